@@ -0,0 +1,236 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "loops.h"
+#include "block_placement.h"
+
+namespace {
+  // an edge with its estimated frequency
+  struct WeightedEdge {
+    Edge *edge;
+    double frequency;
+  };
+
+  // more frequent edges first; of two equally frequent edges, keep the
+  // one that already falls through
+  bool is_more_frequent(const WeightedEdge &a, const WeightedEdge &b) {
+    if (a.frequency != b.frequency) {
+      return a.frequency > b.frequency;
+    }
+    return a.edge->get_kind() == EDGE_FALLTHROUGH && b.edge->get_kind() != EDGE_FALLTHROUGH;
+  }
+}
+
+BlockPlacement::BlockPlacement(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_loops(nullptr)
+  , m_num_chains(0) {
+}
+
+BlockPlacement::~BlockPlacement() {
+}
+
+void BlockPlacement::execute() {
+  m_loops = m_cfg->get_loop_forest();
+  unsigned num_blocks = m_cfg->get_num_blocks();
+  BasicBlock *entry = m_cfg->get_entry_block();
+  BasicBlock *exit = m_cfg->get_exit_block();
+
+  // the block at the end of the original code, which falls through
+  // into the exit
+  BasicBlock *last = nullptr;
+  const ControlFlowGraph::EdgeList &exit_edges = m_cfg->get_incoming_edges(exit);
+  for (auto i = exit_edges.cbegin(); i != exit_edges.cend(); i++) {
+    if ((*i)->get_kind() == EDGE_FALLTHROUGH) {
+      last = (*i)->get_source();
+    }
+  }
+
+  // blocks that can't be reached (e.g., ones emptied by
+  // ControlFlowGraphSimplification) aren't placed; the exit always is
+  std::vector<bool> reachable(num_blocks, false);
+  std::vector<BasicBlock *> work_list;
+  work_list.push_back(entry);
+  reachable[entry->get_id()] = true;
+  reachable[exit->get_id()] = true;
+  while (!work_list.empty()) {
+    BasicBlock *bb = work_list.back();
+    work_list.pop_back();
+    const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+      BasicBlock *succ = (*i)->get_target();
+      if (!reachable[succ->get_id()]) {
+        reachable[succ->get_id()] = true;
+        work_list.push_back(succ);
+      }
+    }
+  }
+  unsigned num_reachable = unsigned(std::count(reachable.begin(), reachable.end(), true));
+  if (last != nullptr && !reachable[last->get_id()]) {
+    last = nullptr;
+  }
+
+  std::vector<WeightedEdge> edges;
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    if (!reachable[(*i)->get_id()]) {
+      continue;
+    }
+    double frequency = get_frequency(*i);
+    const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(*i);
+    for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+      edges.push_back({ *j, frequency * get_probability(*j) });
+    }
+  }
+  std::stable_sort(edges.begin(), edges.end(), is_more_frequent);
+
+  // every block starts out as a chain by itself
+  std::vector<ControlFlowGraph::BlockList> chains(num_blocks);
+  std::vector<unsigned> chain_of(num_blocks);
+  for (unsigned i = 0; i < num_blocks; i++) {
+    chains[i].push_back(m_cfg->get_block(i));
+    chain_of[i] = i;
+  }
+
+  // merge the chain of the target of an edge onto the end of the
+  // source's chain
+  auto merge = [&](Edge *e) {
+    unsigned source = chain_of[e->get_source()->get_id()];
+    unsigned target = chain_of[e->get_target()->get_id()];
+    for (auto i = chains[target].begin(); i != chains[target].end(); i++) {
+      chains[source].push_back(*i);
+      chain_of[(*i)->get_id()] = source;
+    }
+    chains[target].clear();
+  };
+
+  // the code before the first label (e.g., the prologue) has to stay
+  // at the start, so the entry's successor always follows it
+  const ControlFlowGraph::EdgeList &entry_edges = m_cfg->get_outgoing_edges(entry);
+  assert(entry_edges.size() == 1);
+  merge(entry_edges.front());
+
+  for (auto i = edges.begin(); i != edges.end(); i++) {
+    BasicBlock *source = i->edge->get_source(), *target = i->edge->get_target();
+    unsigned source_chain = chain_of[source->get_id()];
+    unsigned target_chain = chain_of[target->get_id()];
+    if (source_chain == target_chain || target == exit || target == entry ||
+        chains[source_chain].back() != source || chains[target_chain].front() != target) {
+      continue;
+    }
+    // a back edge only falls through if that puts the loop's test at
+    // the bottom: it must be a jump to a header that can leave the loop
+    // (like a WHILE loop's condition).  Otherwise it stays a taken
+    // branch, and the loop runs from its header down to the latch.
+    if (is_back_edge(i->edge) && (m_cfg->get_outgoing_edges(source).size() > 1 || !is_exiting(target))) {
+      continue;
+    }
+    // the last block's chain is placed last, so it can't be the entry's
+    if (last != nullptr && (source_chain == chain_of[entry->get_id()] || target_chain == chain_of[entry->get_id()]) &&
+        (source_chain == chain_of[last->get_id()] || target_chain == chain_of[last->get_id()])) {
+      continue;
+    }
+    merge(i->edge);
+  }
+
+  // place the chains, starting with the entry's: the next one is the
+  // chain most frequently branched to from the blocks already placed
+  // (or the first one left, if none are)
+  std::vector<double> connection(num_blocks, 0.0);
+  std::vector<bool> placed(num_blocks, false);
+  unsigned exit_chain = chain_of[exit->get_id()];
+  unsigned last_chain = (last != nullptr) ? chain_of[last->get_id()] : exit_chain;
+  unsigned next = chain_of[entry->get_id()];
+  m_order.clear();
+  m_num_chains = 0;
+  while (true) {
+    placed[next] = true;
+    m_num_chains++;
+    for (auto i = chains[next].begin(); i != chains[next].end(); i++) {
+      BasicBlock *bb = *i;
+      m_order.push_back(bb);
+      double frequency = get_frequency(bb);
+      const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+      for (auto j = outgoing.cbegin(); j != outgoing.cend(); j++) {
+        unsigned target = chain_of[(*j)->get_target()->get_id()];
+        connection[target] = std::max(connection[target], frequency * get_probability(*j));
+      }
+    }
+
+    int best = -1;
+    for (unsigned i = 0; i < num_blocks; i++) {
+      if (chains[i].empty() || !reachable[i] || placed[i] || i == exit_chain || i == last_chain) {
+        continue;
+      }
+      if (best < 0 || connection[i] > connection[best]) {
+        best = int(i);
+      }
+    }
+    if (best >= 0) {
+      next = unsigned(best);
+    } else if (!placed[last_chain]) {
+      next = last_chain;
+    } else if (!placed[exit_chain]) {
+      next = exit_chain;
+    } else {
+      break;
+    }
+  }
+  assert(m_order.size() == num_reachable);
+  assert(m_order.front() == entry && m_order.back() == exit);
+}
+
+// a block's estimated frequency, relative to the entry's
+double BlockPlacement::get_frequency(BasicBlock *bb) {
+  double frequency = 1.0;
+  for (unsigned depth = m_loops->get_depth(bb); depth > 0; depth--) {
+    frequency *= 10.0;
+  }
+  return frequency;
+}
+
+// the estimated probability that control leaves the edge's source
+// through the edge
+double BlockPlacement::get_probability(Edge *e) {
+  const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(e->get_source());
+  if (outgoing.size() != 2) {
+    return 1.0 / double(outgoing.size());
+  }
+  Edge *other = (outgoing[0] == e) ? outgoing[1] : outgoing[0];
+  int prediction = predict(e), other_prediction = predict(other);
+  if (prediction == other_prediction) {
+    return 0.5;
+  }
+  return (prediction > other_prediction) ? 0.9 : 0.1;
+}
+
+// 1 if the edge goes to a loop's header, either entering the loop or
+// going around it again (likely to be taken), -1 if it leaves a loop
+// (unlikely), and 0 otherwise
+int BlockPlacement::predict(Edge *e) {
+  BasicBlock *source = e->get_source(), *target = e->get_target();
+  if (m_loops->is_loop_header(target)) {
+    return 1;
+  }
+  Loop *loop = m_loops->get_loop(source);
+  if (loop != nullptr && !m_loops->contains(loop, target)) {
+    return -1;
+  }
+  return 0;
+}
+
+// can control leave a loop from the block?
+bool BlockPlacement::is_exiting(BasicBlock *bb) {
+  const ControlFlowGraph::EdgeList &outgoing = m_cfg->get_outgoing_edges(bb);
+  for (auto i = outgoing.cbegin(); i != outgoing.cend(); i++) {
+    if (predict(*i) < 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// is the edge a loop's back edge?
+bool BlockPlacement::is_back_edge(Edge *e) {
+  BasicBlock *target = e->get_target();
+  return m_loops->is_loop_header(target) && m_loops->contains(m_loops->get_loop(target), e->get_source());
+}
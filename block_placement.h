@@ -0,0 +1,52 @@
+#ifndef BLOCK_PLACEMENT_H
+#define BLOCK_PLACEMENT_H
+
+#include <vector>
+#include "cfg.h"
+
+// Profile-free block placement: Pettis and Hansen's bottom-up chain
+// merging, driven by static estimates of edge frequencies.  A block's
+// frequency is 10 to the power of its loop nesting depth, and is split
+// between its successors predicting that branches to a loop header
+// (back edges, and entering a loop) are taken and loop exits aren't
+// (and evenly otherwise).  Going from the most frequent edge to the
+// least, two chains of blocks are merged whenever the edge goes from
+// the end of one to the start of the other, so that it will fall
+// through.  A back edge is left as a branch unless making it fall
+// through puts the loop's test at the bottom (a jump back to a WHILE
+// loop's condition), so that each iteration takes one branch.  The
+// chains are then placed starting with the entry's, each next one
+// being the chain most frequently branched to from the ones already
+// placed; the chain that falls into the exit goes last.
+//
+// The result is only an order: ControlFlowGraph::create_instruction_sequence
+// rewrites the branches to match it.
+class BlockPlacement {
+private:
+  ControlFlowGraph *m_cfg;
+  LoopForest *m_loops;
+  std::vector<BasicBlock *> m_order;
+  unsigned m_num_chains;
+
+public:
+  BlockPlacement(ControlFlowGraph *cfg);
+  ~BlockPlacement();
+
+  void execute();
+
+  // get the blocks in the order they should be emitted (the entry
+  // first and the exit last)
+  const ControlFlowGraph::BlockList &get_order() const { return m_order; }
+
+  // get the number of chains the blocks were grouped into
+  unsigned get_num_chains() const { return m_num_chains; }
+
+private:
+  double get_frequency(BasicBlock *bb);
+  double get_probability(Edge *e);
+  int predict(Edge *e);
+  bool is_exiting(BasicBlock *bb);
+  bool is_back_edge(Edge *e);
+};
+
+#endif // BLOCK_PLACEMENT_H
@@ -1,8 +1,12 @@
 #include <cassert>
 #include <cstdio>
 #include <algorithm>
+#include <set>
 #include "cpputil.h"
 #include "cfg.h"
+#include "dominators.h"
+#include "loops.h"
+#include "block_placement.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Operand implementation
@@ -82,6 +86,16 @@ int Operand::get_index_reg() const {
   return m_indexreg;
 }
 
+void Operand::set_base_reg(int reg) {
+  assert(has_base_reg());
+  m_basereg = reg;
+}
+
+void Operand::set_index_reg(int reg) {
+  assert(has_index_reg());
+  m_indexreg = reg;
+}
+
 long Operand::get_int_value() const {
   assert(m_kind == OPERAND_INT_LITERAL);
   return m_ival;
@@ -92,6 +106,12 @@ int Operand::get_offset() const {
   return int(m_ival);
 }
 
+void Operand::set_scale(int scale) {
+  assert(has_index_reg());
+  assert(scale == 1 || scale == 2 || scale == 4 || scale == 8);
+  m_scale = scale;
+}
+
 std::string Operand::get_target_label() const {
   assert((m_kind & OPROP_HAS_LABEL) != 0);
   return m_target_label;
@@ -104,46 +124,54 @@ void Operand::set_m_reg_to_alloc(int m_reg){
 int Operand::get_m_reg_to_alloc(){
   return m_reg_to_alloc;
 }
+
+void Operand::set_stack_slot(int slot){
+  m_stack_slot = slot;
+}
+int Operand::get_stack_slot() const{
+  return m_stack_slot;
+}
 ////////////////////////////////////////////////////////////////////////
 // Instruction implementation
 ////////////////////////////////////////////////////////////////////////
 
 Instruction::Instruction(int opcode)
-  : m_opcode(opcode)
-  , m_num_operands(0) {
+  : m_opcode(opcode) {
 }
 
 Instruction::Instruction(int opcode, Operand op1)
   : m_opcode(opcode)
-  , m_num_operands(1) {
-  m_operands[0] = op1;
+  , m_operands{op1} {
 }
 
 Instruction::Instruction(int opcode, Operand op1, Operand op2)
   : m_opcode(opcode)
-  , m_num_operands(2) {
-  m_operands[0] = op1;
-  m_operands[1] = op2;
+  , m_operands{op1, op2} {
 }
 
 Instruction::Instruction(int opcode, Operand op1, Operand op2, Operand op3)
   : m_opcode(opcode)
-  , m_num_operands(3) {
-  m_operands[0] = op1;
-  m_operands[1] = op2;
-  m_operands[2] = op3;
+  , m_operands{op1, op2, op3} {
 }
 
 unsigned Instruction::get_num_operands() const {
-  return m_num_operands;
+  return unsigned(m_operands.size());
 }
 
 Operand Instruction::get_operand(unsigned index) const {
-  assert(index >= 0);
-  assert(index < m_num_operands);
+  assert(index < m_operands.size());
   return m_operands[index];
 }
 
+void Instruction::add_operand(Operand op) {
+  m_operands.push_back(op);
+}
+
+void Instruction::remove_operand(unsigned index) {
+  assert(index < m_operands.size());
+  m_operands.erase(m_operands.begin() + index);
+}
+
 void Instruction::set_comment(const std::string &comment) {
   m_comment = comment;
 }
@@ -174,6 +202,35 @@ void InstructionSequence::add_instruction(Instruction *ins) {
   m_next_label = "";
 }
 
+void InstructionSequence::insert_instruction(unsigned index, Instruction *ins) {
+  assert(index <= unsigned(m_instr_seq.size()));
+  if (index == unsigned(m_instr_seq.size())) {
+    add_instruction(ins);
+    return;
+  }
+  // a label on the instruction at index now labels the new instruction
+  m_instr_seq.insert(m_instr_seq.begin() + index, ins);
+  m_labels.insert(m_labels.begin() + index + 1, "");
+  for (auto i = m_label_to_index.begin(); i != m_label_to_index.end(); i++) {
+    if (i->second > index) {
+      i->second++;
+    }
+  }
+}
+
+void InstructionSequence::remove_instruction(unsigned index) {
+  assert(index < unsigned(m_instr_seq.size()));
+  assert(m_labels[index].empty());
+  delete m_instr_seq[index];
+  m_instr_seq.erase(m_instr_seq.begin() + index);
+  m_labels.erase(m_labels.begin() + index);
+  for (auto i = m_label_to_index.begin(); i != m_label_to_index.end(); i++) {
+    if (i->second > index) {
+      i->second--;
+    }
+  }
+}
+
 void InstructionSequence::define_label(const std::string &label) {
   assert(m_next_label.empty());
   m_next_label = label;
@@ -309,6 +366,9 @@ std::string PrintInstructionSequence::format_operand(const Operand &operand) {
   case OPERAND_VREG_MEMREF_OFFSET:
     return cpputil::format("%d(vr%d)", operand.get_offset(), operand.get_base_reg());
   case OPERAND_VREG_MEMREF_INDEX:
+    if (operand.get_scale() != 1) {
+      return cpputil::format("(vr%d,vr%d,%d)", operand.get_base_reg(), operand.get_index_reg(), operand.get_scale());
+    }
     return cpputil::format("(vr%d,vr%d)", operand.get_base_reg(), operand.get_index_reg());
   case OPERAND_MREG:
     return get_mreg_name(operand.get_base_reg());
@@ -317,10 +377,23 @@ std::string PrintInstructionSequence::format_operand(const Operand &operand) {
   case OPERAND_MREG_MEMREF_OFFSET:
     return cpputil::format("%d(%s)", operand.get_offset(), get_mreg_name(operand.get_base_reg()).c_str());
   case OPERAND_MREG_MEMREF_INDEX:
+    if (operand.get_scale() != 1) {
+      return cpputil::format("(%s,%s,%d)",
+                             get_mreg_name(operand.get_base_reg()).c_str(),
+                             get_mreg_name(operand.get_index_reg()).c_str(),
+                             operand.get_scale());
+    }
     return cpputil::format("(%s,%s)",
                            get_mreg_name(operand.get_base_reg()).c_str(),
                            get_mreg_name(operand.get_index_reg()).c_str());
   case OPERAND_MREG_MEMREF_OFFSET_INDEX:
+    if (operand.get_scale() != 1) {
+      return cpputil::format("%d(%s, %s, %d)",
+                             operand.get_offset(),
+                             get_mreg_name(operand.get_base_reg()).c_str(),
+                             get_mreg_name(operand.get_index_reg()).c_str(),
+                             operand.get_scale());
+    }
     return cpputil::format("%d(%s, %s)",
                            operand.get_offset(),
                            get_mreg_name(operand.get_base_reg()).c_str(),
@@ -384,16 +457,26 @@ Edge::Edge(BasicBlock *source, BasicBlock *target, EdgeKind kind)
 Edge::~Edge() {
 }
 
+////////////////////////////////////////////////////////////////////////
+// BranchRewriter implementation
+////////////////////////////////////////////////////////////////////////
+
+BranchRewriter::~BranchRewriter() {
+}
+
 ////////////////////////////////////////////////////////////////////////
 // ControlFlowGraph implementation
 ////////////////////////////////////////////////////////////////////////
 
 ControlFlowGraph::ControlFlowGraph()
   : m_entry(nullptr)
-  , m_exit(nullptr) {
+  , m_exit(nullptr)
+  , m_dominator_tree(nullptr)
+  , m_loop_forest(nullptr) {
 }
 
 ControlFlowGraph::~ControlFlowGraph() {
+  invalidate_analyses();
 }
 
 BasicBlock *ControlFlowGraph::get_entry_block() const {
@@ -405,6 +488,7 @@ BasicBlock *ControlFlowGraph::get_exit_block() const {
 }
 
 BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std::string &label) {
+  invalidate_analyses();
   BasicBlock *bb = new BasicBlock(kind, unsigned(m_basic_blocks.size()), label);
   m_basic_blocks.push_back(bb);
   if (bb->get_kind() == BASICBLOCK_ENTRY) {
@@ -420,12 +504,16 @@ BasicBlock *ControlFlowGraph::create_basic_block(BasicBlockKind kind, const std:
 
 Edge *ControlFlowGraph::create_edge(BasicBlock *source, BasicBlock *target, EdgeKind kind) {
   // make sure BasicBlocks belong to this ControlFlowGraph
-  assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), source) != m_basic_blocks.end());
-  assert(std::find(m_basic_blocks.begin(), m_basic_blocks.end(), target) != m_basic_blocks.end());
+  // (a block's id is its index in m_basic_blocks, so this doesn't
+  // need a linear search)
+  assert(source->get_id() < m_basic_blocks.size() && m_basic_blocks[source->get_id()] == source);
+  assert(target->get_id() < m_basic_blocks.size() && m_basic_blocks[target->get_id()] == target);
 
   // make sure this Edge doesn't already exist
   assert(lookup_edge(source, target) == nullptr);
 
+  invalidate_analyses();
+
   // create the edge, add it to outgoing/incoming edge maps
   Edge *e = new Edge(source, target, kind);
   m_outgoing_edges[source].push_back(e);
@@ -434,6 +522,17 @@ Edge *ControlFlowGraph::create_edge(BasicBlock *source, BasicBlock *target, Edge
   return e;
 }
 
+void ControlFlowGraph::remove_edge(Edge *e) {
+  invalidate_analyses();
+
+  // (the edge lists stay in the maps even if they become empty)
+  EdgeList &outgoing = m_outgoing_edges[e->get_source()];
+  EdgeList &incoming = m_incoming_edges[e->get_target()];
+  outgoing.erase(std::find(outgoing.begin(), outgoing.end(), e));
+  incoming.erase(std::find(incoming.begin(), incoming.end(), e));
+  delete e;
+}
+
 Edge *ControlFlowGraph::lookup_edge(BasicBlock *source, BasicBlock *target) const {
   auto i = m_outgoing_edges.find(source);
   if (i == m_outgoing_edges.cend()) {
@@ -460,11 +559,47 @@ const ControlFlowGraph::EdgeList &ControlFlowGraph::get_incoming_edges(BasicBloc
   return i == m_incoming_edges.end() ? m_empty_edge_list : i->second;
 }
 
-InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
+unsigned ControlFlowGraph::get_incoming_index(Edge *e) const {
+  const EdgeList &incoming_edges = get_incoming_edges(e->get_target());
+  auto i = std::find(incoming_edges.cbegin(), incoming_edges.cend(), e);
+  assert(i != incoming_edges.cend());
+  return unsigned(i - incoming_edges.cbegin());
+}
+
+DominatorTree *ControlFlowGraph::get_dominator_tree() {
+  if (m_dominator_tree == nullptr) {
+    m_dominator_tree = new DominatorTree(this);
+    m_dominator_tree->execute();
+  }
+  return m_dominator_tree;
+}
+
+LoopForest *ControlFlowGraph::get_loop_forest() {
+  if (m_loop_forest == nullptr) {
+    m_loop_forest = new LoopForest(this, get_dominator_tree());
+    m_loop_forest->execute();
+  }
+  return m_loop_forest;
+}
+
+void ControlFlowGraph::invalidate_analyses() {
+  delete m_loop_forest;
+  m_loop_forest = nullptr;
+  delete m_dominator_tree;
+  m_dominator_tree = nullptr;
+}
+
+InstructionSequence *ControlFlowGraph::create_instruction_sequence(BranchRewriter *rewriter) {
   assert(m_entry != nullptr);
   assert(m_exit != nullptr);
   assert(m_outgoing_edges.size() == m_incoming_edges.size());
 
+  if (rewriter != nullptr) {
+    BlockPlacement placement(this);
+    placement.execute();
+    return create_placed_instruction_sequence(placement.get_order(), rewriter);
+  }
+
   // Find all Chunks (groups of basic blocks connected via fall-through)
   typedef std::map<BasicBlock *, Chunk *> ChunkMap;
   ChunkMap chunk_map;
@@ -578,6 +713,106 @@ InstructionSequence *ControlFlowGraph::create_instruction_sequence() const {
   return result;
 }
 
+InstructionSequence *ControlFlowGraph::create_placed_instruction_sequence(const BlockList &order,
+                                                                       BranchRewriter *rewriter) {
+  // a successor that doesn't come right after its predecessor is
+  // branched to, so it needs a label
+  for (unsigned i = 0; i < order.size(); i++) {
+    BasicBlock *next = (i + 1 < order.size()) ? order[i + 1] : nullptr;
+    const EdgeList &outgoing_edges = get_outgoing_edges(order[i]);
+    for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+      BasicBlock *target = (*j)->get_target();
+      if (target != next && !target->has_label()) {
+        target->set_label(create_label(target));
+      }
+    }
+  }
+
+  InstructionSequence *result = new InstructionSequence();
+  // labels of blocks that turned out to be empty (where the label of
+  // the block after them is used instead)
+  std::map<std::string, std::string> aliases;
+
+  for (unsigned i = 0; i < order.size(); i++) {
+    BasicBlock *bb = order[i];
+    BasicBlock *next = (i + 1 < order.size()) ? order[i + 1] : nullptr;
+
+    if (bb->has_label()) {
+      if (result->has_label_at_end()) {
+        aliases[bb->get_label()] = result->get_label_at_end();
+      } else {
+        result->define_label(bb->get_label());
+      }
+    }
+
+    Edge *fall_through = nullptr, *branch = nullptr;
+    const EdgeList &outgoing_edges = get_outgoing_edges(bb);
+    for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+      if ((*j)->get_kind() == EDGE_FALLTHROUGH) {
+        fall_through = *j;
+      } else {
+        branch = *j;
+      }
+    }
+
+    // everything but the branch at the end
+    unsigned length = bb->get_length() - (branch != nullptr ? 1 : 0);
+    for (unsigned j = 0; j < length; j++) {
+      result->add_instruction(bb->get_instruction(j)->duplicate());
+    }
+
+    if (branch != nullptr && fall_through == nullptr) {
+      // an unconditional jump isn't needed if its target comes next
+      if (branch->get_target() != next) {
+        result->add_instruction(bb->get_last()->duplicate());
+      }
+    } else if (branch != nullptr) {
+      BasicBlock *target = fall_through->get_target();
+      if (target == next) {
+        result->add_instruction(bb->get_last()->duplicate());
+      } else if (branch->get_target() == next) {
+        // branch to the fall-through successor instead, and fall
+        // through to the branch target
+        result->add_instruction(rewriter->create_inverted_branch(bb->get_last(), target->get_label()));
+      } else {
+        result->add_instruction(bb->get_last()->duplicate());
+        result->add_instruction(rewriter->create_jump(target->get_label()));
+      }
+    } else if (fall_through != nullptr && fall_through->get_target() != next) {
+      result->add_instruction(rewriter->create_jump(fall_through->get_target()->get_label()));
+    }
+  }
+
+  if (!aliases.empty()) {
+    for (auto i = result->begin(); i != result->end(); i++) {
+      Instruction *ins = *i;
+      if (ins->get_num_operands() == 1 && (*ins)[0].get_kind() == OPERAND_LABEL) {
+        auto j = aliases.find((*ins)[0].get_target_label());
+        if (j != aliases.end()) {
+          (*ins)[0] = Operand(j->second);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+std::string ControlFlowGraph::create_label(BasicBlock *bb) const {
+  std::set<std::string> labels;
+  for (auto i = m_basic_blocks.cbegin(); i != m_basic_blocks.cend(); i++) {
+    if ((*i)->has_label()) {
+      labels.insert((*i)->get_label());
+    }
+  }
+  unsigned n = bb->get_id();
+  std::string label;
+  do {
+    label = ".LB" + std::to_string(n++);
+  } while (labels.count(label) > 0);
+  return label;
+}
+
 void ControlFlowGraph::append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const {
   if (bb->has_label()) {
     iseq->define_label(bb->get_label());
@@ -625,7 +860,10 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
   m_basic_blocks[num_instructions] = exit;
 
   std::deque<WorkItem> work_list;
-  work_list.push_back({ ins_index: 0, pred: entry, edge_kind: EDGE_FALLTHROUGH });
+  // (a label on the first instruction is kept even if nothing branches
+  // to it)
+  std::string first_label = m_iseq->has_label(0) ? m_iseq->get_label(0) : "";
+  work_list.push_back({ ins_index: 0, pred: entry, edge_kind: EDGE_FALLTHROUGH, label: first_label });
 
   BasicBlock *last = nullptr;
   while (!work_list.empty()) {
@@ -676,10 +914,17 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
       continue;
     }
 
+    unsigned next_index = item.ins_index + bb->get_length();
+    bool bb_falls_through = falls_through(bb);
+
     // if this basic block ends in a branch, prepare to create an edge
     // to the BasicBlock for the target (creating the BasicBlock if it
     // doesn't exist yet)
-    if (ends_in_branch(bb)) {
+    if (ends_in_branch(bb) && bb_falls_through && get_branch_target_index(bb) == next_index) {
+      // a conditional branch to the next instruction goes there either
+      // way, and would need two edges to the same block: remove it
+      bb->remove_instruction(bb->get_length() - 1);
+    } else if (ends_in_branch(bb)) {
       unsigned target_index = get_branch_target_index(bb);
       // Note: we assume that branch instructions have a single Operand,
       // which is a label
@@ -694,8 +939,8 @@ ControlFlowGraph *ControlFlowGraphBuilder::build() {
     // if this basic block falls through, prepare to create an edge
     // to the BasicBlock for successor instruction (creating it if it doesn't
     // exist yet)
-    if (falls_through(bb)) {
-      unsigned target_index = item.ins_index + bb->get_length();
+    if (bb_falls_through) {
+      unsigned target_index = next_index;
       assert(target_index <= m_iseq->get_length());
       if (target_index == num_instructions) {
         // this is the basic block at the end of the instruction sequence,
@@ -55,8 +55,10 @@ private:
   int m_basereg;              // base register number
   int m_indexreg;             // index register number
   long m_ival;                // literal integer value or offset value
+  int m_scale = 1;            // index register multiplier (1, 2, 4, or 8)
 
   int m_reg_to_alloc = -1;    // machine register number to be alloc
+  int m_stack_slot = -1;      // stack slot number (if not in an mreg)
   std::string m_target_label;
 
 public:
@@ -124,19 +126,30 @@ public:
   // get offset
   int get_offset() const;
 
+  // get/set the scale factor of the index register (1, 2, 4, or 8)
+  int get_scale() const { return m_scale; }
+  void set_scale(int scale);
+
   // get target label name
   std::string get_target_label() const;
 
   // set/get machine register number to be alloc
   void set_m_reg_to_alloc(int m_reg);
   int get_m_reg_to_alloc();
+
+  // change the base or index register number (e.g., when renaming vregs)
+  void set_base_reg(int reg);
+  void set_index_reg(int reg);
+
+  // set/get stack slot number (-1 means the slot is the vreg number)
+  void set_stack_slot(int slot);
+  int get_stack_slot() const;
 };
 
 class Instruction {
 private:
   int m_opcode;
-  unsigned m_num_operands;
-  Operand m_operands[3];
+  std::vector<Operand> m_operands;
   std::string m_comment;
 
 public:
@@ -150,9 +163,14 @@ public:
   unsigned get_num_operands() const;
   Operand get_operand(unsigned index) const;
 
+  // append or remove an operand (for instructions, such as phis,
+  // that have a variable number of operands)
+  void add_operand(Operand op);
+  void remove_operand(unsigned index);
+
   // more convenient notation for referring to operand
   Operand operator[](unsigned index) const {
-    assert(index < m_num_operands);
+    assert(index < m_operands.size());
     return m_operands[index];
   }
 
@@ -160,7 +178,7 @@ public:
   // useful in cases where a jump instruction needs to be changed to
   // a different target
   Operand &operator[](unsigned index) {
-    assert(index < m_num_operands);
+    assert(index < m_operands.size());
     return m_operands[index];
   }
 
@@ -194,6 +212,15 @@ public:
 
   void add_instruction(Instruction *ins);
 
+  // insert an instruction before the instruction at specified index
+  // (or at the end, if index is the length); a label at that index
+  // labels the inserted instruction
+  void insert_instruction(unsigned index, Instruction *ins);
+
+  // remove (and delete) the instruction at specified index; it
+  // must not be labeled
+  void remove_instruction(unsigned index);
+
   // define label to refer to the next instruction to be added
   // to the InstructionSequence; note that at most ONE label
   // should be added to a particular instruction
@@ -320,6 +347,33 @@ public:
   BasicBlock *get_target() const { return m_target; }
 };
 
+// Target-specific branch instructions, needed to emit the blocks of a
+// ControlFlowGraph in a different order than the one they were built
+// from (see ControlFlowGraph::create_instruction_sequence), and to
+// change its control flow (see ControlFlowGraphSimplification)
+class BranchRewriter {
+public:
+  virtual ~BranchRewriter();
+
+  // does the instruction do nothing (e.g., a placeholder keeping a
+  // block's label)?
+  virtual bool is_nop(Instruction *ins) = 0;
+
+  // does the instruction only set the condition tested by the
+  // conditional branch after it?
+  virtual bool is_compare(Instruction *ins) = 0;
+
+  // create an unconditional jump to the label
+  virtual Instruction *create_jump(const std::string &label) = 0;
+
+  // create a conditional branch to the label, taken exactly when the
+  // given conditional branch isn't
+  virtual Instruction *create_inverted_branch(Instruction *branch, const std::string &label) = 0;
+};
+
+class DominatorTree;
+class LoopForest;
+
 // ControlFlowGraph: graph of BasicBlocks connected by Edges.
 // There are dedicated empty entry and exit blocks.
 class ControlFlowGraph {
@@ -334,6 +388,10 @@ private:
   EdgeMap m_incoming_edges;
   EdgeMap m_outgoing_edges;
   EdgeList m_empty_edge_list;
+  // structural analyses, computed on demand and discarded
+  // when blocks or edges are added
+  DominatorTree *m_dominator_tree;
+  LoopForest *m_loop_forest;
 
   // A "Chunk" is a collection of BasicBlocks
   // connected by fall-through edges.  All of the blocks
@@ -404,6 +462,9 @@ public:
   // Create Edge of given kind from source to target
   Edge *create_edge(BasicBlock *source, BasicBlock *target, EdgeKind kind);
 
+  // Remove (and delete) an Edge
+  void remove_edge(Edge *e);
+
   // Look up edge from specified source block to target block:
   // returns a null pointer if no such block exists
   Edge *lookup_edge(BasicBlock *source, BasicBlock *target) const;
@@ -414,11 +475,35 @@ public:
   // Get vector of all incoming edges to given block
   const EdgeList &get_incoming_edges(BasicBlock *bb) const;
 
+  // Get the position of an edge in its target's incoming edges
+  unsigned get_incoming_index(Edge *e) const;
+
+  // Get the dominator tree (computed the first time it's needed
+  // after the CFG changes)
+  DominatorTree *get_dominator_tree();
+
+  // Get the natural loops (computed the first time they're needed
+  // after the CFG changes)
+  LoopForest *get_loop_forest();
+
+  // Discard cached analyses; transformations that change the CFG's
+  // shape must call this
+  void invalidate_analyses();
+
   // Return a "flat" InstructionSequence created from this ControlFlowGraph;
-  // this is useful for optimization passes which create a transformed ControlFlowGraph
-  InstructionSequence *create_instruction_sequence() const;
+  // this is useful for optimization passes which create a transformed ControlFlowGraph.
+  // Without a BranchRewriter, blocks connected by fall-through edges stay
+  // together and the branches are unchanged; with one, the blocks are
+  // placed by BlockPlacement, and branches are inverted, added, or
+  // removed so that each block falls through to the one after it where
+  // it can.
+  InstructionSequence *create_instruction_sequence(BranchRewriter *rewriter = nullptr);
+
+  // make up a label for a block that isn't reached by any branch yet
+  std::string create_label(BasicBlock *bb) const;
 
 private:
+  InstructionSequence *create_placed_instruction_sequence(const BlockList &order, BranchRewriter *rewriter);
   void append_basic_block(InstructionSequence *iseq, const BasicBlock *bb, std::vector<bool> &finished_blocks) const;
   void append_chunk(InstructionSequence *iseq, Chunk *chunk, std::vector<bool> &finished_blocks) const;
   void visit_successors(BasicBlock *bb, std::deque<BasicBlock *> &work_list) const;
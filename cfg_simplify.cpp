@@ -0,0 +1,201 @@
+#include <cassert>
+#include <set>
+#include <vector>
+#include "cfg.h"
+#include "cfg_simplify.h"
+
+ControlFlowGraphSimplification::ControlFlowGraphSimplification(ControlFlowGraph *cfg, BranchRewriter *rewriter)
+  : m_cfg(cfg)
+  , m_rewriter(rewriter)
+  , m_num_removed(0)
+  , m_num_threaded(0)
+  , m_num_folded(0)
+  , m_num_merged(0) {
+}
+
+ControlFlowGraphSimplification::~ControlFlowGraphSimplification() {
+}
+
+void ControlFlowGraphSimplification::execute() {
+  // (blocks are never added, so the block list is stable)
+  bool changed = true;
+  while (changed) {
+    changed = remove_unreachable_blocks();
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+      if (thread_edges(*i)) {
+        changed = true;
+      }
+      if (merge_successor(*i)) {
+        changed = true;
+      }
+    }
+  }
+}
+
+bool ControlFlowGraphSimplification::remove_unreachable_blocks() {
+  std::vector<bool> reached(m_cfg->get_num_blocks(), false);
+  std::vector<BasicBlock *> work_list;
+  work_list.push_back(m_cfg->get_entry_block());
+  reached[m_cfg->get_entry_block()->get_id()] = true;
+  while (!work_list.empty()) {
+    BasicBlock *bb = work_list.back();
+    work_list.pop_back();
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+    for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+      BasicBlock *succ = (*i)->get_target();
+      if (!reached[succ->get_id()]) {
+        reached[succ->get_id()] = true;
+        work_list.push_back(succ);
+      }
+    }
+  }
+
+  bool removed = false;
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    if (reached[bb->get_id()] || bb->get_kind() != BASICBLOCK_INTERIOR ||
+        (bb->get_length() == 0 && m_cfg->get_outgoing_edges(bb).empty())) {
+      continue;
+    }
+    while (!m_cfg->get_outgoing_edges(bb).empty()) {
+      m_cfg->remove_edge(m_cfg->get_outgoing_edges(bb).back());
+    }
+    while (bb->get_length() > 0) {
+      bb->remove_instruction(bb->get_length() - 1);
+    }
+    m_num_removed++;
+    removed = true;
+  }
+  return removed;
+}
+
+// send each of the block's edges that goes to a forwarding block
+// straight to where that block goes
+bool ControlFlowGraphSimplification::thread_edges(BasicBlock *bb) {
+  bool threaded = false;
+  // (the edge list changes as edges are threaded)
+  ControlFlowGraph::EdgeList outgoing_edges = m_cfg->get_outgoing_edges(bb);
+  for (auto i = outgoing_edges.begin(); i != outgoing_edges.end(); i++) {
+    Edge *e = *i;
+    // follow the chain of forwarding blocks to its end (unless it's a
+    // cycle, i.e., an empty infinite loop)
+    std::set<BasicBlock *> seen;
+    BasicBlock *target = e->get_target();
+    while (seen.insert(target).second) {
+      BasicBlock *next = get_forwarding_target(target);
+      if (next == nullptr) {
+        break;
+      }
+      target = next;
+    }
+    // (nothing in the code can be labeled to branch to the exit)
+    if (target == e->get_target() || get_forwarding_target(target) != nullptr ||
+        (e->get_kind() == EDGE_BRANCH && target == m_cfg->get_exit_block())) {
+      continue;
+    }
+    EdgeKind kind = e->get_kind();
+    m_cfg->remove_edge(e);
+    m_num_threaded++;
+    threaded = true;
+
+    if (m_cfg->lookup_edge(bb, target) != nullptr) {
+      // both ways out of the block now go to the same place
+      fold_branch(bb, target);
+      break;
+    }
+    if (kind == EDGE_BRANCH) {
+      if (!target->has_label()) {
+        target->set_label(m_cfg->create_label(target));
+      }
+      Instruction *branch = bb->get_last();
+      assert(branch->get_num_operands() == 1 && (*branch)[0].get_kind() == OPERAND_LABEL);
+      (*branch)[0] = Operand(target->get_label());
+    }
+    m_cfg->create_edge(bb, target, kind);
+  }
+  return threaded;
+}
+
+// merge the block's only successor into it, if the block is its only
+// predecessor
+bool ControlFlowGraphSimplification::merge_successor(BasicBlock *bb) {
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+  if (bb->get_kind() != BASICBLOCK_INTERIOR || outgoing_edges.size() != 1) {
+    return false;
+  }
+  Edge *e = outgoing_edges.front();
+  BasicBlock *succ = e->get_target();
+  if (succ == bb || succ->get_kind() != BASICBLOCK_INTERIOR || m_cfg->get_incoming_edges(succ).size() != 1) {
+    return false;
+  }
+
+  if (e->get_kind() == EDGE_BRANCH) {
+    // the jump to the successor
+    bb->remove_instruction(bb->get_length() - 1);
+  }
+  m_cfg->remove_edge(e);
+  for (auto i = succ->cbegin(); i != succ->cend(); i++) {
+    bb->add_instruction((*i)->duplicate());
+  }
+  while (succ->get_length() > 0) {
+    succ->remove_instruction(succ->get_length() - 1);
+  }
+  while (!m_cfg->get_outgoing_edges(succ).empty()) {
+    Edge *succ_edge = m_cfg->get_outgoing_edges(succ).front();
+    BasicBlock *target = succ_edge->get_target();
+    EdgeKind kind = succ_edge->get_kind();
+    m_cfg->remove_edge(succ_edge);
+    m_cfg->create_edge(bb, target, kind);
+  }
+  remove_nops(bb);
+  m_num_merged++;
+  return true;
+}
+
+// if the block does nothing but go to a single successor, get the
+// successor (otherwise, a null pointer)
+BasicBlock *ControlFlowGraphSimplification::get_forwarding_target(BasicBlock *bb) {
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+  if (bb->get_kind() != BASICBLOCK_INTERIOR || outgoing_edges.size() != 1) {
+    return nullptr;
+  }
+  Edge *e = outgoing_edges.front();
+  // (the jump at the end, if any, isn't checked)
+  unsigned length = bb->get_length() - (e->get_kind() == EDGE_BRANCH ? 1 : 0);
+  for (unsigned i = 0; i < length; i++) {
+    if (!m_rewriter->is_nop(bb->get_instruction(i))) {
+      return nullptr;
+    }
+  }
+  return e->get_target();
+}
+
+// remove the conditional branch at the end of the block (and the
+// compare before it), now that both of its edges go to the target
+void ControlFlowGraphSimplification::fold_branch(BasicBlock *bb, BasicBlock *target) {
+  Edge *e = m_cfg->lookup_edge(bb, target);
+  assert(m_cfg->get_outgoing_edges(bb).size() == 1 && bb->get_length() > 0);
+  bb->remove_instruction(bb->get_length() - 1);
+  if (bb->get_length() > 0 && m_rewriter->is_compare(bb->get_last())) {
+    bb->remove_instruction(bb->get_length() - 1);
+  }
+  m_cfg->remove_edge(e);
+  m_cfg->create_edge(bb, target, EDGE_FALLTHROUGH);
+  m_num_folded++;
+}
+
+// remove the block's nops, unless that would leave it empty
+void ControlFlowGraphSimplification::remove_nops(BasicBlock *bb) {
+  bool has_code = false;
+  for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+    has_code = has_code || !m_rewriter->is_nop(*i);
+  }
+  if (!has_code) {
+    return;
+  }
+  for (unsigned i = bb->get_length(); i > 0; i--) {
+    if (m_rewriter->is_nop(bb->get_instruction(i - 1))) {
+      bb->remove_instruction(i - 1);
+    }
+  }
+}
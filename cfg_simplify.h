@@ -0,0 +1,57 @@
+#ifndef CFG_SIMPLIFY_H
+#define CFG_SIMPLIFY_H
+
+#include "cfg.h"
+
+// Control-flow cleanup over a ControlFlowGraph (high-level or x86-64,
+// with the matching BranchRewriter), repeated until nothing changes:
+//   - blocks not reachable from the entry are emptied and disconnected
+//   - an edge into a block that only jumps (or falls through) to
+//     another one, like the blocks holding just a placeholder that the
+//     code generator leaves after an IF, is threaded to that block
+//   - a conditional branch whose two successors became the same block
+//     is removed, along with its compare
+//   - a block is merged into its predecessor when each is the other's
+//     only neighbor, removing the jump between them
+//
+// Blocks can move away from the ones they fell through to, so the
+// result must be flattened with a BranchRewriter (see
+// ControlFlowGraph::create_instruction_sequence).  Phis aren't
+// updated, so the CFG must not be in SSA form.
+class ControlFlowGraphSimplification {
+private:
+  ControlFlowGraph *m_cfg;
+  BranchRewriter *m_rewriter;
+  unsigned m_num_removed;
+  unsigned m_num_threaded;
+  unsigned m_num_folded;
+  unsigned m_num_merged;
+
+public:
+  ControlFlowGraphSimplification(ControlFlowGraph *cfg, BranchRewriter *rewriter);
+  ~ControlFlowGraphSimplification();
+
+  void execute();
+
+  // get the number of unreachable blocks removed
+  unsigned get_num_removed() const { return m_num_removed; }
+
+  // get the number of edges threaded through forwarding blocks
+  unsigned get_num_threaded() const { return m_num_threaded; }
+
+  // get the number of conditional branches removed
+  unsigned get_num_folded() const { return m_num_folded; }
+
+  // get the number of blocks merged into their predecessors
+  unsigned get_num_merged() const { return m_num_merged; }
+
+private:
+  bool remove_unreachable_blocks();
+  bool thread_edges(BasicBlock *bb);
+  bool merge_successor(BasicBlock *bb);
+  BasicBlock *get_forwarding_target(BasicBlock *bb);
+  void fold_branch(BasicBlock *bb, BasicBlock *target);
+  void remove_nops(BasicBlock *bb);
+};
+
+#endif // CFG_SIMPLIFY_H
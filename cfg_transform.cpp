@@ -4,6 +4,7 @@
 #include "cfg.h"
 #include "cfg_transform.h"
 #include "live_vregs.h"
+#include "highlevel.h"
 #include "x86_64.h"
 #include <map>
 
@@ -60,10 +61,10 @@ ControlFlowGraph *ControlFlowGraphTransform::transform_cfg() {
   return result;
 }
 
-HighLevelControlFlowGraphTransform::HighLevelControlFlowGraphTransform(ControlFlowGraph *cfg, LiveVregs *lvreg)
+HighLevelControlFlowGraphTransform::HighLevelControlFlowGraphTransform(ControlFlowGraph *cfg, RegisterAllocator *allocator, StackSlotAllocator *slots)
 : ControlFlowGraphTransform(cfg){
-  this->lvreg = lvreg;
-  m_cfg = cfg;
+  m_allocator = allocator;
+  m_slots = slots;
 }
 
 HighLevelControlFlowGraphTransform::~HighLevelControlFlowGraphTransform(){
@@ -72,101 +73,42 @@ HighLevelControlFlowGraphTransform::~HighLevelControlFlowGraphTransform(){
 
 // alloc mreg to vreg
 InstructionSequence *HighLevelControlFlowGraphTransform::transform_basic_block(BasicBlock *bb){
-  //std::cout << "enter basic block transform" << std::endl;
-  auto it = bb->begin();
-
-  Instruction* ins;
   InstructionSequence *new_iseq = new InstructionSequence();
-  int num_operand;
-  Operand reg_0, reg_1;
-
-  while(it != bb->end()){
-    ins = *it;
-    num_operand = ins->get_num_operands();
-    
-    Instruction* new_ins = ins->duplicate();
-
-    for (int i = 0; i < num_operand; i++ ){
-      
-        Operand *op = &(*new_ins)[i];
-
-        // check if op is a vreg
-        if (op->get_kind() == OPERAND_VREG || op->get_kind() == OPERAND_VREG_MEMREF || op->get_kind() == OPERAND_VREG_MEMREF_OFFSET) {
-
-            // vreg not alloc a mreg
-            if (vreg_mreg.find(op->get_base_reg()) == vreg_mreg.end()){
-              if (mreg_alloc < mreg_aval) {
-                op->set_m_reg_to_alloc(free_mreg.back());
-
-                vreg_mreg.insert({op->get_base_reg(), free_mreg.back()});
-                free_mreg.pop_back();
-                mreg_alloc++;
-
-                max_mreg_use = (max_mreg_use>mreg_alloc)?max_mreg_use:mreg_alloc;
-
-                // already alloc
-              } else {
-                // op with the same id, alloc a same mreg
-                if (visited.find(op->get_base_reg()) == visited.end()) {
-                  visited.insert(op->get_base_reg());
-                  vreg_count++;
-                }
-              }
-            } else {
-              op->set_m_reg_to_alloc(vreg_mreg.find(op->get_base_reg())->second);
-            }
-        }
-      } 
-    new_iseq->add_instruction(new_ins);
-    
-    // check if any mreg can be reused
-    reset_mreg_after_ins(bb, ins);
-    it++;
-  }
 
-  return new_iseq;
-}
+  for (unsigned index = 0; index < bb->get_length(); index++){
+    Instruction* new_ins = bb->get_instruction(index)->duplicate();
 
-// check dead vreg 
-void HighLevelControlFlowGraphTransform::reset_mreg_after_ins(BasicBlock *bb, Instruction *ins){
-  LiveVregs::LiveSet live_set = lvreg->get_fact_after_instruction(bb, ins);
-  LiveVregs::LiveSet live_set_global;
-  std::set<int> live_vreg;
-  std::set<int> live_vreg_global;
-
-  // live vreg after a ins
-  for (unsigned i = 0; i < LiveVregs::MAX_VREGS; i++) {
-    if (live_set.test(i)) {
-      live_vreg.insert(i);
+    // caller-saved mregs holding values needed after a call
+    // are saved to their stack slots around the call
+    std::vector<int> saved = m_allocator->get_saved_across_call(bb, index);
+    for (auto i = saved.begin(); i != saved.end(); i++) {
+      new_iseq->add_instruction(new Instruction(HINS_SPILL, allocated_vreg(*i)));
     }
-  }
 
-  std::map<int, int>::iterator it = vreg_mreg.begin();
-
-  // iterate all alive vreg
-  while (it != vreg_mreg.end()) {
-
-    if (live_vreg.count(it->first) == 0) { 
-      int flag, start;
-      // check if another basic block needs the vreg
-      for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
-        if (*i == bb) {
-          start = 1; // mark current bb
-        } else if (start == 1) {
-          live_set_global = lvreg->get_fact_at_beginning_of_block(*i);
-          if (live_set_global.test(it->first)){
-            flag = 1;
-          }
-        }
-      }
-      // vreg is dead, realloc its mreg
-      if (flag != 1){
-        free_mreg.push_back(it->second);
-        vreg_mreg.erase(it);
-        mreg_alloc--;
+    for (unsigned i = 0; i < new_ins->get_num_operands(); i++){
+      Operand *op = &(*new_ins)[i];
+
+      // check if op is a vreg
+      if (op->get_kind() == OPERAND_VREG || op->get_kind() == OPERAND_VREG_MEMREF || op->get_kind() == OPERAND_VREG_MEMREF_OFFSET) {
+        // spilled vregs keep m_reg_to_alloc == -1 and use their stack slot
+        op->set_m_reg_to_alloc(m_allocator->get_mreg(op->get_base_reg()));
+        op->set_stack_slot(m_slots->get_slot(op->get_base_reg()));
       }
+    }
+    new_iseq->add_instruction(new_ins);
 
+    for (auto i = saved.begin(); i != saved.end(); i++) {
+      new_iseq->add_instruction(new Instruction(HINS_RELOAD, allocated_vreg(*i)));
     }
-    it ++;
   }
-}
\ No newline at end of file
+
+  return new_iseq;
+}
+
+// make a vreg operand with its allocated mreg
+Operand HighLevelControlFlowGraphTransform::allocated_vreg(int vreg){
+  Operand op(OPERAND_VREG, vreg);
+  op.set_m_reg_to_alloc(m_allocator->get_mreg(vreg));
+  op.set_stack_slot(m_slots->get_slot(vreg));
+  return op;
+}
@@ -5,7 +5,7 @@
 #include <map>
 #include <vector>
 #include "live_vregs.h"
-#include <set>
+#include "regalloc.h"
 
 class ControlFlowGraph;
 
@@ -25,36 +25,29 @@ public:
 
 class HighLevelControlFlowGraphTransform:public ControlFlowGraphTransform {
 private:
-  ControlFlowGraph *m_cfg;
-  LiveVregs *lvreg;
-  int mreg_aval = 8;
-  int mreg_alloc = 0;
-
-  int max_mreg_use = 0;
-
-  int vreg_count = 0;
-  std::vector<int> free_mreg = {0, 1, 2, 3, 4, 5, 6, 7};
-  std::map<int, int> vreg_mreg;
-  std::set<int> visited;
+  RegisterAllocator *m_allocator;
+  StackSlotAllocator *m_slots;
 
 public:
-  HighLevelControlFlowGraphTransform(ControlFlowGraph *cfg, LiveVregs *lvreg);
+  HighLevelControlFlowGraphTransform(ControlFlowGraph *cfg, RegisterAllocator *allocator, StackSlotAllocator *slots);
   virtual ~HighLevelControlFlowGraphTransform();
 
+  // rewrite vreg operands to use the mregs and stack slots chosen
+  // by the allocators
   virtual InstructionSequence *transform_basic_block(BasicBlock *bb);
 
-  // reset mreg alloc
-  void reset_mreg_after_ins(BasicBlock *bb, Instruction *ins);
-
-  // get max num of vreg used 
+  // get num of vreg stack slots needed
   int get_vreg_count() {
-    return vreg_count;
+    return int(m_slots->get_num_slots());
   }
 
-  // get max num of mreg used 
+  // get num of callee-saved mregs to save
   int get_max_mreg_use() {
-    return max_mreg_use;
+    return m_allocator->get_max_mreg_use();
   }
+
+private:
+  Operand allocated_vreg(int vreg);
 };
 
 #endif // CFG_TRANSFORM_H
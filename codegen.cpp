@@ -11,6 +11,8 @@
 #include <ostream>
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////
 // Main class CodeGenerator as a ASTvisitor
@@ -25,8 +27,13 @@ private:
   SymbolTable *symtable = nullptr;
   
   InstructionSequence *code = new InstructionSequence();
+  // number of vregs handed out so far (the high-water mark: vreg
+  // numbers are reused, so this is also the number of distinct vregs)
   int vreg_count = 0;
-  int max_vreg_count = 0;
+  // temporaries that are free for reuse, and temporaries allocated
+  // since the last statement ended
+  std::set<int> free_vregs;
+  std::vector<int> statement_vregs;
   int label_count = 0;
 
 public:
@@ -82,10 +89,13 @@ private:
 
   int get_jmp_ins(struct Node *ast, bool invert = 1);
 
-  // alloc a new vreg
+  // alloc a vreg for a temporary (only live within a statement)
   int alloc_vreg();
 
-  // reset allocated vreg after instructions
+  // alloc a vreg for a variable (never reused)
+  int alloc_var_vreg();
+
+  // release temporaries allocated by the statement just translated
   void rest_vreg();
 
   // alloc a new label for code blocks
@@ -132,6 +142,7 @@ void CodeGenerator::visit_function(struct Node *ast){
 
   visit_instructions(node_get_kid(ast, 2));
   visit_return(node_get_kid(ast, 3));
+  rest_vreg();
 
   this->symtable = this->symtable->get_parent();
 }
@@ -217,6 +228,9 @@ void CodeGenerator::visit_instructions(struct Node *ast){
     default:
       error_at_node(instruction, "visit_instructions: Unknown Instruction");
   }
+
+  // temporaries don't outlive the statement that computed them
+  rest_vreg();
   
   if(num_kids == 2){
     return visit_instructions(node_get_kid(ast, 1));
@@ -292,7 +306,7 @@ void CodeGenerator::visit_var_ref(struct Node *ast){
     if (this->symtable->get_symbol(ast->get_str())->get_type()->get_kind() == BASE_TYPE){
       struct Operand* op = this->symtable->get_symbol(ast->get_str())->get_operand();
       if (op == nullptr){
-        oprand = new Operand(OPERAND_VREG, this->alloc_vreg());
+        oprand = new Operand(OPERAND_VREG, this->alloc_var_vreg());
         this->symtable->get_symbol(ast->get_str())->set_operand(oprand);
       } else {
         oprand = op;
@@ -738,6 +752,19 @@ void CodeGenerator::visit_compare(struct Node *ast, struct Operand *left, struct
 // helper functions //
 
 int CodeGenerator::alloc_vreg(){
+  int vreg;
+  // reuse the lowest free temporary, so vreg numbers stay dense
+  if (!this->free_vregs.empty()) {
+    vreg = *this->free_vregs.begin();
+    this->free_vregs.erase(this->free_vregs.begin());
+  } else {
+    vreg = this->vreg_count++;
+  }
+  this->statement_vregs.push_back(vreg);
+  return vreg;
+}
+
+int CodeGenerator::alloc_var_vreg(){
   return this->vreg_count++;
 }
 
@@ -750,10 +777,13 @@ std::string CodeGenerator::alloc_label(){
   return label + std::to_string(this->label_count++);
 }
 
-// reset vreg allocation and record maximum vreg allocated
+// make the temporaries of the statement just translated available
+// again.  Statements only nest inside other statements' bodies, and an
+// enclosing statement's temporaries (e.g., an IF condition) are dead
+// once its body starts, so releasing them early is safe.
 void CodeGenerator::rest_vreg(){
-  this->max_vreg_count = (this->vreg_count > this->max_vreg_count) ? this->vreg_count : this->max_vreg_count;
-  this->vreg_count = 0;
+  this->free_vregs.insert(this->statement_vregs.begin(), this->statement_vregs.end());
+  this->statement_vregs.clear();
 }
 
 // get correct jump code
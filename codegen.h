@@ -24,7 +24,9 @@ void generator_generate_highlevel(struct CodeGenerator *cgt);
 // retrive high-level code
 struct InstructionSequence *generator_get_highlevel(struct CodeGenerator *cgt);
 
-// get number of vreg allcated (for low-level code generator)
+// get number of vreg allcated (for low-level code generator); temporary
+// vregs are reused across statements, so this is the high-water mark
+// of vreg numbers, not the number of values computed
 int get_vreg_offset(struct CodeGenerator *cgt);
 
 void generator_set_flag(struct CodeGenerator *cgt, char flag);
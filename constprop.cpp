@@ -0,0 +1,416 @@
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "ssa.h"
+#include "constprop.h"
+
+namespace {
+  bool fits_in_imm32(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+  }
+}
+
+ConstantPropagation::ConstantPropagation(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_reached(cfg->get_num_blocks(), false)
+  , m_num_folded(0)
+  , m_num_branches_folded(0)
+  , m_num_blocks_removed(0) {
+}
+
+ConstantPropagation::~ConstantPropagation() {
+}
+
+void ConstantPropagation::execute() {
+  find_uses();
+  propagate();
+  rewrite();
+}
+
+void ConstantPropagation::find_uses() {
+  unsigned num_vregs = count_vregs(m_cfg);
+  std::vector<bool> has_def(num_vregs, false);
+  m_uses.resize(num_vregs);
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+      Instruction *ins = *j;
+      if (is_def(ins)) {
+        has_def[ins->get_operand(0).get_base_reg()] = true;
+      }
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (!is_use(ins, int(k))) {
+          continue;
+        }
+        Operand operand = ins->get_operand(k);
+        m_uses[operand.get_base_reg()].push_back(Use(bb, ins));
+        if (operand.has_index_reg()) {
+          m_uses[operand.get_index_reg()].push_back(Use(bb, ins));
+        }
+      }
+    }
+  }
+
+  // a vreg with no def has whatever value its storage happens to hold
+  m_values.assign(num_vregs, LatticeValue(LATTICE_TOP));
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    if (!has_def[vreg]) {
+      m_values[vreg] = LatticeValue(LATTICE_BOTTOM);
+    }
+  }
+}
+
+void ConstantPropagation::propagate() {
+  BasicBlock *entry = m_cfg->get_entry_block();
+  m_reached[entry->get_id()] = true;
+  visit_block(entry);
+
+  while (!m_edge_worklist.empty() || !m_vreg_worklist.empty()) {
+    while (!m_edge_worklist.empty()) {
+      Edge *e = m_edge_worklist.front();
+      m_edge_worklist.pop_front();
+      BasicBlock *bb = e->get_target();
+
+      // the phis have a new executable operand
+      for (unsigned i = 0; i < bb->get_length() && is_phi(bb->get_instruction(i)); i++) {
+        visit_phi(bb, bb->get_instruction(i));
+      }
+
+      if (!m_reached[bb->get_id()]) {
+        m_reached[bb->get_id()] = true;
+        visit_block(bb);
+      }
+    }
+
+    while (!m_vreg_worklist.empty()) {
+      int vreg = m_vreg_worklist.front();
+      m_vreg_worklist.pop_front();
+
+      const std::vector<Use> &uses = m_uses[vreg];
+      for (auto i = uses.begin(); i != uses.end(); i++) {
+        BasicBlock *bb = i->first;
+        Instruction *ins = i->second;
+        if (!m_reached[bb->get_id()]) {
+          continue;
+        }
+        if (is_phi(ins)) {
+          visit_phi(bb, ins);
+        } else if (ins->get_opcode() == HINS_INT_COMPARE) {
+          visit_branch(bb);
+        } else if (is_def(ins)) {
+          visit_instruction(ins);
+        }
+      }
+    }
+  }
+}
+
+void ConstantPropagation::visit_block(BasicBlock *bb) {
+  // (phis are visited when their operands' edges become executable)
+  for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+    if (!is_phi(*i) && is_def(*i)) {
+      visit_instruction(*i);
+    }
+  }
+  visit_branch(bb);
+}
+
+void ConstantPropagation::visit_phi(BasicBlock *bb, Instruction *phi) {
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+  LatticeValue value(LATTICE_TOP);
+  for (unsigned j = 0; j < incoming_edges.size(); j++) {
+    if (m_executable.count(incoming_edges[j]) > 0) {
+      value = meet(value, get_value(phi->get_operand(j + 1)));
+    }
+  }
+  set_value(phi->get_operand(0).get_base_reg(), value);
+}
+
+void ConstantPropagation::visit_instruction(Instruction *ins) {
+  LatticeValue value;
+  int opcode = ins->get_opcode();
+  switch (opcode) {
+  case HINS_MOV:
+  case HINS_LOAD_ICONST:
+    value = get_value(ins->get_operand(1));
+    break;
+  case HINS_INT_ADD:
+  case HINS_INT_SUB:
+  case HINS_INT_MUL:
+  case HINS_INT_DIV:
+  case HINS_INT_MOD:
+    value = fold(opcode, get_value(ins->get_operand(1)), get_value(ins->get_operand(2)));
+    break;
+  default:
+    // loads, input, calls, etc.
+    value = LatticeValue(LATTICE_BOTTOM);
+    break;
+  }
+  set_value(ins->get_operand(0).get_base_reg(), value);
+}
+
+void ConstantPropagation::visit_branch(BasicBlock *bb) {
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+
+  unsigned len = bb->get_length();
+  if (len >= 2 && is_conditional_branch(bb->get_last()) &&
+      bb->get_instruction(len - 2)->get_opcode() == HINS_INT_COMPARE) {
+    Instruction *cmp = bb->get_instruction(len - 2);
+    LatticeValue a = get_value(cmp->get_operand(0));
+    LatticeValue b = get_value(cmp->get_operand(1));
+    if (a.kind == LATTICE_TOP || b.kind == LATTICE_TOP) {
+      // nothing is known yet
+      return;
+    }
+    if (a.kind == LATTICE_CONST && b.kind == LATTICE_CONST) {
+      EdgeKind kind = branch_taken(bb->get_last()->get_opcode(), a.value, b.value) ? EDGE_BRANCH : EDGE_FALLTHROUGH;
+      for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+        if ((*i)->get_kind() == kind) {
+          mark_executable(*i);
+          return;
+        }
+      }
+    }
+  }
+
+  for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+    mark_executable(*i);
+  }
+}
+
+void ConstantPropagation::mark_executable(Edge *e) {
+  if (m_executable.insert(e).second) {
+    m_edge_worklist.push_back(e);
+  }
+}
+
+void ConstantPropagation::set_value(int vreg, LatticeValue value) {
+  // values only move down the lattice
+  LatticeValue new_value = meet(m_values[vreg], value);
+  if (new_value != m_values[vreg]) {
+    m_values[vreg] = new_value;
+    m_vreg_worklist.push_back(vreg);
+  }
+}
+
+ConstantPropagation::LatticeValue ConstantPropagation::get_value(const Operand &operand) const {
+  switch (operand.get_kind()) {
+  case OPERAND_INT_LITERAL:
+    if (fits_in_imm32(operand.get_int_value())) {
+      return LatticeValue(LATTICE_CONST, operand.get_int_value());
+    }
+    return LatticeValue(LATTICE_BOTTOM);
+  case OPERAND_VREG:
+    return m_values[operand.get_base_reg()];
+  default:
+    return LatticeValue(LATTICE_BOTTOM);
+  }
+}
+
+ConstantPropagation::LatticeValue ConstantPropagation::meet(LatticeValue a, LatticeValue b) {
+  if (a.kind == LATTICE_TOP) {
+    return b;
+  }
+  if (b.kind == LATTICE_TOP) {
+    return a;
+  }
+  if (a == b) {
+    return a;
+  }
+  return LatticeValue(LATTICE_BOTTOM);
+}
+
+ConstantPropagation::LatticeValue ConstantPropagation::fold(int opcode, LatticeValue a, LatticeValue b) {
+  // anything times zero is zero
+  if (opcode == HINS_INT_MUL &&
+      ((a.kind == LATTICE_CONST && a.value == 0) || (b.kind == LATTICE_CONST && b.value == 0))) {
+    return LatticeValue(LATTICE_CONST, 0);
+  }
+  if (a.kind == LATTICE_BOTTOM || b.kind == LATTICE_BOTTOM) {
+    return LatticeValue(LATTICE_BOTTOM);
+  }
+  if (a.kind == LATTICE_TOP || b.kind == LATTICE_TOP) {
+    return LatticeValue(LATTICE_TOP);
+  }
+
+  // both operands fit in 32 bits, so none of these overflow
+  long result;
+  switch (opcode) {
+  case HINS_INT_ADD: result = a.value + b.value; break;
+  case HINS_INT_SUB: result = a.value - b.value; break;
+  case HINS_INT_MUL: result = a.value * b.value; break;
+  case HINS_INT_DIV:
+  case HINS_INT_MOD:
+    if (b.value == 0) {
+      // leave the division to fail at run time
+      return LatticeValue(LATTICE_BOTTOM);
+    }
+    // (C++ division truncates toward zero, like idivq)
+    result = (opcode == HINS_INT_DIV) ? a.value / b.value : a.value % b.value;
+    break;
+  default:
+    assert(false);
+    return LatticeValue(LATTICE_BOTTOM);
+  }
+  if (!fits_in_imm32(result)) {
+    return LatticeValue(LATTICE_BOTTOM);
+  }
+  return LatticeValue(LATTICE_CONST, result);
+}
+
+bool ConstantPropagation::branch_taken(int opcode, long a, long b) {
+  // "cmpi a, b" followed by a conditional jump branches if a <op> b
+  switch (opcode) {
+  case HINS_JE:   return a == b;
+  case HINS_JNE:  return a != b;
+  case HINS_JLT:  return a < b;
+  case HINS_JLTE: return a <= b;
+  case HINS_JGT:  return a > b;
+  case HINS_JGTE: return a >= b;
+  default:
+    assert(false);
+    return false;
+  }
+}
+
+void ConstantPropagation::rewrite() {
+  // (removing edges adds no blocks, so the block list is stable)
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    if (m_reached[bb->get_id()]) {
+      rewrite_block(bb);
+      fold_branch(bb);
+    } else {
+      remove_block(bb);
+    }
+  }
+  remove_dead_defs();
+}
+
+void ConstantPropagation::rewrite_block(BasicBlock *bb) {
+  std::vector<int> const_phis;
+  unsigned num_phis = 0;
+
+  for (unsigned i = 0; i < bb->get_length(); i++) {
+    Instruction *ins = bb->get_instruction(i);
+
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      Operand operand = ins->get_operand(k);
+      if (operand.get_kind() != OPERAND_VREG || !is_use(ins, int(k)) || !accepts_literal(ins, k)) {
+        continue;
+      }
+      LatticeValue value = m_values[operand.get_base_reg()];
+      if (value.kind == LATTICE_CONST) {
+        (*ins)[k] = Operand(OPERAND_INT_LITERAL, value.value);
+        m_num_folded++;
+      }
+    }
+
+    if (!is_def(ins)) {
+      continue;
+    }
+    Operand dest = ins->get_operand(0);
+    LatticeValue value = m_values[dest.get_base_reg()];
+    if (is_phi(ins)) {
+      num_phis++;
+      if (value.kind == LATTICE_CONST) {
+        const_phis.push_back(int(i));
+      }
+    } else if (value.kind == LATTICE_CONST && ins->get_opcode() != HINS_MOV) {
+      // compute the value at compile time
+      *ins = Instruction(HINS_MOV, dest, Operand(OPERAND_INT_LITERAL, value.value));
+    }
+  }
+
+  // a phi with a constant value becomes a copy of the constant after
+  // the remaining phis
+  for (auto i = const_phis.rbegin(); i != const_phis.rend(); i++) {
+    Operand dest = bb->get_instruction(unsigned(*i))->get_operand(0);
+    long value = m_values[dest.get_base_reg()].value;
+    bb->remove_instruction(unsigned(*i));
+    num_phis--;
+    bb->insert_instruction(num_phis, new Instruction(HINS_MOV, dest, Operand(OPERAND_INT_LITERAL, value)));
+  }
+}
+
+void ConstantPropagation::fold_branch(BasicBlock *bb) {
+  // a conditional branch whose outcome is known: keep only the
+  // executable edge
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+  Edge *live_edge = nullptr, *dead_edge = nullptr;
+  for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+    if (m_executable.count(*i) > 0) {
+      live_edge = *i;
+    } else {
+      dead_edge = *i;
+    }
+  }
+  if (dead_edge == nullptr || live_edge == nullptr) {
+    return;
+  }
+
+  unsigned len = bb->get_length();
+  assert(len >= 2 && is_conditional_branch(bb->get_last()));
+  std::string target = bb->get_last()->get_operand(0).get_target_label();
+  bb->remove_instruction(len - 1);
+  bb->remove_instruction(len - 2);
+  if (live_edge->get_kind() == EDGE_BRANCH) {
+    bb->add_instruction(new Instruction(HINS_JUMP, Operand(target)));
+  } else if (bb->get_length() == 0) {
+    // keep a placeholder for the block's label
+    bb->add_instruction(new Instruction(HINS_EMPTY));
+  }
+  ssa_remove_edge(m_cfg, dead_edge);
+  m_num_branches_folded++;
+}
+
+void ConstantPropagation::remove_dead_defs() {
+  // constants copied into vregs that are no longer used
+  std::vector<unsigned> num_uses(m_values.size(), 0);
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (is_use(ins, int(k))) {
+          Operand operand = ins->get_operand(k);
+          num_uses[operand.get_base_reg()]++;
+          if (operand.has_index_reg()) {
+            num_uses[operand.get_index_reg()]++;
+          }
+        }
+      }
+    }
+  }
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    for (unsigned j = bb->get_length(); j > 0; j--) {
+      Instruction *ins = bb->get_instruction(j - 1);
+      if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_INT_LITERAL &&
+          m_values[ins->get_operand(0).get_base_reg()].kind == LATTICE_CONST &&
+          num_uses[ins->get_operand(0).get_base_reg()] == 0) {
+        bb->remove_instruction(j - 1);
+      }
+    }
+    if (bb->get_length() == 0 && bb->get_kind() == BASICBLOCK_INTERIOR && m_reached[bb->get_id()]) {
+      bb->add_instruction(new Instruction(HINS_EMPTY));
+    }
+  }
+}
+
+void ConstantPropagation::remove_block(BasicBlock *bb) {
+  if (bb->get_kind() != BASICBLOCK_INTERIOR) {
+    return;
+  }
+  // disconnect the block, so nothing can fall through from it
+  while (!m_cfg->get_outgoing_edges(bb).empty()) {
+    ssa_remove_edge(m_cfg, m_cfg->get_outgoing_edges(bb).back());
+  }
+  while (bb->get_length() > 0) {
+    bb->remove_instruction(bb->get_length() - 1);
+  }
+  m_num_blocks_removed++;
+}
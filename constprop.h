@@ -0,0 +1,96 @@
+#ifndef CONSTPROP_H
+#define CONSTPROP_H
+
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include "cfg.h"
+
+// Sparse conditional constant propagation (Wegman & Zadeck) over a
+// high-level ControlFlowGraph in SSA form (see SSABuilder).  Each vreg
+// starts out undefined (TOP) and is lowered to a constant or to
+// "varying" (BOTTOM) as the edges reaching its def are found to be
+// executable; a conditional branch whose comparison has constant
+// operands only makes one of its edges executable.
+//
+// Afterwards, constant vregs are replaced by literals wherever the
+// lowering accepts a literal operand, the defs left without uses are
+// removed, branches with only one executable edge are folded, and
+// blocks that can't be reached are emptied and disconnected.
+//
+// Only values that fit in a 32-bit immediate are treated as constants,
+// since x86-64 can't use larger immediates in most instructions.
+// A vreg that has no def at all (e.g., an uninitialized variable) is
+// varying rather than undefined.
+class ConstantPropagation {
+private:
+  enum LatticeKind {
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM,
+  };
+
+  struct LatticeValue {
+    LatticeKind kind;
+    long value;
+
+    LatticeValue(LatticeKind kind = LATTICE_TOP, long value = 0) : kind(kind), value(value) { }
+
+    bool operator==(const LatticeValue &other) const {
+      return kind == other.kind && (kind != LATTICE_CONST || value == other.value);
+    }
+    bool operator!=(const LatticeValue &other) const { return !(*this == other); }
+  };
+
+  // a use of a vreg: the instruction and the block containing it
+  typedef std::pair<BasicBlock *, Instruction *> Use;
+
+  ControlFlowGraph *m_cfg;
+  std::vector<LatticeValue> m_values;
+  std::vector<std::vector<Use> > m_uses;
+  std::vector<bool> m_reached;
+  std::unordered_set<Edge *> m_executable;
+  std::deque<Edge *> m_edge_worklist;
+  std::deque<int> m_vreg_worklist;
+
+  unsigned m_num_folded;
+  unsigned m_num_branches_folded;
+  unsigned m_num_blocks_removed;
+
+public:
+  ConstantPropagation(ControlFlowGraph *cfg);
+  ~ConstantPropagation();
+
+  void execute();
+
+  // get the number of vreg operands replaced by literals
+  unsigned get_num_folded() const { return m_num_folded; }
+
+  // get the number of conditional branches with a known outcome
+  unsigned get_num_branches_folded() const { return m_num_branches_folded; }
+
+  // get the number of unreachable blocks removed
+  unsigned get_num_blocks_removed() const { return m_num_blocks_removed; }
+
+private:
+  void find_uses();
+  void propagate();
+  void visit_block(BasicBlock *bb);
+  void visit_phi(BasicBlock *bb, Instruction *phi);
+  void visit_instruction(Instruction *ins);
+  void visit_branch(BasicBlock *bb);
+  void mark_executable(Edge *e);
+  void set_value(int vreg, LatticeValue value);
+  LatticeValue get_value(const Operand &operand) const;
+  static LatticeValue meet(LatticeValue a, LatticeValue b);
+  static LatticeValue fold(int opcode, LatticeValue a, LatticeValue b);
+  static bool branch_taken(int opcode, long a, long b);
+
+  void rewrite();
+  void rewrite_block(BasicBlock *bb);
+  void fold_branch(BasicBlock *bb);
+  void remove_dead_defs();
+  void remove_block(BasicBlock *bb);
+};
+
+#endif // CONSTPROP_H
@@ -0,0 +1,142 @@
+#include <cassert>
+#include <climits>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dominators.h"
+#include "copyprop.h"
+
+CopyPropagation::CopyPropagation(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_propagated(0)
+  , m_num_removed(0) {
+}
+
+CopyPropagation::~CopyPropagation() {
+}
+
+void CopyPropagation::execute() {
+  find_copies();
+  propagate();
+  while (remove_dead_copies())
+    ;
+}
+
+void CopyPropagation::find_copies() {
+  // only copies in reachable blocks are in SSA form, and only a vreg
+  // with exactly one def can be replaced by its source
+  DominatorTree *dom = m_cfg->get_dominator_tree();
+  unsigned num_vregs = count_vregs(m_cfg);
+  std::vector<unsigned> num_defs(num_vregs, 0);
+  m_copy_of.assign(num_vregs, Operand());
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+      Instruction *ins = *j;
+      if (!is_def(ins)) {
+        continue;
+      }
+      int dest = ins->get_operand(0).get_base_reg();
+      num_defs[dest]++;
+      if (ins->get_opcode() != HINS_MOV || !dom->is_reachable(bb)) {
+        continue;
+      }
+      Operand src = ins->get_operand(1);
+      if (src.get_kind() == OPERAND_VREG ||
+          (src.get_kind() == OPERAND_INT_LITERAL &&
+           src.get_int_value() >= INT_MIN && src.get_int_value() <= INT_MAX)) {
+        m_copy_of[dest] = src;
+      }
+    }
+  }
+
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    if (num_defs[vreg] != 1) {
+      m_copy_of[vreg] = Operand();
+    }
+  }
+}
+
+void CopyPropagation::propagate() {
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->begin(); j != bb->end(); j++) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (!is_use(ins, int(k))) {
+          continue;
+        }
+        Operand &operand = (*ins)[k];
+        if (operand.get_kind() == OPERAND_VREG) {
+          Operand src = resolve(operand.get_base_reg(), accepts_literal(ins, k));
+          if (src.get_kind() == OPERAND_INT_LITERAL || src.get_base_reg() != operand.get_base_reg()) {
+            operand = src;
+            m_num_propagated++;
+          }
+          continue;
+        }
+
+        // a memory reference can only use the vregs
+        Operand base = resolve(operand.get_base_reg(), false);
+        if (base.get_base_reg() != operand.get_base_reg()) {
+          operand.set_base_reg(base.get_base_reg());
+          m_num_propagated++;
+        }
+        if (operand.has_index_reg()) {
+          Operand index = resolve(operand.get_index_reg(), false);
+          if (index.get_base_reg() != operand.get_index_reg()) {
+            operand.set_index_reg(index.get_base_reg());
+            m_num_propagated++;
+          }
+        }
+      }
+    }
+  }
+}
+
+Operand CopyPropagation::resolve(int vreg, bool allow_literal) const {
+  // follow the chain of copies back to the original value (SSA
+  // form has no cycles of copies)
+  Operand result(OPERAND_VREG, vreg);
+  while (m_copy_of[result.get_base_reg()].get_kind() != OPERAND_NONE) {
+    const Operand &src = m_copy_of[result.get_base_reg()];
+    if (src.get_kind() == OPERAND_INT_LITERAL) {
+      return allow_literal ? src : result;
+    }
+    result = src;
+  }
+  return result;
+}
+
+bool CopyPropagation::remove_dead_copies() {
+  LiveVregs live_vregs(m_cfg);
+  live_vregs.execute();
+
+  bool removed = false;
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    bool removed_here = false;
+    // (removing an instruction doesn't change the indices of the
+    // ones before it)
+    for (unsigned j = bb->get_length(); j > 0; j--) {
+      Instruction *ins = bb->get_instruction(j - 1);
+      if (ins->get_opcode() != HINS_MOV ||
+          ins->get_operand(0).get_kind() != OPERAND_VREG) {
+        continue;
+      }
+      int dest = ins->get_operand(0).get_base_reg();
+      if (!live_vregs.get_fact_after_instruction(bb, j - 1).test(unsigned(dest))) {
+        bb->remove_instruction(j - 1);
+        m_num_removed++;
+        removed_here = true;
+      }
+    }
+    removed = removed || removed_here;
+    if (removed_here && bb->get_length() == 0) {
+      // keep a placeholder for the block's label
+      bb->add_instruction(new Instruction(HINS_EMPTY));
+    }
+  }
+  return removed;
+}
@@ -0,0 +1,45 @@
+#ifndef COPYPROP_H
+#define COPYPROP_H
+
+#include <vector>
+#include "cfg.h"
+
+// Copy propagation over a high-level ControlFlowGraph in SSA form (see
+// SSABuilder).  Since each vreg has a single def, which dominates its
+// uses, every use of the destination of a copy "mov d, s" can read s
+// instead (following chains of copies), and a copy of a literal can
+// be replaced by the literal wherever the lowering accepts one.
+//
+// The copies left without uses are then removed: a copy whose
+// destination isn't live after it (according to LiveVregs) is
+// deleted, until no more copies are dead.
+class CopyPropagation {
+private:
+  ControlFlowGraph *m_cfg;
+  // source of each vreg defined by a copy (OPERAND_NONE if the vreg
+  // isn't a copy)
+  std::vector<Operand> m_copy_of;
+
+  unsigned m_num_propagated;
+  unsigned m_num_removed;
+
+public:
+  CopyPropagation(ControlFlowGraph *cfg);
+  ~CopyPropagation();
+
+  void execute();
+
+  // get the number of operands that were changed to read a copy's source
+  unsigned get_num_propagated() const { return m_num_propagated; }
+
+  // get the number of dead copies removed
+  unsigned get_num_removed() const { return m_num_removed; }
+
+private:
+  void find_copies();
+  void propagate();
+  Operand resolve(int vreg, bool allow_literal) const;
+  bool remove_dead_copies();
+};
+
+#endif // COPYPROP_H
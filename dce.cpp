@@ -0,0 +1,76 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dce.h"
+
+namespace {
+  // can the instruction be deleted if its def is dead?
+  bool is_removable(Instruction *ins) {
+    switch (ins->get_opcode()) {
+    case HINS_INT_ADD:
+    case HINS_INT_SUB:
+    case HINS_INT_MUL:
+    case HINS_INT_NEGATE:
+    case HINS_LOCALADDR:
+    case HINS_LOAD_INT:
+    case HINS_LOAD_ICONST:
+    case HINS_MOV:
+    case HINS_PHI:
+      return ins->get_operand(0).get_kind() == OPERAND_VREG;
+    case HINS_INT_DIV:
+    case HINS_INT_MOD:
+      {
+        // idivq traps if the divisor is zero
+        Operand divisor = ins->get_operand(2);
+        return divisor.get_kind() == OPERAND_INT_LITERAL && divisor.get_int_value() != 0;
+      }
+    default:
+      return false;
+    }
+  }
+}
+
+DeadCodeElimination::DeadCodeElimination(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_removed(0) {
+}
+
+DeadCodeElimination::~DeadCodeElimination() {
+}
+
+void DeadCodeElimination::execute() {
+  while (remove_dead_instructions())
+    ;
+}
+
+bool DeadCodeElimination::remove_dead_instructions() {
+  LiveVregs live_vregs(m_cfg);
+  live_vregs.execute();
+
+  bool removed = false;
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    bool removed_here = false;
+    // (removing an instruction doesn't change the indices of the
+    // ones before it)
+    for (unsigned j = bb->get_length(); j > 0; j--) {
+      Instruction *ins = bb->get_instruction(j - 1);
+      if (!is_removable(ins)) {
+        continue;
+      }
+      int dest = ins->get_operand(0).get_base_reg();
+      if (!live_vregs.get_fact_after_instruction(bb, j - 1).test(unsigned(dest))) {
+        bb->remove_instruction(j - 1);
+        m_num_removed++;
+        removed_here = true;
+      }
+    }
+    removed = removed || removed_here;
+    if (removed_here && bb->get_length() == 0) {
+      // keep a placeholder for the block's label
+      bb->add_instruction(new Instruction(HINS_EMPTY));
+    }
+  }
+  return removed;
+}
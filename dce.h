@@ -0,0 +1,33 @@
+#ifndef DCE_H
+#define DCE_H
+
+#include "cfg.h"
+
+// Dead code elimination over a high-level ControlFlowGraph: an
+// instruction that only computes a value (arithmetic, localaddr, a
+// load, a copy) is deleted if its destination isn't live after it,
+// according to LiveVregs.  Deleting an instruction can make the values
+// it used dead, so this is repeated until nothing changes.
+//
+// Instructions with an effect besides their def (input, stores, calls)
+// are always kept, as is a division that could trap on a zero divisor.
+// Works on the CFG in or out of SSA form.
+class DeadCodeElimination {
+private:
+  ControlFlowGraph *m_cfg;
+  unsigned m_num_removed;
+
+public:
+  DeadCodeElimination(ControlFlowGraph *cfg);
+  ~DeadCodeElimination();
+
+  void execute();
+
+  // get the number of instructions removed
+  unsigned get_num_removed() const { return m_num_removed; }
+
+private:
+  bool remove_dead_instructions();
+};
+
+#endif // DCE_H
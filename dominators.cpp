@@ -0,0 +1,191 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "dominators.h"
+
+const unsigned DominatorTree::UNREACHABLE;
+
+DominatorTree::DominatorTree(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_rpo_number(cfg->get_num_blocks(), UNREACHABLE)
+  , m_idom(cfg->get_num_blocks(), nullptr)
+  , m_children(cfg->get_num_blocks())
+  , m_preorder(cfg->get_num_blocks(), 0)
+  , m_postorder(cfg->get_num_blocks(), 0)
+  , m_have_frontiers(false) {
+}
+
+DominatorTree::~DominatorTree() {
+}
+
+void DominatorTree::execute() {
+  compute_rpo();
+  compute_idoms();
+  number_tree();
+}
+
+bool DominatorTree::dominates(BasicBlock *a, BasicBlock *b) const {
+  if (!is_reachable(a) || !is_reachable(b)) {
+    return false;
+  }
+  // a dominates b iff b is in a's subtree of the dominator tree
+  unsigned ida = a->get_id(), idb = b->get_id();
+  return m_preorder[ida] <= m_preorder[idb] && m_postorder[idb] <= m_postorder[ida];
+}
+
+const std::vector<BasicBlock *> &DominatorTree::get_frontier(BasicBlock *bb) const {
+  if (!m_have_frontiers) {
+    compute_frontiers();
+  }
+  return m_frontiers[bb->get_id()];
+}
+
+void DominatorTree::compute_rpo() {
+  // iterative depth-first search, so very large CFGs can't overflow
+  // the call stack
+  std::vector<bool> visited(m_cfg->get_num_blocks(), false);
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+
+  BasicBlock *entry = m_cfg->get_entry_block();
+  visited[entry->get_id()] = true;
+  stack.push_back(std::make_pair(entry, 0U));
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_edge = stack.back().second;
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+
+    if (next_edge < outgoing_edges.size()) {
+      stack.back().second++;
+      BasicBlock *succ = outgoing_edges[next_edge]->get_target();
+      if (!visited[succ->get_id()]) {
+        visited[succ->get_id()] = true;
+        stack.push_back(std::make_pair(succ, 0U));
+      }
+    } else {
+      m_rpo.push_back(bb);
+      stack.pop_back();
+    }
+  }
+
+  std::reverse(m_rpo.begin(), m_rpo.end());
+  for (unsigned i = 0; i < m_rpo.size(); i++) {
+    m_rpo_number[m_rpo[i]->get_id()] = i;
+  }
+}
+
+void DominatorTree::compute_idoms() {
+  // work on reverse postorder numbers: idom[n] is the rpo number of
+  // the immediate dominator of the n'th block in reverse postorder
+  unsigned num_reachable = unsigned(m_rpo.size());
+  std::vector<unsigned> idom(num_reachable, UNREACHABLE);
+  idom[0] = 0;
+
+  // predecessors (as rpo numbers), looked up once rather than on
+  // every pass
+  std::vector<std::vector<unsigned> > preds(num_reachable);
+  for (unsigned n = 1; n < num_reachable; n++) {
+    const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(m_rpo[n]);
+    for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+      unsigned p = m_rpo_number[(*i)->get_source()->get_id()];
+      if (p != UNREACHABLE) {
+        preds[n].push_back(p);
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned n = 1; n < num_reachable; n++) {
+      unsigned new_idom = UNREACHABLE;
+      for (auto i = preds[n].begin(); i != preds[n].end(); i++) {
+        unsigned p = *i;
+        if (idom[p] == UNREACHABLE) {
+          // not processed yet
+          continue;
+        }
+        new_idom = (new_idom == UNREACHABLE) ? p : intersect(p, new_idom, idom);
+      }
+      if (idom[n] != new_idom) {
+        idom[n] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  for (unsigned n = 1; n < num_reachable; n++) {
+    BasicBlock *bb = m_rpo[n], *dom = m_rpo[idom[n]];
+    m_idom[bb->get_id()] = dom;
+    m_children[dom->get_id()].push_back(bb);
+  }
+}
+
+unsigned DominatorTree::intersect(unsigned a, unsigned b, const std::vector<unsigned> &idom) const {
+  // walk up the two dominator chains until they meet: a block's
+  // dominators all have smaller reverse postorder numbers
+  while (a != b) {
+    while (a > b) {
+      a = idom[a];
+    }
+    while (b > a) {
+      b = idom[b];
+    }
+  }
+  return a;
+}
+
+void DominatorTree::number_tree() {
+  // number the dominator tree in preorder and postorder (iteratively)
+  unsigned pre = 0, post = 0;
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+  BasicBlock *entry = m_cfg->get_entry_block();
+  m_preorder[entry->get_id()] = pre++;
+  stack.push_back(std::make_pair(entry, 0U));
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_child = stack.back().second;
+    const std::vector<BasicBlock *> &children = m_children[bb->get_id()];
+
+    if (next_child < children.size()) {
+      stack.back().second++;
+      BasicBlock *child = children[next_child];
+      m_preorder[child->get_id()] = pre++;
+      stack.push_back(std::make_pair(child, 0U));
+    } else {
+      m_postorder[bb->get_id()] = post++;
+      stack.pop_back();
+    }
+  }
+}
+
+void DominatorTree::compute_frontiers() const {
+  // Cooper, Harvey & Kennedy: a join block is in the frontier of
+  // each block on the dominator tree path from each of its
+  // predecessors up to (but not including) its immediate dominator
+  m_frontiers.assign(m_cfg->get_num_blocks(), std::vector<BasicBlock *>());
+  for (auto i = m_rpo.begin(); i != m_rpo.end(); i++) {
+    BasicBlock *bb = *i;
+    const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+    if (incoming_edges.size() < 2) {
+      continue;
+    }
+    for (auto j = incoming_edges.cbegin(); j != incoming_edges.cend(); j++) {
+      BasicBlock *runner = (*j)->get_source();
+      if (!is_reachable(runner)) {
+        continue;
+      }
+      while (runner != m_idom[bb->get_id()]) {
+        std::vector<BasicBlock *> &frontier = m_frontiers[runner->get_id()];
+        if (!frontier.empty() && frontier.back() == bb) {
+          // already added by another predecessor's walk
+          break;
+        }
+        frontier.push_back(bb);
+        runner = m_idom[runner->get_id()];
+      }
+    }
+  }
+  m_have_frontiers = true;
+}
@@ -0,0 +1,84 @@
+#ifndef DOMINATORS_H
+#define DOMINATORS_H
+
+#include <vector>
+#include "cfg.h"
+
+// Dominator tree of a ControlFlowGraph, computed with the iterative
+// algorithm of Cooper, Harvey & Kennedy ("A Simple, Fast Dominance
+// Algorithm"): immediate dominators are refined in reverse postorder
+// until nothing changes, intersecting dominator chains by comparing
+// reverse postorder numbers.  On the (reducible) CFGs the code
+// generator produces this converges in two or three passes.
+//
+// Blocks not reachable from the entry block have no dominator and
+// aren't in the tree.
+//
+// Don't create one directly: use ControlFlowGraph::get_dominator_tree(),
+// which caches the result until the CFG changes.
+class DominatorTree {
+private:
+  ControlFlowGraph *m_cfg;
+  // reachable blocks in reverse postorder
+  std::vector<BasicBlock *> m_rpo;
+  // reverse postorder number of each block (indexed by block id,
+  // UNREACHABLE for blocks not reachable from the entry)
+  std::vector<unsigned> m_rpo_number;
+  // immediate dominator of each block (null for the entry block and
+  // unreachable blocks)
+  std::vector<BasicBlock *> m_idom;
+  // children of each block in the dominator tree
+  std::vector<std::vector<BasicBlock *> > m_children;
+  // preorder/postorder numbers of each block in the dominator tree,
+  // used to answer dominates() queries in constant time
+  std::vector<unsigned> m_preorder, m_postorder;
+  // dominance frontier of each block (computed when first needed)
+  mutable std::vector<std::vector<BasicBlock *> > m_frontiers;
+  mutable bool m_have_frontiers;
+
+public:
+  static const unsigned UNREACHABLE = ~0U;
+
+  DominatorTree(ControlFlowGraph *cfg);
+  ~DominatorTree();
+
+  void execute();
+
+  // is the block reachable from the entry block?
+  bool is_reachable(BasicBlock *bb) const { return m_rpo_number[bb->get_id()] != UNREACHABLE; }
+
+  // get reachable blocks in reverse postorder (entry block first)
+  const std::vector<BasicBlock *> &get_rpo() const { return m_rpo; }
+
+  // get the reverse postorder number of a block (UNREACHABLE if the
+  // block isn't reachable)
+  unsigned get_rpo_number(BasicBlock *bb) const { return m_rpo_number[bb->get_id()]; }
+
+  // get the immediate dominator of a block (null for the entry block
+  // and unreachable blocks)
+  BasicBlock *get_idom(BasicBlock *bb) const { return m_idom[bb->get_id()]; }
+
+  // get the blocks immediately dominated by a block
+  const std::vector<BasicBlock *> &get_children(BasicBlock *bb) const { return m_children[bb->get_id()]; }
+
+  // does a dominate b?  (every block dominates itself; unreachable
+  // blocks neither dominate nor are dominated by anything)
+  bool dominates(BasicBlock *a, BasicBlock *b) const;
+
+  // does a strictly dominate b?
+  bool strictly_dominates(BasicBlock *a, BasicBlock *b) const { return a != b && dominates(a, b); }
+
+  // get the dominance frontier of a block: the blocks where its
+  // dominance ends (a block b is in the frontier of a if a dominates
+  // a predecessor of b but doesn't strictly dominate b)
+  const std::vector<BasicBlock *> &get_frontier(BasicBlock *bb) const;
+
+private:
+  void compute_rpo();
+  void compute_idoms();
+  void number_tree();
+  void compute_frontiers() const;
+  unsigned intersect(unsigned a, unsigned b, const std::vector<unsigned> &idom) const;
+};
+
+#endif // DOMINATORS_H
@@ -0,0 +1,244 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dominators.h"
+#include "gvn.h"
+
+namespace {
+  // does the instruction compute a value from its operands alone?
+  bool is_pure(Instruction *ins) {
+    switch (ins->get_opcode()) {
+    case HINS_INT_ADD:
+    case HINS_INT_SUB:
+    case HINS_INT_MUL:
+    case HINS_INT_DIV:
+    case HINS_INT_MOD:
+    case HINS_LOCALADDR:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  bool is_commutative(int opcode) {
+    return opcode == HINS_INT_ADD || opcode == HINS_INT_MUL;
+  }
+
+  // might the instruction change memory?  (reading and writing
+  // integers only clobber registers)
+  bool clobbers_memory(Instruction *ins) {
+    return ins->get_opcode() == HINS_STORE_INT || ins->get_opcode() == HINS_CALL;
+  }
+}
+
+GlobalValueNumbering::GlobalValueNumbering(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_replaced(0)
+  , m_num_loads_replaced(0) {
+}
+
+GlobalValueNumbering::~GlobalValueNumbering() {
+}
+
+void GlobalValueNumbering::execute() {
+  // each vreg starts out with a value number of its own
+  unsigned num_vregs = count_vregs(m_cfg);
+  m_value_number.resize(num_vregs);
+  for (unsigned i = 0; i < num_vregs; i++) {
+    m_value_number[i] = int(i);
+  }
+
+  // preorder walk over the dominator tree (iteratively, as in
+  // SSABuilder::rename); the expressions made available by a block
+  // are removed once all of the blocks it dominates have been visited
+  DominatorTree *dom = m_cfg->get_dominator_tree();
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+  std::vector<std::vector<ExpressionMap::iterator> > added;
+
+  BasicBlock *entry = m_cfg->get_entry_block();
+  stack.push_back(std::make_pair(entry, 0U));
+  added.push_back(std::vector<ExpressionMap::iterator>());
+  visit_block(entry, added.back());
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_child = stack.back().second;
+    const std::vector<BasicBlock *> &children = dom->get_children(bb);
+
+    if (next_child < children.size()) {
+      stack.back().second++;
+      BasicBlock *child = children[next_child];
+      stack.push_back(std::make_pair(child, 0U));
+      added.push_back(std::vector<ExpressionMap::iterator>());
+      visit_block(child, added.back());
+    } else {
+      const std::vector<ExpressionMap::iterator> &exprs = added.back();
+      for (auto i = exprs.begin(); i != exprs.end(); i++) {
+        m_available.erase(*i);
+      }
+      added.pop_back();
+      stack.pop_back();
+    }
+  }
+}
+
+void GlobalValueNumbering::visit_block(BasicBlock *bb, std::vector<ExpressionMap::iterator> &added) {
+  visit_phis(bb);
+
+  m_loads.clear();
+  for (auto i = bb->begin(); i != bb->end(); i++) {
+    Instruction *ins = *i;
+    int opcode = ins->get_opcode();
+
+    if (opcode == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+      // a copy has the value of its source
+      m_value_number[ins->get_operand(0).get_base_reg()] = get_value_number(ins->get_operand(1).get_base_reg());
+    } else if (opcode == HINS_LOAD_INT) {
+      visit_load(ins);
+    } else if (opcode == HINS_STORE_INT) {
+      visit_store(ins);
+    } else if (is_pure(ins)) {
+      Operand dest = ins->get_operand(0);
+      Expression expr = make_expression(ins);
+      auto j = m_available.find(expr);
+      if (j != m_available.end()) {
+        // computed already: copy the earlier result
+        *ins = Instruction(HINS_MOV, dest, Operand(OPERAND_VREG, j->second));
+        m_value_number[dest.get_base_reg()] = j->second;
+        m_num_replaced++;
+      } else {
+        added.push_back(m_available.insert(std::make_pair(expr, dest.get_base_reg())).first);
+      }
+    } else if (clobbers_memory(ins)) {
+      m_loads.clear();
+    }
+  }
+}
+
+void GlobalValueNumbering::visit_phis(BasicBlock *bb) {
+  unsigned num_phis = 0;
+  while (num_phis < bb->get_length() && is_phi(bb->get_instruction(num_phis))) {
+    num_phis++;
+  }
+
+  // a phi whose operands all have the same value (apart from the phi
+  // itself, coming around a loop) is a copy of that value; the copies
+  // go after the remaining phis, so the value mustn't be one of them
+  std::vector<std::pair<unsigned, Operand> > copies;
+  for (unsigned i = 0; i < num_phis; i++) {
+    Instruction *phi = bb->get_instruction(i);
+    int dest = phi->get_operand(0).get_base_reg();
+    Operand value;
+    bool same = true;
+    for (unsigned k = 1; k < phi->get_num_operands() && same; k++) {
+      Operand operand = phi->get_operand(k);
+      if (operand.get_kind() == OPERAND_VREG) {
+        operand = Operand(OPERAND_VREG, get_value_number(operand.get_base_reg()));
+        if (operand.get_base_reg() == dest) {
+          continue;
+        }
+      }
+      if (value.get_kind() == OPERAND_NONE) {
+        value = operand;
+      } else {
+        Expression a, b;
+        add_operand(a, value);
+        add_operand(b, operand);
+        same = (a == b);
+      }
+    }
+    if (same && value.get_kind() != OPERAND_NONE) {
+      copies.push_back(std::make_pair(i, value));
+    }
+  }
+
+  for (auto i = copies.rbegin(); i != copies.rend(); i++) {
+    Operand value = i->second;
+    if (value.get_kind() == OPERAND_VREG) {
+      bool is_local_phi = false;
+      for (unsigned j = 0; j < num_phis && !is_local_phi; j++) {
+        is_local_phi = (bb->get_instruction(j)->get_operand(0).get_base_reg() == value.get_base_reg());
+      }
+      if (is_local_phi) {
+        continue;
+      }
+    }
+
+    Operand dest = bb->get_instruction(i->first)->get_operand(0);
+    bb->remove_instruction(i->first);
+    num_phis--;
+    bb->insert_instruction(num_phis, new Instruction(HINS_MOV, dest, value));
+    if (value.get_kind() == OPERAND_VREG) {
+      m_value_number[dest.get_base_reg()] = value.get_base_reg();
+    }
+    m_num_replaced++;
+  }
+}
+
+void GlobalValueNumbering::visit_load(Instruction *ins) {
+  Operand dest = ins->get_operand(0);
+  Expression addr;
+  add_operand(addr, ins->get_operand(1));
+
+  auto i = m_loads.find(addr);
+  if (i != m_loads.end()) {
+    // loaded (or stored) already, and memory hasn't changed since
+    *ins = Instruction(HINS_MOV, dest, i->second);
+    if (i->second.get_kind() == OPERAND_VREG) {
+      m_value_number[dest.get_base_reg()] = get_value_number(i->second.get_base_reg());
+    }
+    m_num_loads_replaced++;
+  } else {
+    m_loads[addr] = dest;
+  }
+}
+
+void GlobalValueNumbering::visit_store(Instruction *ins) {
+  // the store might write memory that any other address refers to
+  // (two vregs holding the same address needn't have the same value
+  // number), so only the stored value is known afterwards
+  m_loads.clear();
+
+  Operand value = ins->get_operand(1);
+  if (value.get_kind() == OPERAND_VREG || value.get_kind() == OPERAND_INT_LITERAL) {
+    Expression addr;
+    add_operand(addr, ins->get_operand(0));
+    m_loads[addr] = value;
+  }
+}
+
+GlobalValueNumbering::Expression GlobalValueNumbering::make_expression(Instruction *ins) const {
+  std::vector<Expression> operands;
+  for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+    operands.push_back(Expression());
+    add_operand(operands.back(), ins->get_operand(k));
+  }
+  if (is_commutative(ins->get_opcode())) {
+    std::sort(operands.begin(), operands.end());
+  }
+
+  Expression expr;
+  expr.push_back(ins->get_opcode());
+  for (auto i = operands.begin(); i != operands.end(); i++) {
+    expr.insert(expr.end(), i->begin(), i->end());
+  }
+  return expr;
+}
+
+void GlobalValueNumbering::add_operand(Expression &expr, const Operand &operand) const {
+  expr.push_back(operand.get_kind());
+  if (operand.has_base_reg()) {
+    expr.push_back(get_value_number(operand.get_base_reg()));
+  }
+  if (operand.has_index_reg()) {
+    expr.push_back(get_value_number(operand.get_index_reg()));
+    expr.push_back(operand.get_scale());
+  }
+  if (operand.get_kind() == OPERAND_INT_LITERAL) {
+    expr.push_back(operand.get_int_value());
+  } else if (operand.get_kind() & OPROP_HAS_INTVAL) {
+    expr.push_back(operand.get_offset());
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef GVN_H
+#define GVN_H
+
+#include <vector>
+#include <map>
+#include "cfg.h"
+
+// Dominator-based global value numbering over a high-level
+// ControlFlowGraph in SSA form (see SSABuilder), after Briggs, Cooper
+// & Simpson: blocks are visited in a walk over the dominator tree, and
+// an instruction computing the same operation on the same values as an
+// instruction in a dominating block (or earlier in the same block) is
+// replaced by a copy of the earlier result.  This mostly catches the
+// address arithmetic that the code generator repeats for each
+// occurrence of an array element or record field.
+//
+// Copies are looked through (a vreg copied from another has the same
+// value number), addition and multiplication are commutative, and a
+// phi whose operands all have the same value number becomes a copy.
+//
+// Loads are handled conservatively: a load is only reused (or a stored
+// value forwarded to it) within a block, and not past a store or a
+// call, since those might change memory.
+class GlobalValueNumbering {
+private:
+  // an operation on operands: the opcode, then the kind and the value
+  // number (or literal value, or offset) of each source operand
+  typedef std::vector<long> Expression;
+  typedef std::map<Expression, int> ExpressionMap;
+
+  ControlFlowGraph *m_cfg;
+  // value number of each vreg: the vreg first computing the value
+  std::vector<int> m_value_number;
+  // vreg computing each expression available in the current block
+  ExpressionMap m_available;
+  // value loaded from each address in the current block
+  std::map<Expression, Operand> m_loads;
+
+  unsigned m_num_replaced;
+  unsigned m_num_loads_replaced;
+
+public:
+  GlobalValueNumbering(ControlFlowGraph *cfg);
+  ~GlobalValueNumbering();
+
+  void execute();
+
+  // get the number of instructions replaced by copies of earlier results
+  unsigned get_num_replaced() const { return m_num_replaced; }
+
+  // get the number of loads replaced by copies
+  unsigned get_num_loads_replaced() const { return m_num_loads_replaced; }
+
+private:
+  void visit_block(BasicBlock *bb, std::vector<ExpressionMap::iterator> &added);
+  void visit_phis(BasicBlock *bb);
+  void visit_load(Instruction *ins);
+  void visit_store(Instruction *ins);
+  Expression make_expression(Instruction *ins) const;
+  void add_operand(Expression &expr, const Operand &operand) const;
+  int get_value_number(int vreg) const { return m_value_number[vreg]; }
+};
+
+#endif // GVN_H
@@ -36,6 +36,9 @@ std::string PrintHighLevelInstructionSequence::get_opcode_name(int opcode) {
   case HINS_PASS:        return "pass";
   case HINS_CALL:        return "call";
   case HINS_RET:         return "return";
+  case HINS_SPILL:       return "spill";
+  case HINS_RELOAD:      return "reload";
+  case HINS_PHI:         return "phi";
   default:
     assert(false);
     return "<invalid>";
@@ -60,6 +63,40 @@ bool HighLevelControlFlowGraphBuilder::falls_through(Instruction *ins) {
   return ins->get_opcode() != HINS_JUMP;
 }
 
+HighLevelBranchRewriter::HighLevelBranchRewriter() {
+}
+
+HighLevelBranchRewriter::~HighLevelBranchRewriter() {
+}
+
+bool HighLevelBranchRewriter::is_nop(Instruction *ins) {
+  return ins->get_opcode() == HINS_NOP || ins->get_opcode() == HINS_EMPTY;
+}
+
+bool HighLevelBranchRewriter::is_compare(Instruction *ins) {
+  return ins->get_opcode() == HINS_INT_COMPARE;
+}
+
+Instruction *HighLevelBranchRewriter::create_jump(const std::string &label) {
+  return new Instruction(HINS_JUMP, Operand(label));
+}
+
+Instruction *HighLevelBranchRewriter::create_inverted_branch(Instruction *branch, const std::string &label) {
+  int opcode;
+  switch (branch->get_opcode()) {
+  case HINS_JE:   opcode = HINS_JNE; break;
+  case HINS_JNE:  opcode = HINS_JE; break;
+  case HINS_JLT:  opcode = HINS_JGTE; break;
+  case HINS_JLTE: opcode = HINS_JGT; break;
+  case HINS_JGT:  opcode = HINS_JLTE; break;
+  case HINS_JGTE: opcode = HINS_JLT; break;
+  default:
+    assert(false);
+    opcode = HINS_JUMP;
+  }
+  return new Instruction(opcode, Operand(label));
+}
+
 HighLevelControlFlowGraphPrinter::HighLevelControlFlowGraphPrinter(ControlFlowGraph *cfg)
   : ControlFlowGraphPrinter(cfg) {
 }
@@ -84,6 +121,9 @@ std::string HighLevelControlFlowGraphPrinter::format_instruction(BasicBlock *bb,
   return p.format_instruction(ins);
 }
 
+// does the instruction write a vreg (always operand 0)?
+// Note that HINS_STORE_INT is not a def: its operand 0 is a memory
+// reference, so the vreg it names is only used (as an address).
 int is_def(Instruction *ins){
   int m_opcode;
   m_opcode = ins->get_opcode();
@@ -92,50 +132,84 @@ int is_def(Instruction *ins){
       m_opcode ==  HINS_INT_MUL ||
       m_opcode ==  HINS_INT_DIV ||
       m_opcode ==  HINS_INT_MOD ||
+      m_opcode ==  HINS_INT_NEGATE ||
       m_opcode ==  HINS_MOV ||
-      m_opcode ==  HINS_STORE_INT ||
       m_opcode ==  HINS_LOAD_ICONST ||
       m_opcode ==  HINS_LOCALADDR ||
       m_opcode == HINS_READ_INT ||
-      m_opcode == HINS_LOAD_INT) {
-    return 1;
+      m_opcode == HINS_LOAD_INT ||
+      m_opcode == HINS_CALL ||
+      m_opcode == HINS_PHI) {
+    return ins->get_operand(0).get_kind() == OPERAND_VREG;
   } else {
     return 0;
   }
 
 }
 
+// is operand idx of the instruction a use of a vreg?
+// (either the vreg itself, or a memory reference whose address is
+// in a vreg)
 int is_use(Instruction *ins, int idx){
-  int m_opcode;
-  m_opcode = ins->get_opcode();
-  if (m_opcode ==  HINS_INT_ADD ||
-      m_opcode ==  HINS_INT_SUB ||
-      m_opcode ==  HINS_INT_MUL ||
-      m_opcode ==  HINS_INT_DIV ||
-      m_opcode ==  HINS_INT_MOD ||
-      
-      
-      m_opcode ==  HINS_LOAD_ICONST ||
-      m_opcode ==  HINS_LOCALADDR ||
-      m_opcode == HINS_READ_INT ||
-      m_opcode == HINS_LOAD_INT) {
-    if (ins->get_operand(idx).get_kind() == OPERAND_VREG_MEMREF || ins->get_operand(idx).get_kind() == OPERAND_VREG){
-      if(idx == 0) {
-      return 0;
-      } else {
-        return 1;
-      }
-    } else {
-      return 0;
-    }
+  Operand operand = ins->get_operand(idx);
+  if (operand.get_kind() != OPERAND_VREG &&
+      operand.get_kind() != OPERAND_VREG_MEMREF &&
+      operand.get_kind() != OPERAND_VREG_MEMREF_OFFSET &&
+      operand.get_kind() != OPERAND_VREG_MEMREF_INDEX) {
+    return 0;
+  }
 
-    
-  } else {
-    if (ins->get_operand(idx).get_kind() == OPERAND_VREG_MEMREF || ins->get_operand(idx).get_kind() == OPERAND_VREG){
-      return 1;
-    } else {
-      return 0;
-    }
-    
+  // the destination of a def is not a use
+  if (idx == 0 && is_def(ins)) {
+    return 0;
+  }
+  return 1;
+}
+
+// is the instruction lowered to a function call?  (Calls clobber the
+// caller-saved registers rcx, r8 and r9.)
+int is_call(Instruction *ins){
+  int m_opcode = ins->get_opcode();
+  return m_opcode == HINS_READ_INT ||
+         m_opcode == HINS_WRITE_INT ||
+         m_opcode == HINS_CALL;
+}
+
+// can operand idx of the instruction be an integer literal?
+// (i.e., does the lowering accept an immediate there)
+int accepts_literal(Instruction *ins, unsigned idx){
+  switch (ins->get_opcode()) {
+  case HINS_PHI:
+    return idx > 0;
+  case HINS_MOV:
+    return idx == 1;
+  case HINS_INT_ADD:
+  case HINS_INT_SUB:
+  case HINS_INT_MUL:
+  case HINS_INT_DIV:
+  case HINS_INT_MOD:
+    return idx > 0;
+  case HINS_INT_COMPARE:
+  case HINS_WRITE_INT:
+    return 1;
+  case HINS_STORE_INT:
+    return idx == 1;
+  default:
+    return 0;
   }
 }
+
+int is_phi(Instruction *ins){
+  return ins->get_opcode() == HINS_PHI;
+}
+
+// does the instruction transfer control somewhere other than the
+// next instruction?
+int is_branch(Instruction *ins){
+  return ins->get_opcode() == HINS_JUMP || is_conditional_branch(ins);
+}
+
+int is_conditional_branch(Instruction *ins){
+  int m_opcode = ins->get_opcode();
+  return m_opcode >= HINS_JE && m_opcode <= HINS_JGTE;
+}
@@ -32,6 +32,9 @@ enum HighLevelOpcode {
   HINS_PASS,
   HINS_CALL,
   HINS_RET,
+  HINS_SPILL,   // save a vreg's mreg to the vreg's stack slot
+  HINS_RELOAD,  // restore a vreg's mreg from the vreg's stack slot
+  HINS_PHI,     // SSA phi: operand k+1 is the value on incoming edge k
 };
 
 class PrintHighLevelInstructionSequence : public PrintInstructionSequence {
@@ -51,6 +54,18 @@ public:
 
 };
 
+class HighLevelBranchRewriter : public BranchRewriter {
+public:
+  HighLevelBranchRewriter();
+  virtual ~HighLevelBranchRewriter();
+
+  virtual bool is_nop(Instruction *ins);
+  virtual bool is_compare(Instruction *ins);
+
+  virtual Instruction *create_jump(const std::string &label);
+  virtual Instruction *create_inverted_branch(Instruction *branch, const std::string &label);
+};
+
 class HighLevelControlFlowGraphPrinter : public ControlFlowGraphPrinter {
 public:
   HighLevelControlFlowGraphPrinter(ControlFlowGraph *cfg);
@@ -64,4 +79,14 @@ int is_def(Instruction *ins);
 
 int is_use(Instruction *ins, int idx);
 
+int is_call(Instruction *ins);
+
+int accepts_literal(Instruction *ins, unsigned idx);
+
+int is_phi(Instruction *ins);
+
+int is_branch(Instruction *ins);
+
+int is_conditional_branch(Instruction *ins);
+
 #endif // HIGHLEVEL_H
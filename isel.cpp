@@ -0,0 +1,563 @@
+#include <cassert>
+#include <climits>
+#include <iterator>
+#include <utility>
+#include "cfg.h"
+#include "x86_64.h"
+#include "isel.h"
+
+namespace {
+  // extra conditions on a rule's match
+  enum RuleCondition {
+    COND_NONE,
+    COND_IMM32,     // the literal fits in a 32-bit immediate
+    COND_SCALE,     // the second operand is the literal 1, 2, 4, or 8
+    COND_DISP,      // the displacement still fits in 32 bits
+    COND_DEST_REG,  // the destination of the move is an mreg
+    COND_ZERO,      // the second operand is the literal 0
+  };
+
+  // what a rule's code (or value) is
+  enum RuleAction {
+    ACT_LEAF,       // the leaf's operand itself
+    ACT_LOAD_CNST,  // movq $c, r
+    ACT_LOAD_MEM,   // movq m, r
+    ACT_LEA,        // leaq addr, r
+    ACT_BASE,       // (r)
+    ACT_SAME,       // the operand's value, unchanged
+    ACT_DISP,       // c(r), or (off+c)(%rsp)
+    ACT_BASE_INDEX, // (b,i,s), or off(%rsp,i,s)
+    ACT_SCALE,      // i*s
+    ACT_ARITH,      // movq a, r; op b, r
+    ACT_MUL_IMM,    // imulq $c, a, r
+    ACT_STORE,      // movq v, addr
+    ACT_CMP,        // cmpq b, a
+    ACT_TEST,       // testq a, a
+    ACT_MOVE,       // movq v, dest
+  };
+
+  struct SelectionRule {
+    SelectionNonterminal lhs;
+    SelectionOp op;
+    SelectionNonterminal kids[2];
+    RuleCondition cond;
+    int cost;
+    RuleAction action;
+  };
+
+  // The tree grammar.  Costs are instructions; addressing modes are
+  // free, so the selector prefers them (and leaq) to explicit adds.
+  constexpr SelectionRule rules[] = {
+    // leaves
+    { NT_REG,   SEL_REG,   { NT_NONE, NT_NONE },   COND_NONE,     0, ACT_LEAF },
+    { NT_MEM,   SEL_MEM,   { NT_NONE, NT_NONE },   COND_NONE,     0, ACT_LEAF },
+    { NT_IMM,   SEL_CNST,  { NT_NONE, NT_NONE },   COND_IMM32,    0, ACT_LEAF },
+    { NT_REG,   SEL_CNST,  { NT_NONE, NT_NONE },   COND_NONE,     1, ACT_LOAD_CNST },
+    { NT_FRAME, SEL_FRAME, { NT_NONE, NT_NONE },   COND_NONE,     0, ACT_LEAF },
+
+    // chain rules
+    { NT_REG,   SEL_CHAIN, { NT_MEM, NT_NONE },    COND_NONE,     1, ACT_LOAD_MEM },
+    { NT_REG,   SEL_CHAIN, { NT_ADDR, NT_NONE },   COND_NONE,     1, ACT_LEA },
+    { NT_ADDR,  SEL_CHAIN, { NT_REG, NT_NONE },    COND_NONE,     0, ACT_BASE },
+    { NT_ADDR,  SEL_CHAIN, { NT_FRAME, NT_NONE },  COND_NONE,     0, ACT_SAME },
+
+    // addressing modes
+    { NT_ADDR,  SEL_ADD,   { NT_REG, NT_IMM },     COND_DISP,     0, ACT_DISP },
+    { NT_ADDR,  SEL_ADD,   { NT_FRAME, NT_IMM },   COND_DISP,     0, ACT_DISP },
+    { NT_ADDR,  SEL_ADD,   { NT_REG, NT_REG },     COND_NONE,     0, ACT_BASE_INDEX },
+    { NT_ADDR,  SEL_ADD,   { NT_REG, NT_INDEX },   COND_NONE,     0, ACT_BASE_INDEX },
+    { NT_ADDR,  SEL_ADD,   { NT_FRAME, NT_REG },   COND_NONE,     0, ACT_BASE_INDEX },
+    { NT_ADDR,  SEL_ADD,   { NT_FRAME, NT_INDEX }, COND_NONE,     0, ACT_BASE_INDEX },
+    { NT_INDEX, SEL_MUL,   { NT_REG, NT_IMM },     COND_SCALE,    0, ACT_SCALE },
+    { NT_MEM,   SEL_LOAD,  { NT_ADDR, NT_NONE },   COND_NONE,     0, ACT_SAME },
+
+    // arithmetic
+    { NT_REG,   SEL_ADD,   { NT_REG, NT_IMM },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_ADD,   { NT_REG, NT_REG },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_ADD,   { NT_REG, NT_MEM },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_SUB,   { NT_REG, NT_IMM },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_SUB,   { NT_REG, NT_REG },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_SUB,   { NT_REG, NT_MEM },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_MUL,   { NT_REG, NT_REG },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_MUL,   { NT_REG, NT_MEM },     COND_NONE,     2, ACT_ARITH },
+    { NT_REG,   SEL_MUL,   { NT_REG, NT_IMM },     COND_NONE,     1, ACT_MUL_IMM },
+    { NT_REG,   SEL_MUL,   { NT_MEM, NT_IMM },     COND_NONE,     1, ACT_MUL_IMM },
+
+    // roots
+    { NT_STMT,  SEL_STORE, { NT_ADDR, NT_REG },    COND_NONE,     1, ACT_STORE },
+    { NT_STMT,  SEL_STORE, { NT_ADDR, NT_IMM },    COND_NONE,     1, ACT_STORE },
+    { NT_STMT,  SEL_CMP,   { NT_REG, NT_IMM },     COND_ZERO,     1, ACT_TEST },
+    { NT_STMT,  SEL_CMP,   { NT_REG, NT_REG },     COND_NONE,     1, ACT_CMP },
+    { NT_STMT,  SEL_CMP,   { NT_REG, NT_IMM },     COND_NONE,     1, ACT_CMP },
+    { NT_STMT,  SEL_CMP,   { NT_REG, NT_MEM },     COND_NONE,     1, ACT_CMP },
+    { NT_STMT,  SEL_CMP,   { NT_MEM, NT_REG },     COND_NONE,     1, ACT_CMP },
+    { NT_STMT,  SEL_CMP,   { NT_MEM, NT_IMM },     COND_NONE,     1, ACT_CMP },
+    { NT_STMT,  SEL_MOVE,  { NT_REG, NT_NONE },    COND_NONE,     1, ACT_MOVE },
+    { NT_STMT,  SEL_MOVE,  { NT_IMM, NT_NONE },    COND_NONE,     1, ACT_MOVE },
+    { NT_STMT,  SEL_MOVE,  { NT_MEM, NT_NONE },    COND_DEST_REG, 1, ACT_MOVE },
+  };
+
+  const int NUM_RULES = int(std::end(rules) - std::begin(rules));
+  const int INFINITE_COST = INT_MAX / 4;
+
+  const int SCRATCH_REGS[] = { MREG_R10, MREG_R11, MREG_RAX, MREG_RDX };
+  const int NUM_SCRATCH_REGS = int(std::end(SCRATCH_REGS) - std::begin(SCRATCH_REGS));
+
+  bool is_commutative(SelectionOp op) {
+    return op == SEL_ADD || op == SEL_MUL;
+  }
+
+  bool is_imm32(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+  }
+
+  int get_scratch_index(const Operand &operand) {
+    for (int i = 0; i < NUM_SCRATCH_REGS; i++) {
+      if (SCRATCH_REGS[i] == operand.get_base_reg()) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  bool is_scratch(const Operand &operand) {
+    return operand.get_kind() == OPERAND_MREG && get_scratch_index(operand) >= 0;
+  }
+
+  // does any leaf of the tree read the mreg?
+  bool reads_reg(const SelectionNode *node, int reg) {
+    if (node->op == SEL_REG) {
+      return node->operand.get_base_reg() == reg;
+    }
+    for (unsigned i = 0; i < node->get_num_kids(); i++) {
+      if (reads_reg(node->kids[i], reg)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool check_condition(const SelectionRule &rule, const SelectionNode *node, const SelectionNode *left,
+                       const SelectionNode *right) {
+    switch (rule.cond) {
+    case COND_IMM32:
+      return is_imm32(node->operand.get_int_value());
+    case COND_SCALE:
+      {
+        if (right->op != SEL_CNST) {
+          return false;
+        }
+        long scale = right->operand.get_int_value();
+        return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+      }
+    case COND_DISP:
+      {
+        if (right->op != SEL_CNST) {
+          return false;
+        }
+        long disp = right->operand.get_int_value();
+        if (left->op == SEL_FRAME) {
+          disp += left->operand.get_offset();
+        }
+        return is_imm32(disp);
+      }
+    case COND_DEST_REG:
+      return node->operand.get_kind() == OPERAND_MREG;
+    case COND_ZERO:
+      return right->op == SEL_CNST && right->operand.get_int_value() == 0;
+    default:
+      return true;
+    }
+  }
+
+  int get_arith_opcode(SelectionOp op) {
+    switch (op) {
+    case SEL_ADD: return MINS_ADDQ;
+    case SEL_SUB: return MINS_SUBQ;
+    case SEL_MUL: return MINS_IMULQ;
+    default: assert(false); return MINS_NOP;
+    }
+  }
+}
+
+SelectionNode::SelectionNode(SelectionOp op, const Operand &operand, SelectionNode *left, SelectionNode *right)
+  : op(op)
+  , operand(operand)
+  , kids{ left, right } {
+  for (int nt = 0; nt < NUM_NONTERMINALS; nt++) {
+    cost[nt] = INFINITE_COST;
+    rule[nt] = -1;
+    swapped[nt] = false;
+  }
+}
+
+SelectionNode::~SelectionNode() {
+  delete kids[0];
+  delete kids[1];
+}
+
+unsigned SelectionNode::get_num_kids() const {
+  return (kids[0] != nullptr) + (kids[1] != nullptr);
+}
+
+X86_64InstructionSelector::X86_64InstructionSelector(InstructionSequence *iseq)
+  : m_iseq(iseq)
+  , m_scratch_in_use(0)
+  , m_out_of_regs(false)
+  , m_num_trees(0) {
+}
+
+X86_64InstructionSelector::~X86_64InstructionSelector() {
+}
+
+bool X86_64InstructionSelector::fits(SelectionNode *root) {
+  run(root);
+  for (auto i = m_code.begin(); i != m_code.end(); i++) {
+    delete *i;
+  }
+  m_code.clear();
+  return !m_out_of_regs;
+}
+
+void X86_64InstructionSelector::select(SelectionNode *root) {
+  run(root);
+  assert(!m_out_of_regs);
+  for (auto i = m_code.begin(); i != m_code.end(); i++) {
+    m_iseq->add_instruction(*i);
+  }
+  m_code.clear();
+  m_num_trees++;
+}
+
+// label the tree bottom-up with the cheapest rule deriving each
+// nonterminal at each node
+void X86_64InstructionSelector::label(SelectionNode *node) {
+  for (unsigned i = 0; i < node->get_num_kids(); i++) {
+    label(node->kids[i]);
+  }
+  for (int nt = 0; nt < NUM_NONTERMINALS; nt++) {
+    node->cost[nt] = INFINITE_COST;
+    node->rule[nt] = -1;
+    node->swapped[nt] = false;
+  }
+
+  unsigned num_kids = node->get_num_kids();
+  for (int r = 0; r < NUM_RULES; r++) {
+    const SelectionRule &rule = rules[r];
+    if (rule.op != node->op) {
+      continue;
+    }
+    for (int swap = 0; swap <= (num_kids == 2 && is_commutative(node->op)); swap++) {
+      SelectionNode *left = node->kids[swap], *right = node->kids[1 - swap];
+      if (!check_condition(rule, node, left, right)) {
+        continue;
+      }
+      int cost = rule.cost;
+      if (num_kids >= 1) {
+        cost += left->cost[rule.kids[0]];
+      }
+      if (num_kids == 2) {
+        cost += right->cost[rule.kids[1]];
+      }
+      if (cost < node->cost[rule.lhs]) {
+        node->cost[rule.lhs] = cost;
+        node->rule[rule.lhs] = r;
+        node->swapped[rule.lhs] = swap;
+      }
+    }
+  }
+
+  // chain rules, until nothing gets cheaper
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int r = 0; r < NUM_RULES; r++) {
+      const SelectionRule &rule = rules[r];
+      if (rule.op == SEL_CHAIN && node->cost[rule.kids[0]] + rule.cost < node->cost[rule.lhs]) {
+        node->cost[rule.lhs] = node->cost[rule.kids[0]] + rule.cost;
+        node->rule[rule.lhs] = r;
+        node->swapped[rule.lhs] = false;
+        changed = true;
+      }
+    }
+  }
+}
+
+// label and reduce a tree, leaving its code in m_code
+void X86_64InstructionSelector::run(SelectionNode *root) {
+  assert(root->op == SEL_STORE || root->op == SEL_CMP || root->op == SEL_MOVE);
+  m_code.clear();
+  m_scratch_in_use = 0;
+  m_out_of_regs = false;
+
+  label(root);
+  if (!reduce_in_place(root)) {
+    reduce(root, NT_STMT);
+  }
+}
+
+// x = x op tree (x an mreg, op an add, subtract, or multiply, and the
+// tree not reading x) is "op tree, x"
+bool X86_64InstructionSelector::reduce_in_place(SelectionNode *move) {
+  if (move->op != SEL_MOVE || move->operand.get_kind() != OPERAND_MREG) {
+    return false;
+  }
+  SelectionNode *arith = move->kids[0];
+  if (arith->op != SEL_ADD && arith->op != SEL_SUB && arith->op != SEL_MUL) {
+    return false;
+  }
+  int dest_reg = move->operand.get_base_reg();
+
+  // find x (on either side, if op is commutative)
+  int x = -1;
+  for (int i = 0; i < 2 && x < 0; i++) {
+    SelectionNode *kid = arith->kids[i];
+    if (kid->op == SEL_REG && kid->operand.get_base_reg() == dest_reg && (i == 0 || is_commutative(arith->op))) {
+      x = i;
+    }
+  }
+  if (x < 0) {
+    return false;
+  }
+  SelectionNode *other = arith->kids[1 - x];
+  if (reads_reg(other, dest_reg)) {
+    return false;
+  }
+
+  // the other operand can be a register, memory, or (except for
+  // imulq) an immediate, whichever is cheapest
+  int nt = NT_REG;
+  if (other->cost[NT_MEM] < other->cost[nt]) {
+    nt = NT_MEM;
+  }
+  if (arith->op != SEL_MUL && other->cost[NT_IMM] <= other->cost[nt]) {
+    nt = NT_IMM;
+  }
+  Value value = reduce(other, nt);
+  emit(get_arith_opcode(arith->op), value.operand, move->operand);
+  release(value.operand);
+  return true;
+}
+
+// emit the code for the rule deriving the nonterminal at the node, and
+// get its value; a register value goes in the target mreg if there is one
+X86_64InstructionSelector::Value X86_64InstructionSelector::reduce(SelectionNode *node, int nt, int target) {
+  int r = node->rule[nt];
+  assert(r >= 0);
+  const SelectionRule &rule = rules[r];
+
+  Value kids[2] = { { Operand(), 1 }, { Operand(), 1 } };
+  if (rule.op == SEL_CHAIN) {
+    kids[0] = reduce(node, rule.kids[0], target);
+  } else if (node->get_num_kids() > 0) {
+    bool swap = node->swapped[nt];
+    SelectionNode *first = node->kids[swap ? 1 : 0], *second = node->kids[swap ? 0 : 1];
+    if (second != nullptr && target >= 0 && is_commutative(node->op) && rule.kids[0] == rule.kids[1] &&
+        reads_reg(second, target) && !reads_reg(first, target)) {
+      std::swap(first, second);
+    }
+
+    // the value of a move goes directly to its destination; otherwise
+    // the target can also hold the value of the first operand, as
+    // long as the second doesn't read it
+    int first_target = target;
+    if (rule.action == ACT_MOVE) {
+      first_target = (node->operand.get_kind() == OPERAND_MREG) ? node->operand.get_base_reg() : -1;
+    } else if (second != nullptr && target >= 0 && reads_reg(second, target)) {
+      first_target = -1;
+    }
+    kids[0] = reduce(first, rule.kids[0], first_target);
+    if (second != nullptr) {
+      kids[1] = reduce(second, rule.kids[1]);
+    }
+  }
+
+  Value value = { Operand(), 1 };
+  switch (rule.action) {
+  case ACT_LEAF:
+    value.operand = node->operand;
+    break;
+
+  case ACT_LOAD_CNST:
+    value.operand = result_reg(target);
+    emit(MINS_MOVQ, node->operand, value.operand);
+    break;
+
+  case ACT_LOAD_MEM:
+    release(kids[0].operand);
+    value.operand = result_reg(target);
+    emit(MINS_MOVQ, kids[0].operand, value.operand);
+    break;
+
+  case ACT_LEA:
+    {
+      Operand addr = kids[0].operand;
+      release(addr);
+      value.operand = result_reg(target);
+      int reg = value.operand.get_base_reg();
+      if (addr.get_kind() == OPERAND_MREG_MEMREF_OFFSET && addr.get_base_reg() == reg) {
+        // r = r + c
+        emit(MINS_ADDQ, Operand(OPERAND_INT_LITERAL, addr.get_offset()), value.operand);
+      } else if (addr.get_kind() == OPERAND_MREG_MEMREF_INDEX && addr.get_scale() == 1 &&
+                 (addr.get_base_reg() == reg || addr.get_index_reg() == reg)) {
+        // r = r + x
+        int x = (addr.get_base_reg() == reg) ? addr.get_index_reg() : addr.get_base_reg();
+        emit(MINS_ADDQ, Operand(OPERAND_MREG, x), value.operand);
+      } else {
+        emit(MINS_LEAQ, addr, value.operand);
+      }
+    }
+    break;
+
+  case ACT_BASE:
+    value.operand = kids[0].operand.to_memref();
+    break;
+
+  case ACT_SAME:
+    value = kids[0];
+    break;
+
+  case ACT_DISP:
+    {
+      Operand base = kids[0].operand;
+      long disp = kids[1].operand.get_int_value();
+      if (base.get_kind() != OPERAND_MREG) {
+        disp += base.get_offset();
+      }
+      value.operand = Operand(OPERAND_MREG_MEMREF_OFFSET, base.get_base_reg(), int(disp));
+    }
+    break;
+
+  case ACT_BASE_INDEX:
+    {
+      Operand base = kids[0].operand;
+      int index_reg = kids[1].operand.get_base_reg();
+      if (base.get_kind() == OPERAND_MREG) {
+        value.operand = Operand(OPERAND_MREG_MEMREF_INDEX, base.get_base_reg(), index_reg);
+      } else {
+        value.operand = Operand(OPERAND_MREG_MEMREF_OFFSET_INDEX, base.get_base_reg(), index_reg, base.get_offset());
+      }
+      if (kids[1].scale != 1) {
+        value.operand.set_scale(kids[1].scale);
+      }
+    }
+    break;
+
+  case ACT_SCALE:
+    value.operand = kids[0].operand;
+    value.scale = int(kids[1].operand.get_int_value());
+    break;
+
+  case ACT_ARITH:
+    {
+      int opcode = get_arith_opcode(node->op);
+      Operand a = kids[0].operand, b = kids[1].operand;
+      bool b_reads_target = target >= 0 && b.has_base_reg() && (b.get_base_reg() == target || (b.has_index_reg() && b.get_index_reg() == target));
+      if (a.get_base_reg() == target || (is_scratch(a) && (target < 0 || b_reads_target))) {
+        // compute in place
+        value.operand = a;
+      } else {
+        release(a);
+        value.operand = b_reads_target ? alloc_scratch() : result_reg(target);
+        emit(MINS_MOVQ, a, value.operand);
+      }
+      emit(opcode, b, value.operand);
+      release(b);
+      if (target >= 0 && value.operand.get_base_reg() != target) {
+        release(value.operand);
+        emit(MINS_MOVQ, value.operand, Operand(OPERAND_MREG, target));
+        value.operand = Operand(OPERAND_MREG, target);
+      }
+    }
+    break;
+
+  case ACT_MUL_IMM:
+    {
+      Operand a = kids[0].operand;
+      long factor = kids[1].operand.get_int_value();
+      release(a);
+      value.operand = result_reg(target);
+      if (a.get_kind() == OPERAND_MREG && a.get_base_reg() == value.operand.get_base_reg() &&
+          factor > 0 && (factor & (factor - 1)) == 0) {
+        // in place, by a power of 2
+        int k = 0;
+        while ((1L << k) != factor) {
+          k++;
+        }
+        emit(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, k), value.operand);
+      } else {
+        emit(MINS_IMULQ, kids[1].operand, a, value.operand);
+      }
+    }
+    break;
+
+  case ACT_STORE:
+    emit(MINS_MOVQ, kids[1].operand, kids[0].operand);
+    release(kids[0].operand);
+    release(kids[1].operand);
+    break;
+
+  case ACT_CMP:
+    emit(MINS_CMPQ, kids[1].operand, kids[0].operand);
+    release(kids[0].operand);
+    release(kids[1].operand);
+    break;
+
+  case ACT_TEST:
+    emit(MINS_TESTQ, kids[0].operand, kids[0].operand);
+    release(kids[0].operand);
+    break;
+
+  case ACT_MOVE:
+    if (kids[0].operand.get_kind() != OPERAND_MREG || node->operand.get_kind() != OPERAND_MREG ||
+        kids[0].operand.get_base_reg() != node->operand.get_base_reg()) {
+      emit(MINS_MOVQ, kids[0].operand, node->operand);
+    }
+    release(kids[0].operand);
+    break;
+  }
+  return value;
+}
+
+Operand X86_64InstructionSelector::result_reg(int target) {
+  if (target >= 0) {
+    return Operand(OPERAND_MREG, target);
+  }
+  return alloc_scratch();
+}
+
+Operand X86_64InstructionSelector::alloc_scratch() {
+  for (int i = 0; i < NUM_SCRATCH_REGS; i++) {
+    if ((m_scratch_in_use & (1U << i)) == 0) {
+      m_scratch_in_use |= (1U << i);
+      return Operand(OPERAND_MREG, SCRATCH_REGS[i]);
+    }
+  }
+  // fits() will say no
+  m_out_of_regs = true;
+  return Operand(OPERAND_MREG, SCRATCH_REGS[0]);
+}
+
+// the value is no longer needed: free the scratch registers it's in
+void X86_64InstructionSelector::release(const Operand &operand) {
+  if (operand.has_base_reg()) {
+    int i = get_scratch_index(Operand(OPERAND_MREG, operand.get_base_reg()));
+    if (i >= 0) {
+      m_scratch_in_use &= ~(1U << i);
+    }
+  }
+  if (operand.has_index_reg()) {
+    int i = get_scratch_index(Operand(OPERAND_MREG, operand.get_index_reg()));
+    if (i >= 0) {
+      m_scratch_in_use &= ~(1U << i);
+    }
+  }
+}
+
+void X86_64InstructionSelector::emit(int opcode, const Operand &a, const Operand &b) {
+  m_code.push_back(new Instruction(opcode, a, b));
+}
+
+void X86_64InstructionSelector::emit(int opcode, const Operand &a, const Operand &b, const Operand &c) {
+  m_code.push_back(new Instruction(opcode, a, b, c));
+}
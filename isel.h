@@ -0,0 +1,115 @@
+#ifndef ISEL_H
+#define ISEL_H
+
+#include <vector>
+#include "cfg.h"
+
+// operators of the expression trees covered by the instruction selector
+enum SelectionOp {
+  SEL_REG,      // leaf: a value in an mreg
+  SEL_MEM,      // leaf: a value in a stack slot
+  SEL_CNST,     // leaf: a literal
+  SEL_FRAME,    // leaf: the address of a local variable (an offset from %rsp)
+  SEL_ADD,
+  SEL_SUB,
+  SEL_MUL,
+  SEL_LOAD,     // the value at the address kids[0]
+  SEL_STORE,    // root: store kids[1] at the address kids[0]
+  SEL_CMP,      // root: set the flags for kids[0] - kids[1]
+  SEL_MOVE,     // root: assign kids[0] to the destination operand
+  SEL_CHAIN,    // (only in rules) a nonterminal derived from another
+};
+
+// nonterminals of the tree grammar: what a subtree can be turned into
+enum SelectionNonterminal {
+  NT_NONE = -1,
+  NT_STMT,      // the code for a root
+  NT_REG,       // a value in a register
+  NT_IMM,       // a 32-bit immediate
+  NT_MEM,       // a value in memory (in any addressing mode)
+  NT_ADDR,      // an address, as an addressing mode
+  NT_INDEX,     // a register times a scale of 1, 2, 4, or 8
+  NT_FRAME,     // an offset from %rsp
+  NUM_NONTERMINALS
+};
+
+// A node of an expression tree.  Leaves and the destination of a
+// SEL_MOVE are machine operands (mregs, stack slots, and literals);
+// a node owns its kids.
+struct SelectionNode {
+  SelectionOp op;
+  Operand operand;
+  SelectionNode *kids[2];
+
+  // filled in when the tree is labeled: for each nonterminal, the
+  // minimum cost of deriving it from this node, the rule used, and
+  // whether the rule matched the kids of a commutative operator
+  // in reverse order
+  int cost[NUM_NONTERMINALS];
+  int rule[NUM_NONTERMINALS];
+  bool swapped[NUM_NONTERMINALS];
+
+  SelectionNode(SelectionOp op, const Operand &operand = Operand(),
+                SelectionNode *left = nullptr, SelectionNode *right = nullptr);
+  ~SelectionNode();
+
+  unsigned get_num_kids() const;
+};
+
+// Bottom-up rewrite (BURS) instruction selection for x86-64.  The
+// tree grammar is a constant table of rules, each matching a single
+// operator whose operands derive given nonterminals, with a cost in
+// instructions.  Labeling finds the cheapest derivation of every
+// nonterminal at every node (including chain rules such as reg <- mem)
+// by dynamic programming, and reduction then walks the chosen rules
+// from the root, emitting the code.  Covering a whole tree at once is
+// what allows a load to become a memory operand of an add or compare,
+// address arithmetic to become an addressing mode, and an add to
+// become a three-address leaq.
+//
+// Values inside a tree live in the scratch registers (%r10, %r11, %rax,
+// %rdx), so a tree must fit in them: fits() checks this by selecting
+// without keeping the code.  The value of a SEL_MOVE root is computed
+// directly in the destination mreg if no leaf reads it, and
+// "x = x op tree" becomes a single two-address instruction.
+class X86_64InstructionSelector {
+private:
+  // the value of a nonterminal: an operand, and for NT_INDEX the scale
+  struct Value {
+    Operand operand;
+    int scale;
+  };
+
+  InstructionSequence *m_iseq;
+  std::vector<Instruction *> m_code;
+  unsigned m_scratch_in_use;
+  bool m_out_of_regs;
+  unsigned m_num_trees;
+
+public:
+  X86_64InstructionSelector(InstructionSequence *iseq);
+  ~X86_64InstructionSelector();
+
+  // can the tree (a SEL_STORE, SEL_CMP, or SEL_MOVE root) be selected
+  // without running out of scratch registers?
+  bool fits(SelectionNode *root);
+
+  // append the minimum-cost code for the tree to the instruction sequence
+  void select(SelectionNode *root);
+
+  // get the number of trees selected
+  unsigned get_num_trees() const { return m_num_trees; }
+
+private:
+  void label(SelectionNode *node);
+  void run(SelectionNode *root);
+  bool reduce_in_place(SelectionNode *move);
+  Value reduce(SelectionNode *node, int nt, int target = -1);
+  Operand result_reg(int target);
+  Operand alloc_scratch();
+  void release(const Operand &operand);
+  void emit(int opcode, const Operand &a, const Operand &b);
+  void emit(int opcode, const Operand &a, const Operand &b, const Operand &c);
+};
+
+#endif // ISEL_H
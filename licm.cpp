@@ -0,0 +1,147 @@
+#include <cassert>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "loops.h"
+#include "ssa.h"
+#include "licm.h"
+
+namespace {
+  // can the instruction be executed when it otherwise wouldn't have
+  // been, without changing what the program does?
+  bool is_hoistable(Instruction *ins) {
+    switch (ins->get_opcode()) {
+    case HINS_INT_ADD:
+    case HINS_INT_SUB:
+    case HINS_INT_MUL:
+    case HINS_LOCALADDR:
+    case HINS_MOV:
+      return ins->get_operand(0).get_kind() == OPERAND_VREG;
+    case HINS_INT_DIV:
+    case HINS_INT_MOD:
+      {
+        // idivq traps on a zero divisor, and on overflow (dividing the
+        // most negative value by -1)
+        Operand divisor = ins->get_operand(2);
+        return divisor.get_kind() == OPERAND_INT_LITERAL &&
+          divisor.get_int_value() != 0 && divisor.get_int_value() != -1;
+      }
+    default:
+      return false;
+    }
+  }
+}
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_hoisted(0)
+  , m_num_preheaders(0) {
+}
+
+LoopInvariantCodeMotion::~LoopInvariantCodeMotion() {
+}
+
+void LoopInvariantCodeMotion::execute() {
+  find_defs();
+
+  // copy the loops, since creating preheaders discards the loop forest
+  LoopForest *forest = m_cfg->get_loop_forest();
+  const std::vector<Loop *> &loops = forest->get_loops();
+  std::vector<LoopBlocks> copies(loops.size());
+  for (unsigned i = 0; i < loops.size(); i++) {
+    copies[i].header = loops[i]->header;
+    copies[i].blocks.insert(loops[i]->blocks.begin(), loops[i]->blocks.end());
+    copies[i].parent = -1;
+    for (unsigned j = 0; j < i; j++) {
+      if (loops[j] == loops[i]->parent) {
+        copies[i].parent = int(j);
+      }
+    }
+  }
+
+  // inner loops first (each loop comes after the loops enclosing it)
+  for (unsigned i = unsigned(copies.size()); i > 0; i--) {
+    LoopBlocks &loop = copies[i - 1];
+    unsigned num_blocks = m_cfg->get_num_blocks();
+    BasicBlock *preheader = ssa_create_preheader(m_cfg, loop.header);
+    if (preheader == nullptr) {
+      continue;
+    }
+    if (m_cfg->get_num_blocks() != num_blocks) {
+      // a new block is part of the loops enclosing this one
+      m_num_preheaders++;
+      for (int j = loop.parent; j >= 0; j = copies[j].parent) {
+        copies[j].blocks.insert(preheader);
+      }
+    }
+    hoist(loop, preheader);
+  }
+}
+
+void LoopInvariantCodeMotion::find_defs() {
+  m_def_block.assign(count_vregs(m_cfg), nullptr);
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      if (is_def(*j)) {
+        m_def_block[(*j)->get_operand(0).get_base_reg()] = *i;
+      }
+    }
+  }
+}
+
+void LoopInvariantCodeMotion::hoist(LoopBlocks &loop, BasicBlock *preheader) {
+  // the hoisted instructions go before the preheader's jump (if any),
+  // in the order found; visiting the blocks in dominator tree order
+  // means an instruction's operands are hoisted before it is
+  unsigned insert_at = preheader->get_length();
+  if (insert_at > 0 && is_branch(preheader->get_last())) {
+    insert_at--;
+  }
+
+  DominatorTree *dom = m_cfg->get_dominator_tree();
+  const std::vector<BasicBlock *> &rpo = dom->get_rpo();
+  for (auto i = rpo.begin(); i != rpo.end(); i++) {
+    BasicBlock *bb = *i;
+    if (loop.blocks.count(bb) == 0) {
+      continue;
+    }
+    for (unsigned j = 0; j < bb->get_length(); ) {
+      Instruction *ins = bb->get_instruction(j);
+      if (!is_hoistable(ins) || !is_invariant(loop, ins)) {
+        j++;
+        continue;
+      }
+      Instruction *moved = ins->duplicate();
+      bb->remove_instruction(j);
+      preheader->insert_instruction(insert_at++, moved);
+      m_def_block[moved->get_operand(0).get_base_reg()] = preheader;
+      m_num_hoisted++;
+    }
+    if (bb->get_length() == 0) {
+      // keep a placeholder for the block's label
+      bb->add_instruction(new Instruction(HINS_EMPTY));
+    }
+  }
+}
+
+bool LoopInvariantCodeMotion::is_invariant(const LoopBlocks &loop, Instruction *ins) const {
+  for (unsigned k = 1; k < ins->get_num_operands(); k++) {
+    Operand operand = ins->get_operand(k);
+    if (operand.get_kind() == OPERAND_INT_LITERAL) {
+      continue;
+    }
+    if (operand.get_kind() != OPERAND_VREG) {
+      return false;
+    }
+    unsigned vreg = unsigned(operand.get_base_reg());
+    if (vreg >= m_def_block.size()) {
+      // defined by a phi in a new preheader
+      return false;
+    }
+    BasicBlock *def_block = m_def_block[vreg];
+    if (def_block != nullptr && loop.blocks.count(def_block) > 0) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,58 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include <vector>
+#include <set>
+#include "cfg.h"
+
+// Loop-invariant code motion over a high-level ControlFlowGraph in SSA
+// form (see SSABuilder).  An instruction in a natural loop whose
+// operands are all literals or vregs defined outside the loop computes
+// the same value on every iteration, so it is moved to the loop's
+// preheader (see ssa_create_preheader), which runs once before the
+// loop is entered.  Inner loops are done first, so an instruction
+// invariant in several nested loops moves out of all of them.
+//
+// The preheader runs even if the loop body (or the part of it holding
+// the instruction) wouldn't have, so only instructions that can't trap
+// are moved: arithmetic, localaddr, copies, and divisions by a literal
+// other than 0 or -1.  Loads stay in the loop, since a store in the
+// loop (or one of the loop's calls) could change the value.
+class LoopInvariantCodeMotion {
+private:
+  // the parts of a Loop needed here: the Loop itself goes away when
+  // the CFG changes
+  struct LoopBlocks {
+    BasicBlock *header;
+    std::set<BasicBlock *> blocks;
+    // index of the enclosing loop (-1 if none)
+    int parent;
+  };
+
+  ControlFlowGraph *m_cfg;
+  // block containing the def of each vreg (null for vregs not defined
+  // by any instruction)
+  std::vector<BasicBlock *> m_def_block;
+
+  unsigned m_num_hoisted;
+  unsigned m_num_preheaders;
+
+public:
+  LoopInvariantCodeMotion(ControlFlowGraph *cfg);
+  ~LoopInvariantCodeMotion();
+
+  void execute();
+
+  // get the number of instructions moved out of loops
+  unsigned get_num_hoisted() const { return m_num_hoisted; }
+
+  // get the number of preheader blocks created
+  unsigned get_num_preheaders() const { return m_num_preheaders; }
+
+private:
+  void find_defs();
+  void hoist(LoopBlocks &loop, BasicBlock *preheader);
+  bool is_invariant(const LoopBlocks &loop, Instruction *ins) const;
+};
+
+#endif // LICM_H
@@ -0,0 +1,237 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "live_intervals.h"
+
+////////////////////////////////////////////////////////////////////////
+// LiveInterval implementation
+////////////////////////////////////////////////////////////////////////
+
+LiveInterval::LiveInterval(int vreg)
+  : vreg(vreg) {
+}
+
+bool LiveInterval::covers(unsigned pos) const {
+  // find the first range ending after pos
+  auto i = std::upper_bound(ranges.begin(), ranges.end(), pos,
+                            [](unsigned p, const Range &r) { return p < r.second; });
+  return i != ranges.end() && i->first <= pos;
+}
+
+bool LiveInterval::intersects(const LiveInterval *other) const {
+  return next_intersection(other, 0) != UINT_MAX;
+}
+
+unsigned LiveInterval::next_intersection(const LiveInterval *other, unsigned pos) const {
+  // walk both range lists in parallel
+  auto i = ranges.begin(), j = other->ranges.begin();
+  while (i != ranges.end() && j != other->ranges.end()) {
+    unsigned start = std::max(std::max(i->first, j->first), pos);
+    unsigned end = std::min(i->second, j->second);
+    if (start < end) {
+      return start;
+    }
+    if (i->second < j->second) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+  return UINT_MAX;
+}
+
+unsigned LiveInterval::next_use(unsigned pos) const {
+  auto i = std::lower_bound(use_positions.begin(), use_positions.end(), pos);
+  return i != use_positions.end() ? *i : UINT_MAX;
+}
+
+void LiveInterval::add_range(unsigned start, unsigned end) {
+  if (start >= end) {
+    return;
+  }
+  // the most recently added range (lowest positions) is at the back
+  if (!ranges.empty() && end >= ranges.back().first) {
+    assert(start <= ranges.back().first);
+    ranges.back().first = start;
+    ranges.back().second = std::max(ranges.back().second, end);
+  } else {
+    ranges.push_back(Range(start, end));
+  }
+}
+
+void LiveInterval::finish() {
+  std::reverse(ranges.begin(), ranges.end());
+  std::reverse(use_positions.begin(), use_positions.end());
+}
+
+////////////////////////////////////////////////////////////////////////
+// LiveIntervals implementation
+////////////////////////////////////////////////////////////////////////
+
+LiveIntervals::LiveIntervals(ControlFlowGraph *cfg, LiveVregs *live_vregs)
+  : m_cfg(cfg)
+  , m_live_vregs(live_vregs)
+  , m_block_start(cfg->get_num_blocks(), 0)
+  , m_intervals(live_vregs->get_num_vregs(), nullptr) {
+}
+
+LiveIntervals::~LiveIntervals() {
+  for (auto i = m_intervals.begin(); i != m_intervals.end(); i++) {
+    delete *i;
+  }
+}
+
+void LiveIntervals::build() {
+  compute_block_order();
+
+  // number the instructions
+  unsigned pos = 0;
+  for (auto i = m_order.begin(); i != m_order.end(); i++) {
+    BasicBlock *bb = *i;
+    m_block_start[bb->get_id()] = pos;
+    for (unsigned j = 0; j < bb->get_length(); j++) {
+      if (is_call(bb->get_instruction(j))) {
+        m_call_positions.push_back(pos);
+      }
+      pos += 2;
+    }
+  }
+
+  // build intervals with a backwards walk over the blocks
+  for (auto i = m_order.rbegin(); i != m_order.rend(); i++) {
+    build_block_intervals(*i);
+  }
+
+  for (auto i = m_intervals.begin(); i != m_intervals.end(); i++) {
+    if (*i != nullptr) {
+      (*i)->finish();
+    }
+  }
+}
+
+std::vector<LiveInterval *> LiveIntervals::get_sorted_intervals() const {
+  std::vector<LiveInterval *> result;
+  for (auto i = m_intervals.begin(); i != m_intervals.end(); i++) {
+    if (*i != nullptr) {
+      result.push_back(*i);
+    }
+  }
+  std::stable_sort(result.begin(), result.end(),
+                   [](const LiveInterval *a, const LiveInterval *b) { return a->start() < b->start(); });
+  return result;
+}
+
+bool LiveIntervals::is_live_across_call(const LiveInterval *interval, unsigned call_pos) const {
+  // a vreg only read by the call dies at call_pos + 1, and a vreg
+  // written by the call is born at call_pos + 1
+  return interval->covers(call_pos) && interval->covers(call_pos + 1);
+}
+
+unsigned LiveIntervals::get_num_calls_crossed(const LiveInterval *interval) const {
+  unsigned count = 0;
+  auto i = std::lower_bound(m_call_positions.begin(), m_call_positions.end(), interval->start());
+  for (; i != m_call_positions.end() && *i < interval->end(); i++) {
+    if (is_live_across_call(interval, *i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void LiveIntervals::compute_block_order() {
+  // Number blocks in reverse postorder, so that (loops aside) a block's
+  // instructions are numbered after those of its predecessors.  Blocks
+  // not reachable from the entry block are numbered last.
+  std::vector<bool> visited(m_cfg->get_num_blocks(), false);
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+
+  BasicBlock *entry = m_cfg->get_entry_block();
+  visited[entry->get_id()] = true;
+  stack.push_back(std::make_pair(entry, 0U));
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_edge = stack.back().second;
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+
+    if (next_edge < outgoing_edges.size()) {
+      stack.back().second++;
+      BasicBlock *succ = outgoing_edges[next_edge]->get_target();
+      if (!visited[succ->get_id()]) {
+        visited[succ->get_id()] = true;
+        stack.push_back(std::make_pair(succ, 0U));
+      }
+    } else {
+      m_order.push_back(bb);
+      stack.pop_back();
+    }
+  }
+
+  std::reverse(m_order.begin(), m_order.end());
+
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    if (!visited[(*i)->get_id()]) {
+      m_order.push_back(*i);
+    }
+  }
+}
+
+void LiveIntervals::build_block_intervals(BasicBlock *bb) {
+  unsigned block_from = m_block_start[bb->get_id()];
+  unsigned block_to = block_from + 2 * bb->get_length();
+
+  // vregs live at the end of the block are live throughout the block,
+  // until a def is found
+  const LiveVregs::LiveSet &live_out = m_live_vregs->get_fact_at_end_of_block(bb);
+  for (auto i = live_out.begin(); i != live_out.end(); ++i) {
+    get_or_create_interval(int(*i))->add_range(block_from, block_to);
+  }
+
+  for (unsigned j = bb->get_length(); j > 0; j--) {
+    Instruction *ins = bb->get_instruction(j - 1);
+    unsigned pos = block_from + 2 * (j - 1);
+
+    if (is_def(ins)) {
+      // the def starts the live range (or creates a short range if
+      // the value is never used)
+      LiveInterval *interval = get_or_create_interval(ins->get_operand(0).get_base_reg());
+      if (!interval->ranges.empty() && interval->ranges.back().first <= pos &&
+          interval->ranges.back().second > pos) {
+        interval->ranges.back().first = pos + 1;
+      } else {
+        interval->add_range(pos + 1, pos + 2);
+      }
+      interval->use_positions.push_back(pos + 1);
+    }
+
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (!is_use(ins, k)) {
+        continue;
+      }
+      Operand operand = ins->get_operand(k);
+      LiveInterval *interval = get_or_create_interval(operand.get_base_reg());
+      interval->add_range(block_from, pos + 1);
+      if (interval->use_positions.empty() || interval->use_positions.back() != pos) {
+        interval->use_positions.push_back(pos);
+      }
+      if (operand.has_index_reg()) {
+        interval = get_or_create_interval(operand.get_index_reg());
+        interval->add_range(block_from, pos + 1);
+        if (interval->use_positions.empty() || interval->use_positions.back() != pos) {
+          interval->use_positions.push_back(pos);
+        }
+      }
+    }
+  }
+}
+
+LiveInterval *LiveIntervals::get_or_create_interval(int vreg) {
+  assert(vreg >= 0 && unsigned(vreg) < m_intervals.size());
+  if (m_intervals[vreg] == nullptr) {
+    m_intervals[vreg] = new LiveInterval(vreg);
+  }
+  return m_intervals[vreg];
+}
@@ -0,0 +1,103 @@
+#ifndef LIVE_INTERVALS_H
+#define LIVE_INTERVALS_H
+
+#include <vector>
+#include "cfg.h"
+#include "live_vregs.h"
+
+// A LiveInterval describes where a vreg is live, in terms of a linear
+// numbering of all of the instructions of a ControlFlowGraph.
+// Instruction number n has position 2n: its operands are read at
+// position 2n and its result is written at position 2n+1.
+//
+// Because blocks are laid out one after another, a vreg can be
+// dead for a while and then become live again (e.g., a temporary
+// vreg reused by several statements), so the interval is a sorted
+// list of disjoint half-open ranges [start, end).
+struct LiveInterval {
+  typedef std::pair<unsigned, unsigned> Range;
+
+  int vreg;
+  std::vector<Range> ranges;
+  // positions at which the vreg is used or defined, in increasing order
+  std::vector<unsigned> use_positions;
+
+  LiveInterval(int vreg);
+
+  unsigned start() const { return ranges.front().first; }
+  unsigned end() const { return ranges.back().second; }
+
+  bool covers(unsigned pos) const;
+
+  // does this interval overlap the other interval at any position?
+  bool intersects(const LiveInterval *other) const;
+
+  // first position at or after pos where both intervals are live
+  // (returns UINT_MAX if there is no such position)
+  unsigned next_intersection(const LiveInterval *other, unsigned pos) const;
+
+  // first use position at or after pos (UINT_MAX if none)
+  unsigned next_use(unsigned pos) const;
+
+  // Intervals are built by a backwards walk over the instructions, so
+  // while building, ranges and use positions are kept in decreasing
+  // order: add_range() extends the interval by [start, end), where start
+  // must be no greater than the start of any range already added, and
+  // finish() puts everything into increasing order.
+  void add_range(unsigned start, unsigned end);
+  void finish();
+};
+
+// Numbers the instructions of a ControlFlowGraph and computes
+// a LiveInterval for each vreg from the results of LiveVregs.
+class LiveIntervals {
+private:
+  ControlFlowGraph *m_cfg;
+  LiveVregs *m_live_vregs;
+  // blocks in the order they are numbered
+  std::vector<BasicBlock *> m_order;
+  // position of the first instruction of each block (indexed by block id)
+  std::vector<unsigned> m_block_start;
+  // intervals indexed by vreg number (null for vregs that are never live)
+  std::vector<LiveInterval *> m_intervals;
+  // positions of instructions which are lowered to calls
+  std::vector<unsigned> m_call_positions;
+
+public:
+  LiveIntervals(ControlFlowGraph *cfg, LiveVregs *live_vregs);
+  ~LiveIntervals();
+
+  void build();
+
+  unsigned get_num_vregs() const { return unsigned(m_intervals.size()); }
+
+  // get the interval for specified vreg (null if the vreg has no interval)
+  LiveInterval *get_interval(int vreg) const { return m_intervals[vreg]; }
+
+  // get all (non-null) intervals sorted by start position
+  std::vector<LiveInterval *> get_sorted_intervals() const;
+
+  // get the position of the instruction at specified index of a block
+  unsigned get_position(BasicBlock *bb, unsigned index) const {
+    return m_block_start[bb->get_id()] + 2 * index;
+  }
+
+  const std::vector<BasicBlock *> &get_block_order() const { return m_order; }
+
+  // positions of instructions that are lowered to calls
+  const std::vector<unsigned> &get_call_positions() const { return m_call_positions; }
+
+  // is the vreg's value needed after the call at specified position?
+  // (i.e., live both before and after the call)
+  bool is_live_across_call(const LiveInterval *interval, unsigned call_pos) const;
+
+  // get the number of calls the interval is live across
+  unsigned get_num_calls_crossed(const LiveInterval *interval) const;
+
+private:
+  void compute_block_order();
+  void build_block_intervals(BasicBlock *bb);
+  LiveInterval *get_or_create_interval(int vreg);
+};
+
+#endif // LIVE_INTERVALS_H
@@ -1,4 +1,6 @@
+#include <cassert>
 #include <algorithm>
+#include <deque>
 #include "cfg.h"
 #include "highlevel.h"
 #include "live_vregs.h"
@@ -7,10 +9,37 @@ namespace {
   bool DEBUG_LIVE_VREGS;
 }
 
+// find the number of vregs used by the instructions of a CFG
+unsigned count_vregs(ControlFlowGraph *cfg) {
+  unsigned num_vregs = 0;
+  for (auto i = cfg->bb_begin(); i != cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        Operand operand = ins->get_operand(k);
+        OperandKind kind = operand.get_kind();
+        if (kind != OPERAND_VREG && kind != OPERAND_VREG_MEMREF &&
+            kind != OPERAND_VREG_MEMREF_OFFSET && kind != OPERAND_VREG_MEMREF_INDEX) {
+          continue;
+        }
+        num_vregs = std::max(num_vregs, unsigned(operand.get_base_reg()) + 1);
+        if (operand.has_index_reg()) {
+          num_vregs = std::max(num_vregs, unsigned(operand.get_index_reg()) + 1);
+        }
+      }
+    }
+  }
+  return num_vregs;
+}
+
 LiveVregs::LiveVregs(ControlFlowGraph *cfg)
   : m_cfg(cfg)
-  , m_endfacts(cfg->get_num_blocks(), LiveSet())
-  , m_beginfacts(cfg->get_num_blocks(), LiveSet()) {
+  , m_num_vregs(count_vregs(cfg))
+  , m_endfacts(cfg->get_num_blocks(), LiveSet(m_num_vregs))
+  , m_beginfacts(cfg->get_num_blocks(), LiveSet(m_num_vregs))
+  , m_gen(cfg->get_num_blocks(), LiveSet(m_num_vregs))
+  , m_kill(cfg->get_num_blocks(), LiveSet(m_num_vregs)) {
 }
 
 LiveVregs::~LiveVregs() {
@@ -18,6 +47,7 @@ LiveVregs::~LiveVregs() {
 
 void LiveVregs::execute() {
   compute_iter_order();
+  compute_local_sets();
 
   if (DEBUG_LIVE_VREGS) {
     // for now just print iteration order
@@ -28,60 +58,73 @@ void LiveVregs::execute() {
     printf("\n");
   }
 
-  bool done = false;
-
-  unsigned num_iters = 0;
-  while (!done) {
-    num_iters++;
-    bool change = false;
+  // Worklist of blocks whose live-in set may be out of date.
+  // Initially every block is on the worklist (in iteration order);
+  // afterwards, a block is only revisited when the live-in set of
+  // one of its successors changes.
+  unsigned num_blocks = m_cfg->get_num_blocks();
+  std::deque<unsigned> work_list(m_iter_order.begin(), m_iter_order.end());
+  std::vector<bool> on_work_list(num_blocks, false);
+  for (auto i = m_iter_order.begin(); i != m_iter_order.end(); i++) {
+    on_work_list[*i] = true;
+  }
+  // blocks that can't reach the exit block (e.g., infinite loops)
+  // still need facts
+  for (unsigned id = 0; id < num_blocks; id++) {
+    if (!on_work_list[id]) {
+      work_list.push_back(id);
+      on_work_list[id] = true;
+    }
+  }
 
-    // for each block (according to the iteration order)...
-    for (auto i = m_iter_order.begin(); i != m_iter_order.end(); i++) {
-      unsigned id = *i;
-      BasicBlock *bb = m_cfg->get_block(id);
-
-      // Compute the set of vregs we currently know to be alive at the
-      // end of the basic block.  For the exit block, this is the empty set.
-      // for all other blocks (which will have at least one successor),
-      // then it's the union of the vregs we know to be alive at the
-      // beginning of each successor.
-      LiveSet live_set;
-      if (bb->get_kind() != BASICBLOCK_EXIT) {
-        const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
-        for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
-          Edge *e = *j;
-          BasicBlock *successor = e->get_target();
-          live_set |= m_beginfacts[successor->get_id()];
-        }
+  unsigned num_visits = 0;
+  while (!work_list.empty()) {
+    unsigned id = work_list.front();
+    work_list.pop_front();
+    on_work_list[id] = false;
+    num_visits++;
+
+    BasicBlock *bb = m_cfg->get_block(id);
+
+    // Compute the set of vregs we currently know to be alive at the
+    // end of the basic block.  For the exit block, this is the empty set.
+    // for all other blocks (which will have at least one successor),
+    // then it's the union of the vregs we know to be alive at the
+    // beginning of each successor.
+    LiveSet live_set(m_num_vregs);
+    if (bb->get_kind() != BASICBLOCK_EXIT) {
+      const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+      for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+        Edge *e = *j;
+        BasicBlock *successor = e->get_target();
+        live_set |= m_beginfacts[successor->get_id()];
       }
+    }
 
-      // Update (currently-known) live vregs at the end of the basic block
-      m_endfacts[id] = live_set;
+    // Update (currently-known) live vregs at the end of the basic block
+    m_endfacts[id] = live_set;
 
-      // for each Instruction in reverse order...
-      for (auto j = bb->crbegin(); j != bb->crend(); j++) {
-        Instruction *ins = *j;
+    // live-in = gen U (live-out - kill)
+    live_set.subtract(m_kill[id]);
+    live_set |= m_gen[id];
 
-        // model the instruction
-        model_instruction(ins, live_set);
-      }
+    // if the live_set at the beginning of the block changed,
+    // the predecessors need to be (re)visited
+    if (live_set != m_beginfacts[id]) {
+      m_beginfacts[id] = live_set;
 
-      // did the live_set at the beginning of the block change?
-      // if so, at least one more round will be needed
-      if (live_set != m_beginfacts[id]) {
-        change = true;
-        m_beginfacts[id] = live_set;
+      const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+      for (auto j = incoming_edges.cbegin(); j != incoming_edges.cend(); j++) {
+        unsigned pred_id = (*j)->get_source()->get_id();
+        if (!on_work_list[pred_id]) {
+          work_list.push_back(pred_id);
+          on_work_list[pred_id] = true;
+        }
       }
     }
-
-    // if there was no change in the computed dataflow fact at the beginning
-    // of any block, then the analysis has terminated
-    if (!change) {
-      done = true;
-    }
   }
   if (DEBUG_LIVE_VREGS) {
-    printf("Analysis finished in %u iterations\n", num_iters);
+    printf("Analysis finished after %u block visits\n", num_visits);
   }
 }
 
@@ -93,59 +136,123 @@ const LiveVregs::LiveSet &LiveVregs::get_fact_at_beginning_of_block(BasicBlock *
   return m_beginfacts.at(bb->get_id());
 }
 
-LiveVregs::LiveSet LiveVregs::get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const {
-  LiveSet live_set = m_endfacts[bb->get_id()];
+const LiveVregs::LiveSet &LiveVregs::get_fact_after_instruction(BasicBlock *bb, unsigned index) const {
+  const std::vector<LiveSet> &facts = get_instruction_facts(bb);
+  assert(index < facts.size());
+  return facts[index];
+}
 
-  for (auto i = bb->crbegin(); i != bb->crend(); i++) {
-    if (*i == ins) {
-      break;
-    }
-    model_instruction(*i, live_set);
+const LiveVregs::LiveSet &LiveVregs::get_fact_before_instruction(BasicBlock *bb, unsigned index) const {
+  // the fact before an instruction is the fact after its predecessor
+  // in the block, or the fact at the beginning of the block for the
+  // first instruction
+  if (index == 0) {
+    return get_fact_at_beginning_of_block(bb);
   }
+  return get_fact_after_instruction(bb, index - 1);
+}
 
-  return live_set;
+LiveVregs::LiveSet LiveVregs::get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const {
+  return get_fact_after_instruction(bb, get_instruction_index(bb, ins));
 }
 
 LiveVregs::LiveSet LiveVregs::get_fact_before_instruction(BasicBlock *bb, Instruction *ins) const {
-  LiveSet live_set = m_endfacts[bb->get_id()];
+  return get_fact_before_instruction(bb, get_instruction_index(bb, ins));
+}
+
+const std::vector<LiveVregs::LiveSet> &LiveVregs::get_instruction_facts(BasicBlock *bb) const {
+  unsigned id = bb->get_id();
+  if (m_insfacts.empty()) {
+    m_insfacts.resize(m_cfg->get_num_blocks());
+    m_have_insfacts.assign(m_cfg->get_num_blocks(), false);
+  }
 
-  for (auto i = bb->crbegin(); i != bb->crend(); i++) {
-    model_instruction(*i, live_set);
-    if (*i == ins) {
-      break;
+  if (!m_have_insfacts[id]) {
+    // one backward pass over the block records the live set
+    // after every instruction
+    std::vector<LiveSet> &facts = m_insfacts[id];
+    unsigned num_ins = bb->get_length();
+    facts.assign(num_ins, LiveSet(m_num_vregs));
+
+    LiveSet live_set = m_endfacts[id];
+    for (unsigned i = num_ins; i > 0; i--) {
+      facts[i - 1] = live_set;
+      model_instruction(bb->get_instruction(i - 1), live_set);
     }
+    m_have_insfacts[id] = true;
   }
 
-  return live_set;
+  return m_insfacts[id];
+}
+
+unsigned LiveVregs::get_instruction_index(BasicBlock *bb, Instruction *ins) const {
+  for (unsigned i = 0; i < bb->get_length(); i++) {
+    if (bb->get_instruction(i) == ins) {
+      return i;
+    }
+  }
+  assert(false);
+  return 0;
 }
 
 void LiveVregs::compute_iter_order() {
   // since this is a backwards problem,
   // desired iteration order is reverse postorder on
   // reversed CFG
-  std::bitset<MAX_BLOCKS> visited;
-  postorder_on_rcfg(visited, m_cfg->get_exit_block());
+  //
+  // The depth-first search uses an explicit stack so that very
+  // large CFGs can't overflow the call stack.
+  std::vector<bool> visited(m_cfg->get_num_blocks(), false);
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+
+  BasicBlock *exit = m_cfg->get_exit_block();
+  visited[exit->get_id()] = true;
+  stack.push_back(std::make_pair(exit, 0U));
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_edge = stack.back().second;
+    const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+
+    if (next_edge < incoming_edges.size()) {
+      // visit the next predecessor (if it hasn't been visited yet)
+      stack.back().second++;
+      BasicBlock *pred = incoming_edges[next_edge]->get_source();
+      if (!visited[pred->get_id()]) {
+        visited[pred->get_id()] = true;
+        stack.push_back(std::make_pair(pred, 0U));
+      }
+    } else {
+      // all predecessors visited: add this block to the order
+      m_iter_order.push_back(bb->get_id());
+      stack.pop_back();
+    }
+  }
+
   std::reverse(m_iter_order.begin(), m_iter_order.end());
 }
 
-void LiveVregs::postorder_on_rcfg(std::bitset<LiveVregs::MAX_BLOCKS> &visited, BasicBlock *bb) {
-  // already arrived at this block?
-  if (visited.test(bb->get_id())) {
-    return;
-  }
-
-  // this block is now guaranteed to be visited
-  visited.set(bb->get_id());
+void LiveVregs::compute_local_sets() {
+  // Summarize each block as a (gen, kill) pair.  Modeling the block's
+  // instructions backwards starting from the empty set yields
+  // exactly the upward-exposed uses; the kill set is every vreg
+  // the block defines.
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    unsigned id = bb->get_id();
+
+    LiveSet gen(m_num_vregs), kill(m_num_vregs);
+    for (auto j = bb->crbegin(); j != bb->crend(); j++) {
+      Instruction *ins = *j;
+      model_instruction(ins, gen);
+      if (is_def(ins)) {
+        kill.set(ins->get_operand(0).get_base_reg());
+      }
+    }
 
-  // recursively visit predecessors
-  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
-  for (auto i = incoming_edges.begin(); i != incoming_edges.end(); i++) {
-    Edge *e = *i;
-    postorder_on_rcfg(visited, e->get_source());
+    m_gen[id] = gen;
+    m_kill[id] = kill;
   }
-
-  // add this block to the order
-  m_iter_order.push_back(bb->get_id());
 }
 
 void LiveVregs::model_instruction(Instruction *ins, LiveSet &fact) const {
@@ -200,11 +307,9 @@ std::string LiveVregsControlFlowGraphPrinter::format_instruction(BasicBlock *bb,
 
 std::string LiveVregsControlFlowGraphPrinter::format_set(const LiveVregs::LiveSet &live_set) {
   std::string s;
-  for (unsigned i = 0; i < LiveVregs::MAX_VREGS; i++) {
-    if (live_set.test(i)) {
-      if (!s.empty()) { s += ","; }
-      s += std::to_string(i);
-    }
+  for (auto i = live_set.begin(); i != live_set.end(); ++i) {
+    if (!s.empty()) { s += ","; }
+    s += std::to_string(*i);
   }
   return s;
 }
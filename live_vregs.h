@@ -1,36 +1,48 @@
 #ifndef LIVE_VREGS_H
 #define LIVE_VREGS_H
 
-#include <bitset>
 #include <vector>
 #include "cfg.h"
 #include "highlevel.h"
+#include "vreg_set.h"
+
+// find the number of vregs used by the instructions of a CFG (one
+// more than the highest vreg number)
+unsigned count_vregs(ControlFlowGraph *cfg);
 
 class LiveVregs {
 public:
-  // we assume that there are never more than this many vregs used
-  static const unsigned MAX_VREGS = 256;
-
-  // We use a bitset to represent the set of live vregs.
-  // To check whether a vreg is live, check the bit indexed by
-  // its register number.
-  typedef std::bitset<MAX_VREGS> LiveSet;
-
-  // we assume there are never more than this many basic blocks
-  static const unsigned MAX_BLOCKS = 1024;
+  // We use a VregSet to represent the set of live vregs.
+  // To check whether a vreg is live, test the member indexed by
+  // its register number.  Sets are sized from the number of vregs
+  // the function actually uses.
+  typedef VregSet LiveSet;
 
 private:
   // the control flow graph
   ControlFlowGraph *m_cfg;
+  // one more than the highest vreg number used in the CFG
+  unsigned m_num_vregs;
   // live vregs at end and beginning of each basic block
   std::vector<LiveSet> m_endfacts, m_beginfacts;
+  // per-block upward-exposed uses (gen) and defs (kill),
+  // computed once before the fixpoint iteration
+  std::vector<LiveSet> m_gen, m_kill;
   // block iteration order
   std::vector<unsigned> m_iter_order;
+  // live vregs after each instruction, indexed by block id and then
+  // by instruction index; a block's entry is filled in (by a single
+  // backward pass over the block) the first time it is queried
+  mutable std::vector<std::vector<LiveSet> > m_insfacts;
+  mutable std::vector<bool> m_have_insfacts;
 
 public:
   LiveVregs(ControlFlowGraph *cfg);
   ~LiveVregs();
 
+  // get the number of vregs (one more than the highest vreg number)
+  unsigned get_num_vregs() const { return m_num_vregs; }
+
   // execute the analysis
   void execute();
 
@@ -40,6 +52,14 @@ public:
   // get live vregs at beginning of specific block
   const LiveSet &get_fact_at_beginning_of_block(BasicBlock *bb) const;
 
+  // get live vregs after the instruction at the specified index
+  // of the block
+  const LiveSet &get_fact_after_instruction(BasicBlock *bb, unsigned index) const;
+
+  // get live vregs before the instruction at the specified index
+  // of the block
+  const LiveSet &get_fact_before_instruction(BasicBlock *bb, unsigned index) const;
+
   // get live vregs after specified instruction
   LiveSet get_fact_after_instruction(BasicBlock *bb, Instruction *ins) const;
 
@@ -48,7 +68,9 @@ public:
 
 private:
   void compute_iter_order();
-  void postorder_on_rcfg(std::bitset<MAX_BLOCKS> &visited, BasicBlock *bb);
+  void compute_local_sets();
+  const std::vector<LiveSet> &get_instruction_facts(BasicBlock *bb) const;
+  unsigned get_instruction_index(BasicBlock *bb, Instruction *ins) const;
   void model_instruction(Instruction *ins, LiveSet &fact) const;
 };
 
@@ -0,0 +1,93 @@
+#include <cassert>
+#include <vector>
+#include "cfg.h"
+#include "loops.h"
+#include "loop_rotate.h"
+
+namespace {
+  // the most instructions a loop's test can have to be copied
+  const unsigned MAX_GUARD_LENGTH = 8;
+}
+
+LoopRotation::LoopRotation(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_rotated(0) {
+}
+
+LoopRotation::~LoopRotation() {
+}
+
+void LoopRotation::execute() {
+  // copy the headers, since changing the CFG discards the loop forest
+  std::vector<BasicBlock *> headers;
+  const std::vector<Loop *> &loops = m_cfg->get_loop_forest()->get_loops();
+  for (auto i = loops.begin(); i != loops.end(); i++) {
+    headers.push_back((*i)->header);
+  }
+
+  for (auto i = headers.begin(); i != headers.end(); i++) {
+    if (rotate(*i)) {
+      m_num_rotated++;
+    }
+  }
+}
+
+bool LoopRotation::rotate(BasicBlock *header) {
+  LoopForest *loops = m_cfg->get_loop_forest();
+  Loop *loop = loops->get_loop(header);
+  if (loop == nullptr || loop->header != header || header->get_length() > MAX_GUARD_LENGTH) {
+    return false;
+  }
+
+  // the header must either stay in the loop or leave it
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(header);
+  if (outgoing_edges.size() != 2) {
+    return false;
+  }
+  Edge *stay = nullptr, *leave = nullptr;
+  for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+    if (loops->contains(loop, (*i)->get_target())) {
+      stay = *i;
+    } else {
+      leave = *i;
+    }
+  }
+  if (stay == nullptr || leave == nullptr || stay->get_target() == header) {
+    return false;
+  }
+
+  // the loop must be entered from one block, which only goes to the
+  // header
+  Edge *entering = nullptr;
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(header);
+  for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+    if (!loops->contains(loop, (*i)->get_source())) {
+      if (entering != nullptr) {
+        return false;
+      }
+      entering = *i;
+    }
+  }
+  if (entering == nullptr) {
+    return false;
+  }
+  BasicBlock *pred = entering->get_source();
+  if (pred->get_kind() != BASICBLOCK_INTERIOR || m_cfg->get_outgoing_edges(pred).size() != 1) {
+    return false;
+  }
+
+  // replace the jump to the header (if there is one) with a copy of
+  // the header, going the same places
+  BasicBlock *body = stay->get_target(), *out = leave->get_target();
+  EdgeKind stay_kind = stay->get_kind(), leave_kind = leave->get_kind();
+  if (entering->get_kind() == EDGE_BRANCH) {
+    pred->remove_instruction(pred->get_length() - 1);
+  }
+  m_cfg->remove_edge(entering);
+  for (auto i = header->cbegin(); i != header->cend(); i++) {
+    pred->add_instruction((*i)->duplicate());
+  }
+  m_cfg->create_edge(pred, body, stay_kind);
+  m_cfg->create_edge(pred, out, leave_kind);
+  return true;
+}
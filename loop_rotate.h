@@ -0,0 +1,48 @@
+#ifndef LOOP_ROTATE_H
+#define LOOP_ROTATE_H
+
+#include "cfg.h"
+
+// Loop rotation over a ControlFlowGraph that isn't in SSA form.  The
+// code generator already tests a WHILE loop at the bottom, entering it
+// with a jump to the test:
+//
+//        jmp test                      (test, with a branch to out)
+//   body:                        body:
+//        ...                 =>       ...
+//   test:                        test:
+//        cmp; jcc body                cmp; jcc body
+//   out:                         out:
+//
+// Rotation copies the test (a loop header that can leave the loop)
+// into the block entering the loop in place of the jump, so the loop is
+// only entered if the test passes, and then falls into the body; the
+// body becomes the loop's header.  Every iteration still takes one
+// branch, but the jump on entry is gone, and the loop's test is at its
+// latch, which is where LICM's preheader and the induction variable
+// passes expect to find it.
+//
+// A test is only copied if it's short (see MAX_GUARD_LENGTH), and if
+// the loop is entered from a single block that only goes to the
+// header.  The copy has the same successors as the header, so the
+// result must be flattened with a BranchRewriter (see
+// ControlFlowGraph::create_instruction_sequence).
+class LoopRotation {
+private:
+  ControlFlowGraph *m_cfg;
+  unsigned m_num_rotated;
+
+public:
+  LoopRotation(ControlFlowGraph *cfg);
+  ~LoopRotation();
+
+  void execute();
+
+  // get the number of loops rotated
+  unsigned get_num_rotated() const { return m_num_rotated; }
+
+private:
+  bool rotate(BasicBlock *header);
+};
+
+#endif // LOOP_ROTATE_H
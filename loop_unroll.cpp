@@ -0,0 +1,373 @@
+#include <cassert>
+#include <climits>
+#include <vector>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "loops.h"
+#include "loop_unroll.h"
+
+namespace {
+  // how many copies of the body a partially unrolled loop has
+  const unsigned UNROLL_FACTOR = 4;
+
+  // loops running longer than this are treated as if their trip count
+  // were only known at run time
+  const long MAX_TRIP_COUNT = 1L << 16;
+
+  bool is_literal(const Operand &operand) {
+    return operand.get_kind() == OPERAND_INT_LITERAL;
+  }
+
+  bool is_vreg(const Operand &operand) {
+    return operand.get_kind() == OPERAND_VREG;
+  }
+
+  bool is_nop(Instruction *ins) {
+    return ins->get_opcode() == HINS_NOP || ins->get_opcode() == HINS_EMPTY;
+  }
+
+  bool fits_in_imm32(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+  }
+
+  // does "cmpi a, b" followed by a conditional jump branch?
+  bool branch_taken(int opcode, long a, long b) {
+    switch (opcode) {
+    case HINS_JE:   return a == b;
+    case HINS_JNE:  return a != b;
+    case HINS_JLT:  return a < b;
+    case HINS_JLTE: return a <= b;
+    case HINS_JGT:  return a > b;
+    case HINS_JGTE: return a >= b;
+    default:
+      assert(false);
+      return false;
+    }
+  }
+
+  // the condition with the compare's operands swapped
+  int mirror_condition(int opcode) {
+    switch (opcode) {
+    case HINS_JLT:  return HINS_JGT;
+    case HINS_JLTE: return HINS_JGTE;
+    case HINS_JGT:  return HINS_JLT;
+    case HINS_JGTE: return HINS_JLTE;
+    default:        return opcode;
+    }
+  }
+
+  // find the index of the last instruction before index end defining a
+  // vreg in a block (-1 if there is none)
+  int find_def_before(BasicBlock *bb, int vreg, unsigned end) {
+    for (unsigned i = end; i > 0; i--) {
+      Instruction *ins = bb->get_instruction(i - 1);
+      if (is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+        return int(i - 1);
+      }
+    }
+    return -1;
+  }
+
+  // the number of instructions in the loop's body (i.e., not counting
+  // nops, and the compare and branch at the end)
+  unsigned get_body_length(BasicBlock *bb) {
+    unsigned length = 0;
+    for (unsigned i = 0; i + 2 < bb->get_length(); i++) {
+      length += is_nop(bb->get_instruction(i)) ? 0 : 1;
+    }
+    return length;
+  }
+
+  // append copies of the first length instructions of body to a block
+  void append_copies(BasicBlock *bb, BasicBlock *body, unsigned length, unsigned times) {
+    for (unsigned k = 0; k < times; k++) {
+      for (unsigned i = 0; i < length; i++) {
+        Instruction *ins = body->get_instruction(i);
+        if (!is_nop(ins)) {
+          bb->add_instruction(ins->duplicate());
+        }
+      }
+    }
+  }
+
+  // repeat the body of a loop's block (which ends with a compare and a
+  // branch) so that it's there the given number of times
+  void repeat_body(BasicBlock *bb, unsigned times) {
+    unsigned length = bb->get_length() - 2;
+    for (unsigned k = 1; k < times; k++) {
+      for (unsigned i = 0; i < length; i++) {
+        Instruction *ins = bb->get_instruction(i);
+        if (!is_nop(ins)) {
+          bb->insert_instruction(bb->get_length() - 2, ins->duplicate());
+        }
+      }
+    }
+  }
+}
+
+LoopUnrolling::LoopUnrolling(ControlFlowGraph *cfg, unsigned budget)
+  : m_cfg(cfg)
+  , m_budget(budget)
+  , m_next_vreg(0)
+  , m_num_unrolled(0)
+  , m_num_partially_unrolled(0) {
+}
+
+LoopUnrolling::~LoopUnrolling() {
+}
+
+void LoopUnrolling::execute() {
+  m_next_vreg = int(count_vregs(m_cfg));
+
+  // copy the headers, since changing the CFG discards the loop forest
+  std::vector<BasicBlock *> headers;
+  const std::vector<Loop *> &loops = m_cfg->get_loop_forest()->get_loops();
+  for (auto i = loops.begin(); i != loops.end(); i++) {
+    headers.push_back((*i)->header);
+  }
+
+  for (auto i = headers.begin(); i != headers.end(); i++) {
+    TripCount trip;
+    if (!analyze(*i, trip)) {
+      continue;
+    }
+    unsigned length = get_body_length(trip.block);
+    if (length == 0) {
+      continue;
+    }
+
+    if (trip.count > 0 && trip.count * length <= m_budget) {
+      unroll_fully(trip);
+      m_num_unrolled++;
+      continue;
+    }
+
+    // the most copies that fit in the budget (along with the iterations
+    // peeled in front of the loop, if the trip count is known)
+    unsigned factor = UNROLL_FACTOR;
+    while (factor >= 2 && (factor + (trip.count > 0 ? trip.count % factor : 0)) * length > m_budget) {
+      factor--;
+    }
+    if (factor < 2) {
+      continue;
+    }
+
+    if (trip.count > 0) {
+      unroll_by_factor(trip, factor);
+      m_num_partially_unrolled++;
+    } else if (trip.runtime_count) {
+      unroll_with_remainder(trip, factor);
+      m_num_partially_unrolled++;
+    }
+  }
+}
+
+// find the loop's induction variable, bound and step from the test at
+// the end of its block, and its trip count if it's constant
+bool LoopUnrolling::analyze(BasicBlock *header, TripCount &trip) {
+  LoopForest *loops = m_cfg->get_loop_forest();
+  Loop *loop = loops->get_loop(header);
+  if (loop == nullptr || loop->header != header || loop->blocks.size() != 1) {
+    return false;
+  }
+
+  // the block must branch back to itself, and otherwise leave the loop
+  Edge *back = m_cfg->lookup_edge(header, header);
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(header);
+  if (back == nullptr || back->get_kind() != EDGE_BRANCH || outgoing_edges.size() != 2) {
+    return false;
+  }
+  Edge *leave = (outgoing_edges[0] == back) ? outgoing_edges[1] : outgoing_edges[0];
+
+  // ...and be entered from one block
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(header);
+  if (incoming_edges.size() != 2) {
+    return false;
+  }
+  Edge *entering = (incoming_edges[0] == back) ? incoming_edges[1] : incoming_edges[0];
+
+  unsigned len = header->get_length();
+  if (len < 3 || !is_conditional_branch(header->get_last()) ||
+      header->get_instruction(len - 2)->get_opcode() != HINS_INT_COMPARE) {
+    return false;
+  }
+  trip.block = header;
+  trip.preheader = entering->get_source();
+  trip.out = leave->get_target();
+  trip.compare = header->get_instruction(len - 2);
+  trip.branch = header->get_last();
+
+  // the induction variable can be on either side of the compare, and
+  // the bound must be a literal or a vreg the loop doesn't change
+  Operand a = trip.compare->get_operand(0), b = trip.compare->get_operand(1);
+  auto is_bound = [&](const Operand &operand, int iv) {
+    return is_literal(operand) ||
+      (is_vreg(operand) && operand.get_base_reg() != iv && find_def_before(header, operand.get_base_reg(), len) < 0);
+  };
+  if (is_vreg(a) && is_bound(b, a.get_base_reg()) && find_step(header, a.get_base_reg(), trip.step)) {
+    trip.iv = a.get_base_reg();
+    trip.bound = b;
+    trip.op = trip.branch->get_opcode();
+  } else if (is_vreg(b) && is_bound(a, b.get_base_reg()) && find_step(header, b.get_base_reg(), trip.step)) {
+    trip.iv = b.get_base_reg();
+    trip.bound = a;
+    trip.op = mirror_condition(trip.branch->get_opcode());
+  } else {
+    return false;
+  }
+
+  // a loop counting up to (or down to) its bound runs a number of times
+  // that can be worked out when it's entered (but a loop going straight
+  // to the exit isn't unrolled that way, since the remainder would be a
+  // second block falling through to the exit)
+  trip.runtime_count = (((trip.op == HINS_JLT || trip.op == HINS_JLTE) && trip.step > 0) ||
+                        ((trip.op == HINS_JGT || trip.op == HINS_JGTE) && trip.step < 0)) &&
+                       trip.out != m_cfg->get_exit_block();
+  trip.count = find_count(trip);
+  return true;
+}
+
+// is iv changed exactly once in the block, by adding a literal to it?
+bool LoopUnrolling::find_step(BasicBlock *bb, int iv, long &step) {
+  unsigned end = bb->get_length() - 2;
+  int def = find_def_before(bb, iv, end);
+  if (def < 0 || find_def_before(bb, iv, unsigned(def)) >= 0) {
+    return false;
+  }
+
+  // "addi iv, iv, $step", or "addi t, iv, $step; mov iv, t"
+  Instruction *ins = bb->get_instruction(unsigned(def));
+  if (ins->get_opcode() == HINS_MOV && is_vreg(ins->get_operand(1)) && ins->get_operand(1).get_base_reg() != iv) {
+    int t = find_def_before(bb, ins->get_operand(1).get_base_reg(), unsigned(def));
+    if (t < 0) {
+      return false;
+    }
+    ins = bb->get_instruction(unsigned(t));
+  }
+  if ((ins->get_opcode() != HINS_INT_ADD && ins->get_opcode() != HINS_INT_SUB) ||
+      !is_vreg(ins->get_operand(1)) || ins->get_operand(1).get_base_reg() != iv ||
+      !is_literal(ins->get_operand(2))) {
+    return false;
+  }
+  step = ins->get_operand(2).get_int_value();
+  if (ins->get_opcode() == HINS_INT_SUB) {
+    step = -step;
+  }
+  return step != 0 && fits_in_imm32(step * long(UNROLL_FACTOR));
+}
+
+// the number of times the block runs each time the loop is entered, if
+// the induction variable's value entering the loop and the bound are
+// literals (0 if not)
+long LoopUnrolling::find_count(const TripCount &trip) {
+  int def = find_def_before(trip.preheader, trip.iv, trip.preheader->get_length());
+  if (def < 0 || !is_literal(trip.bound)) {
+    return 0;
+  }
+  Instruction *ins = trip.preheader->get_instruction(unsigned(def));
+  if (ins->get_opcode() != HINS_MOV || !is_literal(ins->get_operand(1))) {
+    return 0;
+  }
+
+  long value = ins->get_operand(1).get_int_value(), bound = trip.bound.get_int_value();
+  for (long count = 1; count <= MAX_TRIP_COUNT; count++) {
+    value += trip.step;
+    if (!branch_taken(trip.op, value, bound)) {
+      return count;
+    }
+  }
+  return 0;
+}
+
+// replace the loop with copies of its body, one for each iteration
+void LoopUnrolling::unroll_fully(const TripCount &trip) {
+  BasicBlock *bb = trip.block;
+  repeat_body(bb, unsigned(trip.count));
+  bb->remove_instruction(bb->get_length() - 1);
+  bb->remove_instruction(bb->get_length() - 1);
+
+  // the block now just falls through to the code after the loop
+  m_cfg->remove_edge(m_cfg->lookup_edge(bb, bb));
+  Edge *leave = m_cfg->lookup_edge(bb, trip.out);
+  if (leave->get_kind() != EDGE_FALLTHROUGH) {
+    m_cfg->remove_edge(leave);
+    m_cfg->create_edge(bb, trip.out, EDGE_FALLTHROUGH);
+  }
+}
+
+// repeat the loop's body factor times, with the iterations left over
+// (if the trip count isn't a multiple of factor) peeled in front of it;
+// the tests left out of the loop would all pass
+void LoopUnrolling::unroll_by_factor(const TripCount &trip, unsigned factor) {
+  BasicBlock *bb = trip.block;
+  unsigned peeled = unsigned(trip.count % factor);
+  if (peeled > 0) {
+    assert(bb->has_label());
+    BasicBlock *peel = m_cfg->create_basic_block(BASICBLOCK_INTERIOR);
+    append_copies(peel, bb, bb->get_length() - 2, peeled);
+    redirect_entry(trip, peel);
+    peel->add_instruction(new Instruction(HINS_JUMP, Operand(bb->get_label())));
+    m_cfg->create_edge(peel, bb, EDGE_BRANCH);
+  }
+  repeat_body(bb, factor);
+}
+
+// run the loop's body factor times between tests while at least that
+// many iterations are left, and the original loop for the rest
+void LoopUnrolling::unroll_with_remainder(const TripCount &trip, unsigned factor) {
+  BasicBlock *loop = trip.block;
+
+  // the test of whether factor more iterations will run, i.e., whether
+  // the test would pass after the first factor - 1 of them
+  Operand check(OPERAND_VREG, m_next_vreg++);
+  Operand offset(OPERAND_INT_LITERAL, long(factor - 1) * trip.step);
+  auto append_check = [&](BasicBlock *bb, BasicBlock *target) {
+    bb->add_instruction(new Instruction(HINS_INT_ADD, check, Operand(OPERAND_VREG, trip.iv), offset));
+    Instruction *compare = trip.compare->duplicate();
+    for (unsigned i = 0; i < compare->get_num_operands(); i++) {
+      if (is_vreg((*compare)[i]) && (*compare)[i].get_base_reg() == trip.iv) {
+        (*compare)[i] = check;
+      }
+    }
+    bb->add_instruction(compare);
+    bb->add_instruction(new Instruction(trip.branch->get_opcode(), Operand(target->get_label())));
+  };
+
+  BasicBlock *guard = m_cfg->create_basic_block(BASICBLOCK_INTERIOR);
+  BasicBlock *unrolled = m_cfg->create_basic_block(BASICBLOCK_INTERIOR);
+  BasicBlock *remainder = m_cfg->create_basic_block(BASICBLOCK_INTERIOR);
+  unrolled->set_label(m_cfg->create_label(unrolled));
+
+  redirect_entry(trip, guard);
+  append_check(guard, unrolled);
+  m_cfg->create_edge(guard, unrolled, EDGE_BRANCH);
+  m_cfg->create_edge(guard, loop, EDGE_FALLTHROUGH);
+
+  append_copies(unrolled, loop, loop->get_length() - 2, factor);
+  append_check(unrolled, unrolled);
+  m_cfg->create_edge(unrolled, unrolled, EDGE_BRANCH);
+  m_cfg->create_edge(unrolled, remainder, EDGE_FALLTHROUGH);
+
+  // the original test, for whether any iterations are left
+  remainder->add_instruction(trip.compare->duplicate());
+  remainder->add_instruction(trip.branch->duplicate());
+  m_cfg->create_edge(remainder, loop, EDGE_BRANCH);
+  m_cfg->create_edge(remainder, trip.out, EDGE_FALLTHROUGH);
+}
+
+// make the edge entering the loop go to another block instead
+void LoopUnrolling::redirect_entry(const TripCount &trip, BasicBlock *target) {
+  Edge *e = m_cfg->lookup_edge(trip.preheader, trip.block);
+  EdgeKind kind = e->get_kind();
+  m_cfg->remove_edge(e);
+  if (kind == EDGE_BRANCH) {
+    if (!target->has_label()) {
+      target->set_label(m_cfg->create_label(target));
+    }
+    Instruction *branch = trip.preheader->get_last();
+    assert(branch->get_num_operands() == 1 && (*branch)[0].get_kind() == OPERAND_LABEL);
+    (*branch)[0] = Operand(target->get_label());
+  }
+  m_cfg->create_edge(trip.preheader, target, kind);
+}
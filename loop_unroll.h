@@ -0,0 +1,94 @@
+#ifndef LOOP_UNROLL_H
+#define LOOP_UNROLL_H
+
+#include "cfg.h"
+
+// Loop unrolling over a high-level ControlFlowGraph that isn't in SSA
+// form (after LoopRotation, so a counted loop's test is at its latch).
+//
+// Only innermost loops made of a single block are unrolled: the block
+// ends with "cmpi iv, bound; jcc header", iv is changed exactly once
+// in the block, by a literal step ("addi iv, iv, $step", or
+// "addi t, iv, $step; mov iv, t", the way the code generator emits
+// "i := i + 1"), and the bound is a literal or a vreg the loop doesn't
+// change.  The block runs at least once each time the loop is entered
+// (LoopRotation's guard, or a REPEAT loop), and then again while the
+// test passes.
+//
+// If iv's value entering the loop is a literal, and the bound is too,
+// the trip count is found by stepping iv until the test fails:
+//   - if every iteration fits in the budget, the loop is replaced by
+//     that many copies of its body
+//   - otherwise, the body is repeated UNROLL_FACTOR times in the loop,
+//     and the iterations left over are peeled into a block in front
+//     of it
+// Otherwise, if the test is <, <=, > or >= (with a step going the
+// right way), the trip count is only known at run time, and the loop
+// is unrolled with a copy of the original loop for the remainder:
+//
+//   check:  addi t, iv, $(UNROLL_FACTOR-1)*step
+//           cmpi t, bound; jcc unrolled      (else to the loop)
+//   unrolled:
+//           body * UNROLL_FACTOR
+//           addi t, iv, $(UNROLL_FACTOR-1)*step
+//           cmpi t, bound; jcc unrolled      (else to remainder)
+//   remainder:
+//           cmpi iv, bound; jcc loop         (else out of the loop)
+//   loop:   body; cmpi iv, bound; jcc loop
+//
+// The budget is the most instructions an unrolled loop body (and its
+// peeled iterations) may have, and fewer copies are made if needed.
+// New blocks are connected to blocks they don't fall through to, so
+// the result must be flattened with a BranchRewriter (see
+// ControlFlowGraph::create_instruction_sequence).
+class LoopUnrolling {
+private:
+  // what's known about a loop's trip count
+  struct TripCount {
+    BasicBlock *block;
+    BasicBlock *preheader;
+    BasicBlock *out;
+    // the compare and conditional branch at the end of the block
+    Instruction *compare;
+    Instruction *branch;
+    // the condition for staying in the loop, as "iv <op> bound"
+    int op;
+    int iv;
+    long step;
+    Operand bound;
+    // the number of times the block runs each time the loop is
+    // entered (0 if it isn't constant), and whether it can be worked
+    // out when the loop is entered
+    long count;
+    bool runtime_count;
+  };
+
+  ControlFlowGraph *m_cfg;
+  unsigned m_budget;
+  int m_next_vreg;
+  unsigned m_num_unrolled;
+  unsigned m_num_partially_unrolled;
+
+public:
+  LoopUnrolling(ControlFlowGraph *cfg, unsigned budget);
+  ~LoopUnrolling();
+
+  void execute();
+
+  // get the number of loops replaced by copies of their bodies
+  unsigned get_num_unrolled() const { return m_num_unrolled; }
+
+  // get the number of loops unrolled by a factor
+  unsigned get_num_partially_unrolled() const { return m_num_partially_unrolled; }
+
+private:
+  bool analyze(BasicBlock *header, TripCount &trip);
+  bool find_step(BasicBlock *bb, int iv, long &step);
+  long find_count(const TripCount &trip);
+  void unroll_fully(const TripCount &trip);
+  void unroll_by_factor(const TripCount &trip, unsigned factor);
+  void unroll_with_remainder(const TripCount &trip, unsigned factor);
+  void redirect_entry(const TripCount &trip, BasicBlock *target);
+};
+
+#endif // LOOP_UNROLL_H
@@ -0,0 +1,136 @@
+#include <cassert>
+#include <algorithm>
+#include "cfg.h"
+#include "dominators.h"
+#include "loops.h"
+
+Loop::Loop(BasicBlock *header)
+  : header(header)
+  , parent(nullptr)
+  , depth(0) {
+}
+
+LoopForest::LoopForest(ControlFlowGraph *cfg, DominatorTree *dom)
+  : m_cfg(cfg)
+  , m_dom(dom)
+  , m_block_loop(cfg->get_num_blocks(), nullptr) {
+}
+
+LoopForest::~LoopForest() {
+  for (auto i = m_loops.begin(); i != m_loops.end(); i++) {
+    delete *i;
+  }
+}
+
+void LoopForest::execute() {
+  // A loop header dominates the headers of the loops nested inside
+  // it, and so comes before them in reverse postorder: visiting the
+  // blocks in postorder finds inner loops first.
+  const std::vector<BasicBlock *> &rpo = m_dom->get_rpo();
+  std::vector<Loop *> found;
+  for (auto i = rpo.rbegin(); i != rpo.rend(); i++) {
+    find_loop(*i, found);
+  }
+
+  // order the loops (and their children) by the reverse postorder
+  // of their headers, outer loops first, and compute depths
+  std::vector<Loop *> stack;
+  for (auto i = found.rbegin(); i != found.rend(); i++) {
+    Loop *loop = *i;
+    std::reverse(loop->children.begin(), loop->children.end());
+    if (loop->parent == nullptr) {
+      m_top_level_loops.push_back(loop);
+    }
+  }
+  for (auto i = m_top_level_loops.rbegin(); i != m_top_level_loops.rend(); i++) {
+    stack.push_back(*i);
+  }
+  while (!stack.empty()) {
+    Loop *loop = stack.back();
+    stack.pop_back();
+    loop->depth = (loop->parent != nullptr) ? loop->parent->depth + 1 : 1;
+    m_loops.push_back(loop);
+    for (auto i = loop->children.rbegin(); i != loop->children.rend(); i++) {
+      stack.push_back(*i);
+    }
+  }
+
+  // every block belongs to its innermost loop and all of the loops
+  // enclosing it
+  for (auto i = rpo.begin(); i != rpo.end(); i++) {
+    for (Loop *loop = m_block_loop[(*i)->get_id()]; loop != nullptr; loop = loop->parent) {
+      loop->blocks.push_back(*i);
+    }
+  }
+}
+
+unsigned LoopForest::get_depth(BasicBlock *bb) const {
+  Loop *loop = m_block_loop[bb->get_id()];
+  return (loop != nullptr) ? loop->depth : 0;
+}
+
+bool LoopForest::is_loop_header(BasicBlock *bb) const {
+  Loop *loop = m_block_loop[bb->get_id()];
+  return loop != nullptr && loop->header == bb;
+}
+
+bool LoopForest::contains(const Loop *loop, BasicBlock *bb) const {
+  for (Loop *l = m_block_loop[bb->get_id()]; l != nullptr; l = l->parent) {
+    if (l == loop) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void LoopForest::find_loop(BasicBlock *header, std::vector<Loop *> &found) {
+  std::vector<BasicBlock *> work;
+  const ControlFlowGraph::EdgeList &header_incoming = m_cfg->get_incoming_edges(header);
+  for (auto i = header_incoming.cbegin(); i != header_incoming.cend(); i++) {
+    BasicBlock *pred = (*i)->get_source();
+    if (m_dom->dominates(header, pred)) {
+      work.push_back(pred);
+    }
+  }
+  if (work.empty()) {
+    return;
+  }
+
+  Loop *loop = new Loop(header);
+  loop->latches = work;
+  m_block_loop[header->get_id()] = loop;
+  found.push_back(loop);
+
+  // search backwards from the latches to the header
+  while (!work.empty()) {
+    BasicBlock *bb = work.back();
+    work.pop_back();
+
+    Loop *inner = m_block_loop[bb->get_id()];
+    if (inner == nullptr) {
+      // a block not in any loop found so far
+      m_block_loop[bb->get_id()] = loop;
+    } else {
+      // a block of an inner loop (or of this loop): continue the
+      // search from the header of the outermost loop found so far
+      // that contains it
+      while (inner->parent != nullptr) {
+        inner = inner->parent;
+      }
+      if (inner == loop) {
+        continue;
+      }
+      inner->parent = loop;
+      loop->children.push_back(inner);
+      bb = inner->header;
+    }
+
+    const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(bb);
+    for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+      BasicBlock *pred = (*i)->get_source();
+      if (m_dom->is_reachable(pred)) {
+        work.push_back(pred);
+      }
+    }
+  }
+}
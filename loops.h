@@ -0,0 +1,80 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <vector>
+#include "cfg.h"
+#include "dominators.h"
+
+// A natural loop: a header block, which dominates every block of the
+// loop, and the blocks that can reach a back edge (an edge into the
+// header from a block the header dominates) without going through the
+// header.  All back edges into the same header form one loop.
+struct Loop {
+  BasicBlock *header;
+  // enclosing loop (null for an outermost loop)
+  Loop *parent;
+  // loops nested immediately inside this one
+  std::vector<Loop *> children;
+  // every block of the loop, including the blocks of nested loops, in
+  // reverse postorder (so the header is first)
+  std::vector<BasicBlock *> blocks;
+  // sources of the back edges
+  std::vector<BasicBlock *> latches;
+  // nesting depth (1 for an outermost loop)
+  unsigned depth;
+
+  Loop(BasicBlock *header);
+};
+
+// The forest of natural loops of a ControlFlowGraph, and for each block
+// the innermost loop containing it.  Loops are found by walking the
+// dominator tree bottom-up (so inner loops are found before the loops
+// enclosing them) and searching backwards from each header's back
+// edges; blocks already claimed by an inner loop are skipped over by
+// jumping to that loop's header, so the whole forest is built in time
+// roughly linear in the size of the CFG.
+//
+// A cycle whose entry doesn't dominate the rest of it (an irreducible
+// loop) has no back edge, and isn't a natural loop.
+//
+// Don't create one directly: use ControlFlowGraph::get_loop_forest(),
+// which caches the result until the CFG changes.
+class LoopForest {
+private:
+  ControlFlowGraph *m_cfg;
+  DominatorTree *m_dom;
+  // all loops, outer loops before the loops nested in them
+  std::vector<Loop *> m_loops;
+  std::vector<Loop *> m_top_level_loops;
+  // innermost loop containing each block (indexed by block id)
+  std::vector<Loop *> m_block_loop;
+
+public:
+  LoopForest(ControlFlowGraph *cfg, DominatorTree *dom);
+  ~LoopForest();
+
+  void execute();
+
+  // get all loops, each loop before the loops nested inside it
+  const std::vector<Loop *> &get_loops() const { return m_loops; }
+
+  // get the loops that aren't nested inside another loop
+  const std::vector<Loop *> &get_top_level_loops() const { return m_top_level_loops; }
+
+  // get the innermost loop containing a block (null if none)
+  Loop *get_loop(BasicBlock *bb) const { return m_block_loop[bb->get_id()]; }
+
+  // get the number of loops a block is nested in (0 if none)
+  unsigned get_depth(BasicBlock *bb) const;
+
+  // is the block the header of a loop?
+  bool is_loop_header(BasicBlock *bb) const;
+
+  // is the block part of the loop (or of a loop nested in it)?
+  bool contains(const Loop *loop, BasicBlock *bb) const;
+
+private:
+  void find_loop(BasicBlock *header, std::vector<Loop *> &found);
+};
+
+#endif // LOOPS_H
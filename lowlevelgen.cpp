@@ -3,18 +3,108 @@
 #include "highlevel.h"
 #include "x86_64.h"
 #include "codegen.h"
+#include "isel.h"
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <iostream>
 #include <iterator>
 #include <map>
 #include <ostream>
+#include <set>
 #include <string>
+#include <vector>
+
+
+//////////////////////////////////////////////////////////
+// helpers for arithmetic by a constant
+
+// is the operand a literal usable as a 32-bit immediate?
+static bool is_imm32_literal(const Operand &operand){
+  return operand.get_kind() == OPERAND_INT_LITERAL &&
+         operand.get_int_value() >= INT_MIN && operand.get_int_value() <= INT_MAX;
+}
+
+// get k if |value| == 2^k, otherwise -1
+static int exact_log2(long value){
+  unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+  if (magnitude == 0 || (magnitude & (magnitude - 1)) != 0) {
+    return -1;
+  }
+  int k = 0;
+  while (magnitude > 1) {
+    magnitude >>= 1;
+    k++;
+  }
+  return k;
+}
+
+// compute the magic multiplier and shift for signed division by d
+// (|d| >= 2, not a power of 2): x / d is the high 64 bits of
+// magic * x, corrected and shifted right (Granlund & Montgomery; see
+// Hacker's Delight, section 10-4)
+static void compute_signed_magic(long d, long *magic, int *shift){
+  const unsigned long two63 = 1UL << 63;
+  unsigned long ad = d < 0 ? -(unsigned long)d : (unsigned long)d;
+  unsigned long t = two63 + ((unsigned long)d >> 63);
+  unsigned long anc = t - 1 - t % ad;
+  unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+  unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+  unsigned long delta;
+  int p = 63;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  *magic = (long)(q2 + 1);
+  if (d < 0) {
+    *magic = -*magic;
+  }
+  *shift = p - 64;
+}
+
+
+// the condition of a branch after swapping the compare's operands
+static int mirror_condition(int opcode){
+  switch (opcode) {
+  case MINS_JL: return MINS_JG;
+  case MINS_JLE: return MINS_JGE;
+  case MINS_JG: return MINS_JL;
+  case MINS_JGE: return MINS_JLE;
+  default: return opcode;
+  }
+}
 
 
 //////////////////////////////////////////////////////////
 // main class to translate high-level code to x86_64 code
 class InstructionVisitor{
   private:
+    // an expression tree (see build_trees): its root node, whether
+    // other instructions were folded into it, the index of its first
+    // instruction and of its first load (or -1), and the locations its
+    // leaves read, with the index of the instruction reading each
+    struct ExprTree {
+      SelectionNode *node;
+      bool combined;
+      unsigned first;
+      int first_load;
+      std::vector<std::pair<Operand, unsigned>> leaves;
+    };
+
     struct InstructionSequence *high_level;
     struct InstructionSequence *low_level = new InstructionSequence();
     // record num of var and vreg used
@@ -26,6 +116,13 @@ class InstructionVisitor{
     int rsp_offset;
     char flag = 'n';
 
+    // index of the high-level instruction being translated, and of a
+    // jump made redundant by inverting the branch before it
+    unsigned current_index = 0;
+    int skip_index = -1;
+    // did the last compare swap its operands?
+    bool cmp_swapped = false;
+
   public:
     InstructionVisitor(InstructionSequence *iseq, int var_offset, int vreg_count, int mreg_count);
     ~InstructionVisitor() = default;
@@ -40,6 +137,7 @@ class InstructionVisitor{
     void translate_loadcosntint(Instruction *ins);
     
     void translate_cmp(Instruction *ins);
+    void translate_branch(Instruction *ins, int opcode);
 
     void translate_jump(Instruction *ins);
     void translate_jlte(Instruction *ins);
@@ -59,6 +157,25 @@ class InstructionVisitor{
     void translate_call(Instruction *ins);
     void translate_return(Instruction *ins);
     void translate_pass(Instruction *ins);
+    void translate_spill(Instruction *ins);
+    void translate_reload(Instruction *ins);
+
+    // translate add/sub/mul when vregs may be allocated to mregs
+    void translate_arith_optim(Instruction *ins, int opcode, bool commutative);
+
+    // translate mul/div/mod by a literal without imulq/idivq where possible
+    void translate_mul_const(Instruction *ins, int src_idx, long factor);
+    void translate_divmod_const(Instruction *ins, long divisor, bool mod);
+    void translate_sub_from(Operand minuend, int minuend_flg, Operand subtrahend, Operand target, int target_flg);
+
+    // build the expression trees of each basic block for X86_64InstructionSelector
+    void build_trees();
+    SelectionNode *tree_leaf(const Operand &operand);
+    bool can_move_tree(const ExprTree &tree, unsigned def_idx, unsigned use_idx);
+    SelectionNode *make_root(Instruction *ins, SelectionNode *node);
+    void release_root(SelectionNode *root, SelectionNode *node);
+    bool is_only_use(unsigned def_idx, unsigned use_idx, int vreg, std::map<int, unsigned> &num_uses);
+    int find_local_def(unsigned index, int vreg);
 
     void move_first(Instruction *ins, int operand_idx, struct Operand *reg_0, int *reg_0_constant = nullptr);
     void move_second(Instruction *ins, int operand_idx, struct Operand *reg_1, int reg_0_constant = 0);
@@ -94,11 +211,16 @@ class InstructionVisitor{
                                                      {HINS_CALL, &InstructionVisitor::translate_call},
                                                      {HINS_RET, &InstructionVisitor::translate_return},
                                                      {HINS_PASS, &InstructionVisitor::translate_pass},
+                                                     {HINS_SPILL, &InstructionVisitor::translate_spill},
+                                                     {HINS_RELOAD, &InstructionVisitor::translate_reload},
                                                      };
     
     // get the real memory reference of a vreg
     struct Operand vreg_ref(Operand vreg, int bias=0, int *flg=nullptr, int force=0);
 
+    // get the stack slot of a vreg
+    struct Operand vreg_slot(Operand vreg, int bias=0);
+
     struct Operand rsp = Operand(OPERAND_MREG, MREG_RSP);
     struct Operand rdi = Operand(OPERAND_MREG, MREG_RDI);
     struct Operand rsi = Operand(OPERAND_MREG, MREG_RSI);
@@ -136,6 +258,12 @@ class InstructionVisitor{
     struct Operand one_byte = Operand(OPERAND_INT_LITERAL, 8);
 
     Instruction *cqto = new Instruction(MINS_CQTO);
+
+    // expression trees by the index of their root instruction, and the
+    // (skipped) instructions folded into them
+    std::map<unsigned, ExprTree> expr_trees;
+    std::set<Instruction *> folded_defs;
+    X86_64InstructionSelector selector = X86_64InstructionSelector(low_level);
 };
 
 
@@ -194,6 +322,10 @@ void InstructionVisitor::translate(){
 
   Instruction *pushq = new Instruction(MINS_SUBQ, stack_size, rsp);
   low_level->add_instruction(pushq);
+
+  if (flag == 'o'){
+    build_trees();
+  }
   
   // iterate high-level instructions
   for(; it != high_level->end(); ++it){
@@ -209,6 +341,30 @@ void InstructionVisitor::translate(){
       low_level->add_instruction(ins);
     }
 
+    // computed as part of a later instruction's tree, or replaced by
+    // an inverted branch
+    current_index = unsigned(it - high_level->begin());
+    if (folded_defs.count(*it) || int(current_index) == skip_index) {
+      continue;
+    }
+
+    // select code for a tree as a whole; an instruction with nothing
+    // folded into it is translated on its own
+    auto tree = expr_trees.find(current_index);
+    if (tree != expr_trees.end()) {
+      SelectionNode *node = tree->second.node;
+      bool combined = tree->second.combined;
+      expr_trees.erase(tree);
+      if (combined) {
+        SelectionNode *root = make_root(*it, node);
+        selector.select(root);
+        cmp_swapped = false;
+        delete root;
+        continue;
+      }
+      delete node;
+    }
+
     // run correspoding translation function
     iter = translate_high_to_low.find(op_code);
     if(iter != translate_high_to_low.end()){
@@ -283,10 +439,10 @@ void InstructionVisitor::translate_readint(Instruction *ins){
   Instruction *move = new Instruction(MINS_MOVQ, inputfmt, rdi);
   Instruction *load;
   Operand target;
+  int mreg_alloc = 0;
 
   if (flag == 'o'){
     // std::cout << 'o' << std::endl;
-    int mreg_alloc = 0;
     target = vreg_ref(ins->get_operand(0), 8 * stack_push, &mreg_alloc);
 
     load = new Instruction(MINS_MOVQ, readbuf_imm, rsi);
@@ -301,8 +457,16 @@ void InstructionVisitor::translate_readint(Instruction *ins){
   low_level->add_instruction(call);
 
   if (flag == 'o'){
-    Instruction *move_final = new Instruction(MINS_MOVQ, readbuf, target);
-    low_level->add_instruction(move_final);
+    if (mreg_alloc) {
+      Instruction *move_final = new Instruction(MINS_MOVQ, readbuf, target);
+      low_level->add_instruction(move_final);
+    } else {
+      // can't move memory to memory
+      Instruction *move_int = new Instruction(MINS_MOVQ, readbuf, r10);
+      Instruction *move_final = new Instruction(MINS_MOVQ, r10, target);
+      low_level->add_instruction(move_int);
+      low_level->add_instruction(move_final);
+    }
   }
   
   // pop rsp by 8 in case rep offset is not a multiple of 16
@@ -402,8 +566,11 @@ void InstructionVisitor::translate_mov(Instruction *ins){
       reg = vreg_ref(ins->get_operand(1), 0, &mreg_alloc);
       targe_reg = vreg_ref(ins->get_operand(0), 0, &mreg_alloc_target);
       if (mreg_alloc) {
-        move_finl = new Instruction(MINS_MOVQ, reg, targe_reg);
-        low_level->add_instruction(move_finl);
+        // a coalesced copy needs no code
+        if (!mreg_alloc_target || reg.get_base_reg() != targe_reg.get_base_reg()) {
+          move_finl = new Instruction(MINS_MOVQ, reg, targe_reg);
+          low_level->add_instruction(move_finl);
+        }
       } else {
         if (ins->get_operand(1).get_kind() == OPERAND_INT_LITERAL) {
           move_finl = new Instruction(MINS_MOVQ, reg, targe_reg); 
@@ -423,6 +590,217 @@ void InstructionVisitor::translate_mov(Instruction *ins){
 
 }
 
+// instruction selection over expression trees: within straight-line
+// code, an add, subtract, multiply, load, or local address whose value
+// has a single use by another of these (or by a store or compare) is
+// folded into that instruction's tree instead of being computed on
+// its own.  The result is a forest covering the DAG of each basic
+// block, whose roots are the values with several uses (or none), and
+// each tree made this way is covered by X86_64InstructionSelector.
+// Folding moves a computation down to its root, so it is only done if
+// nothing in between changes the leaves it reads (or, for a load, the
+// memory), and if the tree still fits in the scratch registers.
+void InstructionVisitor::build_trees(){
+  std::map<int, unsigned> num_uses;
+  for (auto i = high_level->begin(); i != high_level->end(); i++) {
+    Instruction *ins = *i;
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (is_use(ins, int(k))) {
+        Operand operand = ins->get_operand(k);
+        num_uses[operand.get_base_reg()]++;
+        if (operand.has_index_reg()) {
+          num_uses[operand.get_index_reg()]++;
+        }
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < high_level->get_length(); i++) {
+    Instruction *ins = high_level->get_instruction(i);
+    SelectionOp op;
+    std::vector<unsigned> srcs;
+    switch (ins->get_opcode()) {
+    case HINS_LOCALADDR:
+      expr_trees[i] = { new SelectionNode(SEL_FRAME, Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, ins->get_operand(1).get_int_value())),
+                        false, i, -1, {} };
+      continue;
+    case HINS_INT_ADD: op = SEL_ADD; srcs = { 1, 2 }; break;
+    case HINS_INT_SUB: op = SEL_SUB; srcs = { 1, 2 }; break;
+    case HINS_INT_MUL: op = SEL_MUL; srcs = { 1, 2 }; break;
+    case HINS_LOAD_INT: op = SEL_LOAD; srcs = { 1 }; break;
+    case HINS_STORE_INT: op = SEL_STORE; srcs = { 0, 1 }; break;
+    case HINS_INT_COMPARE: op = SEL_CMP; srcs = { 0, 1 }; break;
+    default: continue;
+    }
+    bool simple_operands = true;
+    for (auto k = srcs.begin(); k != srcs.end(); k++) {
+      OperandKind kind = ins->get_operand(*k).get_kind();
+      simple_operands &= (kind == OPERAND_VREG || kind == OPERAND_VREG_MEMREF || kind == OPERAND_INT_LITERAL);
+    }
+    if (!simple_operands) {
+      continue;
+    }
+
+    // start with leaves, then try folding in the def of each operand
+    ExprTree tree = { nullptr, false, i, (op == SEL_LOAD) ? int(i) : -1, {} };
+    SelectionNode *kids[2] = { nullptr, nullptr };
+    for (unsigned k = 0; k < srcs.size(); k++) {
+      kids[k] = tree_leaf(ins->get_operand(srcs[k]));
+    }
+    tree.node = new SelectionNode(op, Operand(), kids[0], kids[1]);
+
+    for (unsigned k = 0; k < srcs.size(); k++) {
+      Operand operand = ins->get_operand(srcs[k]);
+      int def_idx = (operand.get_kind() == OPERAND_INT_LITERAL) ? -1 : find_local_def(i, operand.get_base_reg());
+      if (def_idx < 0 || !expr_trees.count(unsigned(def_idx)) ||
+          !is_only_use(unsigned(def_idx), i, operand.get_base_reg(), num_uses) ||
+          !can_move_tree(expr_trees[unsigned(def_idx)], unsigned(def_idx), i)) {
+        continue;
+      }
+      ExprTree &def = expr_trees[unsigned(def_idx)];
+      SelectionNode *leaf = tree.node->kids[k];
+      tree.node->kids[k] = def.node;
+      SelectionNode *root = make_root(ins, tree.node);
+      bool fits = selector.fits(root);
+      release_root(root, tree.node);
+      if (!fits) {
+        tree.node->kids[k] = leaf;
+        continue;
+      }
+      delete leaf;
+
+      tree.combined = true;
+      tree.first = std::min(tree.first, def.first);
+      if (def.first_load >= 0 && (tree.first_load < 0 || def.first_load < tree.first_load)) {
+        tree.first_load = def.first_load;
+      }
+      tree.leaves.insert(tree.leaves.end(), def.leaves.begin(), def.leaves.end());
+      folded_defs.insert(high_level->get_instruction(unsigned(def_idx)));
+      expr_trees.erase(unsigned(def_idx));
+    }
+
+    // the leaves read here
+    for (unsigned k = 0; k < srcs.size(); k++) {
+      SelectionOp leaf_op = tree.node->kids[k]->op;
+      if (leaf_op == SEL_REG || leaf_op == SEL_MEM) {
+        tree.leaves.push_back({ tree.node->kids[k]->operand, i });
+      }
+    }
+    expr_trees[i] = tree;
+  }
+}
+
+// a leaf for an operand: the mreg or stack slot of a vreg (or of the
+// address in a memory reference), or a literal
+SelectionNode *InstructionVisitor::tree_leaf(const Operand &operand){
+  if (operand.get_kind() == OPERAND_INT_LITERAL) {
+    return new SelectionNode(SEL_CNST, operand);
+  }
+  int mreg_alloc = 0;
+  Operand location = vreg_ref(operand, 0, &mreg_alloc);
+  return new SelectionNode(mreg_alloc ? SEL_REG : SEL_MEM, location);
+}
+
+// can the tree of the instruction at def_idx be evaluated at the
+// instruction at use_idx instead?  (None of its leaves may be assigned
+// in between, and if it loads from memory, nothing in between may
+// store.)
+bool InstructionVisitor::can_move_tree(const ExprTree &tree, unsigned def_idx, unsigned use_idx){
+  for (unsigned j = tree.first + 1; j < use_idx; j++) {
+    Instruction *ins = high_level->get_instruction(j);
+    if (j == def_idx || folded_defs.count(ins)) {
+      continue;
+    }
+    if (tree.first_load >= 0 && int(j) > tree.first_load &&
+        (ins->get_opcode() == HINS_STORE_INT || is_call(ins))) {
+      return false;
+    }
+    if (!is_def(ins)) {
+      continue;
+    }
+    int mreg_alloc = 0;
+    Operand dest = vreg_ref(ins->get_operand(0), 0, &mreg_alloc);
+    for (auto k = tree.leaves.begin(); k != tree.leaves.end(); k++) {
+      if (j > k->second && dest.get_kind() == k->first.get_kind() && dest.get_base_reg() == k->first.get_base_reg() &&
+          (mreg_alloc || dest.get_offset() == k->first.get_offset())) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// the root of the tree for an instruction: a move to the destination
+// of an instruction computing a value, otherwise the tree itself
+SelectionNode *InstructionVisitor::make_root(Instruction *ins, SelectionNode *node){
+  if (node->op == SEL_STORE || node->op == SEL_CMP) {
+    return node;
+  }
+  int mreg_alloc = 0;
+  return new SelectionNode(SEL_MOVE, vreg_ref(ins->get_operand(0), 0, &mreg_alloc), node);
+}
+
+// free a root made by make_root, but not the tree under it
+void InstructionVisitor::release_root(SelectionNode *root, SelectionNode *node){
+  if (root != node) {
+    root->kids[0] = nullptr;
+    delete root;
+  }
+}
+
+// is the instruction at use_idx the only one reading the value that
+// the instruction at def_idx assigns to the vreg?  (Temporaries are
+// reused, so this looks for the next def of the vreg in the same
+// straight-line code; failing that, the vreg must have no other uses.)
+bool InstructionVisitor::is_only_use(unsigned def_idx, unsigned use_idx, int vreg, std::map<int, unsigned> &num_uses){
+  for (unsigned j = def_idx + 1; j < high_level->get_length(); j++) {
+    Instruction *ins = high_level->get_instruction(j);
+    if (j > use_idx && high_level->has_label(j)) {
+      break;
+    }
+    unsigned uses = 0;
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (is_use(ins, int(k))) {
+        Operand operand = ins->get_operand(k);
+        uses += (operand.get_base_reg() == vreg);
+        uses += (operand.has_index_reg() && operand.get_index_reg() == vreg);
+      }
+    }
+    if (uses != (j == use_idx ? 1U : 0U)) {
+      return false;
+    }
+    if (j > use_idx && is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+      return true;
+    }
+    if (j >= use_idx && is_branch(ins)) {
+      break;
+    }
+  }
+  return num_uses[vreg] == 1;
+}
+
+// find the def of a vreg reaching the instruction at index from the
+// same straight-line code (-1 if there is none, or it isn't certain)
+int InstructionVisitor::find_local_def(unsigned index, int vreg){
+  if (high_level->has_label(index)) {
+    return -1;
+  }
+  for (unsigned j = index; j > 0; j--) {
+    Instruction *ins = high_level->get_instruction(j - 1);
+    if (is_branch(ins) || is_call(ins) ||
+        ins->get_opcode() == HINS_SPILL || ins->get_opcode() == HINS_RELOAD) {
+      return -1;
+    }
+    if (is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+      return int(j - 1);
+    }
+    if (high_level->has_label(j - 1)) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
 // translate the loadint instruction
 void InstructionVisitor::translate_loadint(Instruction *ins){
   Instruction *move_var, *load_int, *store_int;
@@ -468,6 +846,13 @@ void InstructionVisitor::translate_div(Instruction *ins){
   Instruction *move_dividend;
   Instruction *move_divisor, *div, *move_result;
 
+  // division by a literal doesn't need idivq
+  if (flag == 'o' && is_imm32_literal(ins->get_operand(2)) && ins->get_operand(2).get_int_value() != 0 &&
+      ins->get_operand(1).get_kind() != OPERAND_INT_LITERAL) {
+    translate_divmod_const(ins, ins->get_operand(2).get_int_value(), false);
+    return;
+  }
+
   // resolve memory reference
   if (flag == 'o') {
     Operand op1, op2, target;
@@ -510,6 +895,13 @@ void InstructionVisitor::translate_mod(Instruction *ins){
   Instruction *move_dividend;
   Instruction *move_divisor, *div, *move_result;
 
+  // division by a literal doesn't need idivq
+  if (flag == 'o' && is_imm32_literal(ins->get_operand(2)) && ins->get_operand(2).get_int_value() != 0 &&
+      ins->get_operand(1).get_kind() != OPERAND_INT_LITERAL) {
+    translate_divmod_const(ins, ins->get_operand(2).get_int_value(), true);
+    return;
+  }
+
   if (flag == 'o') {
     Operand op1, op2, target;
     int op1_flg, op2_flg, target_flg;
@@ -554,37 +946,7 @@ void InstructionVisitor::translate_add(Instruction *ins){
   Instruction *add, *move_result;
 
   if (flag == 'o') {
-    int target_flg = 0;
-    Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
-    
-    int op_0_flg = 0;
-    int op_1_flg = 0;
-    reg_0 = vreg_ref(ins->get_operand(1), 0, &op_0_flg);
-    reg_1 = vreg_ref(ins->get_operand(2), 0, &op_1_flg);
-
-    if(ins->get_operand(1).is_memref()) {
-      reg_0 = reg_0.to_memref();
-    }
-    if(ins->get_operand(2).is_memref()) {
-      reg_1 = reg_1.to_memref();
-    }
-
-    if (target_flg) {
-      Instruction *move = new Instruction(MINS_MOVQ, reg_1, target);
-      low_level->add_instruction(move);
-      add = new Instruction(MINS_ADDQ, reg_0, target);
-      low_level->add_instruction(add);
-    } else {
-      if (reg_0.has_base_reg()){
-        add = new Instruction(MINS_ADDQ, reg_1, reg_0);
-        move_result = new Instruction(MINS_MOVQ, reg_0, target);
-      } else {
-        add = new Instruction(MINS_ADDQ, reg_0, reg_1);
-        move_result = new Instruction(MINS_MOVQ, reg_1, target);
-      }
-      low_level->add_instruction(add);
-      low_level->add_instruction(move_result);
-    }
+    translate_arith_optim(ins, MINS_ADDQ, true);
   } else {
       int reg_0_constant = 0;
   // resolve memory reference
@@ -619,34 +981,7 @@ void InstructionVisitor::translate_sub(Instruction *ins){
   Instruction *move_result;
 
   if (flag == 'o'){
-    int target_flg = 0;
-    Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
-    
-    int op_0_flg = 0;
-    int op_1_flg = 0;
-    reg_0 = vreg_ref(ins->get_operand(1), 0, &op_0_flg);
-    reg_1 = vreg_ref(ins->get_operand(2), 0, &op_1_flg);
-
-    if(ins->get_operand(1).is_memref()) {
-      reg_0 = reg_0.to_memref();
-    }
-    if(ins->get_operand(2).is_memref()) {
-      reg_1 = reg_1.to_memref();
-    }
-
-    if (target_flg) {
-      Instruction *move = new Instruction(MINS_MOVQ, reg_0, target);
-      low_level->add_instruction(move);
-      add = new Instruction(MINS_SUBQ, reg_1, target);
-      low_level->add_instruction(add);
-    } else {
-      add = new Instruction(MINS_SUBQ, reg_1, reg_0);
-      move_result = new Instruction(MINS_MOVQ, reg_0, target);
-
-      low_level->add_instruction(add);
-      low_level->add_instruction(move_result);
-    }
-  
+    translate_arith_optim(ins, MINS_SUBQ, false);
   } else {
     // resolve memory reference
     move_first(ins, 2, &reg_1);
@@ -678,36 +1013,14 @@ void InstructionVisitor::translate_mul(Instruction *ins){
   Instruction *move_result;
 
   if (flag == 'o') {
-    int target_flg = 0;
-    Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
-    
-    int op_0_flg = 0;
-    int op_1_flg = 0;
-    reg_0 = vreg_ref(ins->get_operand(1), 0, &op_0_flg);
-    reg_1 = vreg_ref(ins->get_operand(2), 0, &op_1_flg);
-
-    if(ins->get_operand(1).is_memref()) {
-      reg_0 = reg_0.to_memref();
-    }
-    if(ins->get_operand(2).is_memref()) {
-      reg_1 = reg_1.to_memref();
-    }
-
-    if (target_flg) {
-      Instruction *move = new Instruction(MINS_MOVQ, reg_1, target);
-      low_level->add_instruction(move);
-      add = new Instruction(MINS_IMULQ, reg_0, target);
-      low_level->add_instruction(add);
+    bool literal_1 = ins->get_operand(1).get_kind() == OPERAND_INT_LITERAL;
+    bool literal_2 = ins->get_operand(2).get_kind() == OPERAND_INT_LITERAL;
+    if (literal_2 && !literal_1 && is_imm32_literal(ins->get_operand(2))) {
+      translate_mul_const(ins, 1, ins->get_operand(2).get_int_value());
+    } else if (literal_1 && !literal_2 && is_imm32_literal(ins->get_operand(1))) {
+      translate_mul_const(ins, 2, ins->get_operand(1).get_int_value());
     } else {
-      if (reg_0.has_base_reg()){
-        add = new Instruction(MINS_IMULQ, reg_1, reg_0);
-        move_result = new Instruction(MINS_MOVQ, reg_0, target);
-      } else {
-        add = new Instruction(MINS_IMULQ, reg_0, reg_1);
-        move_result = new Instruction(MINS_MOVQ, reg_1, target);
-      }
-      low_level->add_instruction(add);
-      low_level->add_instruction(move_result);
+      translate_arith_optim(ins, MINS_IMULQ, true);
     }
   } else {
     int reg_0_constant = 0;
@@ -737,36 +1050,202 @@ void InstructionVisitor::translate_mul(Instruction *ins){
 
 }
 
-// translate the cmp instruction
-void InstructionVisitor::translate_cmp(Instruction *ins){
-  Operand reg_0;
-  Operand reg_1;
-  if (flag == 'o') {
-    int op_0_flg = 0;
-    int op_1_flg = 0;
-    reg_0 = vreg_ref(ins->get_operand(0), 0, &op_0_flg);
-    reg_1 = vreg_ref(ins->get_operand(1), 0, &op_1_flg);
+// translate a two-source arithmetic instruction (target = src1 op src2)
+// when operands may live in mregs.  x86 arithmetic is two-address, so
+// the result is computed in place in the target register; this is only
+// possible if the target is a register and isn't the same register as
+// src2 (unless the operation is commutative).
+void InstructionVisitor::translate_arith_optim(Instruction *ins, int opcode, bool commutative){
+  int target_flg = 0, src1_flg = 0, src2_flg = 0;
+  Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
+  Operand src1 = vreg_ref(ins->get_operand(1), 0, &src1_flg);
+  Operand src2 = vreg_ref(ins->get_operand(2), 0, &src2_flg);
+
+  bool target_is_src1 = target_flg && src1_flg && target.get_base_reg() == src1.get_base_reg();
+  bool target_is_src2 = target_flg && src2_flg && target.get_base_reg() == src2.get_base_reg();
+
+  if (target_flg && (!target_is_src2 || target_is_src1)) {
+    if (!target_is_src1) {
+      low_level->add_instruction(new Instruction(MINS_MOVQ, src1, target));
+    }
+    low_level->add_instruction(new Instruction(opcode, src2, target));
+  } else if (target_flg && commutative) {
+    low_level->add_instruction(new Instruction(opcode, src1, target));
+  } else {
+    // compute the result in r10
+    low_level->add_instruction(new Instruction(MINS_MOVQ, src1, r10));
+    low_level->add_instruction(new Instruction(opcode, src2, r10));
+    low_level->add_instruction(new Instruction(MINS_MOVQ, r10, target));
+  }
+}
 
-    if (op_0_flg == 0){
-      Instruction *move = new Instruction(MINS_MOVQ, reg_0, r10);
-      low_level->add_instruction(move);
-      reg_0 = r10;
+// translate target = src * factor (the other operand) when the factor
+// fits in an immediate: a power of 2 is a shift, 3/5/9 are a leaq with
+// a scaled index, and anything else is a three-operand imulq, which
+// (unlike the two-operand form) needn't copy the source first
+void InstructionVisitor::translate_mul_const(Instruction *ins, int src_idx, long factor){
+  int target_flg = 0, src_flg = 0;
+  Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
+  Operand src = vreg_ref(ins->get_operand(src_idx), 0, &src_flg);
+
+  // compute the result in the target register, or in r10
+  Operand dest = target_flg ? target : r10;
+  bool dest_is_src = target_flg && src_flg && target.get_base_reg() == src.get_base_reg();
+  int k = factor > 0 ? exact_log2(factor) : -1;
+
+  if (factor == 0) {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, 0), target));
+    return;
+  } else if (k == 1 && src_flg && !dest_is_src) {
+    // src + src, without copying src first
+    low_level->add_instruction(new Instruction(MINS_LEAQ,
+                                               Operand(OPERAND_MREG_MEMREF_INDEX, src.get_base_reg(), src.get_base_reg()),
+                                               dest));
+  } else if ((factor == 3 || factor == 5 || factor == 9) && src_flg) {
+    // src + src*2/4/8
+    Operand scaled(OPERAND_MREG_MEMREF_INDEX, src.get_base_reg(), src.get_base_reg());
+    scaled.set_scale(int(factor - 1));
+    low_level->add_instruction(new Instruction(MINS_LEAQ, scaled, dest));
+  } else if (k >= 0) {
+    if (!dest_is_src) {
+      low_level->add_instruction(new Instruction(MINS_MOVQ, src, dest));
+    }
+    if (k > 0) {
+      low_level->add_instruction(new Instruction(MINS_SHLQ, Operand(OPERAND_INT_LITERAL, k), dest));
     }
+  } else {
+    low_level->add_instruction(new Instruction(MINS_IMULQ, Operand(OPERAND_INT_LITERAL, factor), src, dest));
+  }
 
-    if (op_1_flg == 0){
-      Instruction *move = new Instruction(MINS_MOVQ, reg_1, r11);
-      low_level->add_instruction(move);
-      reg_1 = r11;
+  if (!target_flg) {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, r10, target));
+  }
+}
+
+// translate target = x / divisor or x % divisor (truncating, as idivq
+// does) for a nonzero literal divisor.  Dividing by +/-2^k is an
+// arithmetic shift, after adding 2^k - 1 to a negative dividend so the
+// quotient rounds toward zero.  Any other divisor uses the high half
+// of a multiplication by a precomputed magic number.  The remainder
+// is x - quotient * divisor.
+void InstructionVisitor::translate_divmod_const(Instruction *ins, long divisor, bool mod){
+  int target_flg = 0, x_flg = 0;
+  Operand target = vreg_ref(ins->get_operand(0), 0, &target_flg);
+  Operand x = vreg_ref(ins->get_operand(1), 0, &x_flg);
+  int k = exact_log2(divisor);
+
+  if (divisor == 1 || divisor == -1) {
+    if (mod) {
+      low_level->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, 0), target));
+      return;
     }
+    low_level->add_instruction(new Instruction(MINS_MOVQ, x, rax));
+    if (divisor == -1) {
+      low_level->add_instruction(new Instruction(MINS_NEGQ, rax));
+    }
+    low_level->add_instruction(new Instruction(MINS_MOVQ, rax, target));
+    return;
+  }
+
+  if (k > 0) {
+    // rax = x + (x < 0 ? 2^k - 1 : 0)
+    low_level->add_instruction(new Instruction(MINS_MOVQ, x, rax));
+    if (k > 1) {
+      low_level->add_instruction(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, 63), rax));
+    }
+    low_level->add_instruction(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 64 - k), rax));
+    low_level->add_instruction(new Instruction(MINS_ADDQ, x, rax));
+
+    if (mod) {
+      // the dividend rounded toward zero to a multiple of 2^k
+      low_level->add_instruction(new Instruction(MINS_ANDQ, Operand(OPERAND_INT_LITERAL, -(1L << k)), rax));
+      translate_sub_from(x, x_flg, rax, target, target_flg);
+    } else {
+      low_level->add_instruction(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, k), rax));
+      if (divisor < 0) {
+        low_level->add_instruction(new Instruction(MINS_NEGQ, rax));
+      }
+      low_level->add_instruction(new Instruction(MINS_MOVQ, rax, target));
+    }
+    return;
+  }
+
+  long magic;
+  int shift;
+  compute_signed_magic(divisor, &magic, &shift);
+
+  // rdx = high 64 bits of magic * x
+  low_level->add_instruction(new Instruction(MINS_MOVQ, Operand(OPERAND_INT_LITERAL, magic), rax));
+  low_level->add_instruction(new Instruction(MINS_IMULQ, x));
+  if (divisor > 0 && magic < 0) {
+    low_level->add_instruction(new Instruction(MINS_ADDQ, x, rdx));
+  } else if (divisor < 0 && magic > 0) {
+    low_level->add_instruction(new Instruction(MINS_SUBQ, x, rdx));
+  }
+  if (shift > 0) {
+    low_level->add_instruction(new Instruction(MINS_SARQ, Operand(OPERAND_INT_LITERAL, shift), rdx));
+  }
+  // add 1 if the quotient is negative, to round toward zero
+  low_level->add_instruction(new Instruction(MINS_MOVQ, rdx, rax));
+  low_level->add_instruction(new Instruction(MINS_SHRQ, Operand(OPERAND_INT_LITERAL, 63), rax));
+  low_level->add_instruction(new Instruction(MINS_ADDQ, rax, rdx));
+
+  if (mod) {
+    low_level->add_instruction(new Instruction(MINS_IMULQ, Operand(OPERAND_INT_LITERAL, divisor), rdx, rdx));
+    translate_sub_from(x, x_flg, rdx, target, target_flg);
   } else {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, rdx, target));
+  }
+}
 
-    // resolve memory reference
-    move_first(ins, 0, &reg_0);
-    move_second(ins, 1, &reg_1);
+// translate target = minuend - subtrahend (a scratch register)
+void InstructionVisitor::translate_sub_from(Operand minuend, int minuend_flg, Operand subtrahend, Operand target, int target_flg){
+  if (target_flg) {
+    if (!minuend_flg || minuend.get_base_reg() != target.get_base_reg()) {
+      low_level->add_instruction(new Instruction(MINS_MOVQ, minuend, target));
+    }
+    low_level->add_instruction(new Instruction(MINS_SUBQ, subtrahend, target));
+  } else {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, minuend, r10));
+    low_level->add_instruction(new Instruction(MINS_SUBQ, subtrahend, r10));
+    low_level->add_instruction(new Instruction(MINS_MOVQ, r10, target));
+  }
+}
 
+// translate the cmp instruction
+void InstructionVisitor::translate_cmp(Instruction *ins){
+  Operand a, b;
+  if (flag == 'o') {
+    int a_flg = 0, b_flg = 0;
+    a = vreg_ref(ins->get_operand(0), 0, &a_flg);
+    b = vreg_ref(ins->get_operand(1), 0, &b_flg);
+  } else {
+    a = vreg_ref(ins->get_operand(0));
+    b = vreg_ref(ins->get_operand(1));
+  }
+
+  // cmpq b, a sets the flags for a - b: a can't be an immediate (the
+  // operands are swapped, and the branch's condition mirrored, instead)
+  // and at most one of them can be in memory
+  cmp_swapped = false;
+  if (a.get_kind() == OPERAND_INT_LITERAL && b.get_kind() != OPERAND_INT_LITERAL) {
+    std::swap(a, b);
+    cmp_swapped = true;
+  }
+  if (a.get_kind() == OPERAND_INT_LITERAL || (a.is_memref() && b.is_memref())) {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, a, r10));
+    a = r10;
+  }
+  if (b.get_kind() == OPERAND_INT_LITERAL && !is_imm32_literal(b)) {
+    low_level->add_instruction(new Instruction(MINS_MOVQ, b, r11));
+    b = r11;
+  }
+
+  if (b.get_kind() == OPERAND_INT_LITERAL && b.get_int_value() == 0 && a.get_kind() == OPERAND_MREG) {
+    low_level->add_instruction(new Instruction(MINS_TESTQ, a, a));
+  } else {
+    low_level->add_instruction(new Instruction(MINS_CMPQ, b, a));
   }
-  Instruction *cmp = new Instruction(MINS_CMPQ, reg_1, reg_0);
-  low_level->add_instruction(cmp);
 }
 
 // translate the jump instruction
@@ -777,38 +1256,54 @@ void InstructionVisitor::translate_jump(Instruction *ins){
 
 // translate the jlte instruction
 void InstructionVisitor::translate_jlte(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JLE, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JLE);
 }
 
 // translate the jgte instruction
 void InstructionVisitor::translate_jgte(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JGE, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JGE);
 }
 
 // translate the jlt instruction
 void InstructionVisitor::translate_jlt(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JL, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JL);
 }
 
 // translate the jgt instruction
 void InstructionVisitor::translate_jgt(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JG, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JG);
 }
 
 // translate the jeq instruction
 void InstructionVisitor::translate_jeq(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JE, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JE);
 }
 
 // translate the jne instruction
 void InstructionVisitor::translate_jne(Instruction *ins){
-  Instruction *jmp = new Instruction(MINS_JNE, ins->get_operand(0));
-  low_level->add_instruction(jmp);
+  translate_branch(ins, MINS_JNE);
+}
+
+// translate a conditional branch on the flags set by the compare
+// before it.  The condition is mirrored if the compare swapped its
+// operands, and "jcc L1; jmp L2; L1:" becomes "jncc L2; L1:", so the
+// code falls through to L1 instead of taking two branches.
+void InstructionVisitor::translate_branch(Instruction *ins, int opcode){
+  if (cmp_swapped) {
+    opcode = mirror_condition(opcode);
+    cmp_swapped = false;
+  }
+  Operand target = ins->get_operand(0);
+
+  unsigned next = current_index + 1;
+  if (next + 1 < high_level->get_length() && !high_level->has_label(next) &&
+      high_level->get_instruction(next)->get_opcode() == HINS_JUMP &&
+      high_level->has_label(next + 1) && high_level->get_label(next + 1) == target.get_target_label()) {
+    opcode = x86_64_invert_condition(opcode);
+    target = high_level->get_instruction(next)->get_operand(0);
+    skip_index = int(next);
+  }
+  low_level->add_instruction(new Instruction(opcode, target));
 }
 
 void InstructionVisitor::translate_call(Instruction *ins){
@@ -845,6 +1340,20 @@ void InstructionVisitor::translate_return(Instruction *ins){
 
 }
 
+// save a caller-saved mreg to its vreg's stack slot before a call
+void InstructionVisitor::translate_spill(Instruction *ins){
+  Operand vreg = ins->get_operand(0);
+  Instruction *move = new Instruction(MINS_MOVQ, idx_to_register[vreg.get_m_reg_to_alloc()], vreg_slot(vreg));
+  low_level->add_instruction(move);
+}
+
+// restore a caller-saved mreg from its vreg's stack slot after a call
+void InstructionVisitor::translate_reload(Instruction *ins){
+  Operand vreg = ins->get_operand(0);
+  Instruction *move = new Instruction(MINS_MOVQ, vreg_slot(vreg), idx_to_register[vreg.get_m_reg_to_alloc()]);
+  low_level->add_instruction(move);
+}
+
 
 // get var reference to a vreg
 struct Operand InstructionVisitor::vreg_ref(Operand vreg, int bias, int *flg, int force){
@@ -860,14 +1369,23 @@ struct Operand InstructionVisitor::vreg_ref(Operand vreg, int bias, int *flg, in
 
   // memory references
   if(force || vreg.has_base_reg()){
-    struct Operand memr_address = Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, _var_offset + 8 * vreg.get_base_reg() + bias);
-    return memr_address;
+    return vreg_slot(vreg, bias);
   } else {
     return vreg;
   }
   
 }
 
+// get stack slot of a vreg (slots may be shared by vregs that are
+// never live at the same time; otherwise each vreg has its own)
+struct Operand InstructionVisitor::vreg_slot(Operand vreg, int bias){
+  int slot = vreg.get_stack_slot();
+  if (slot < 0) {
+    slot = vreg.get_base_reg();
+  }
+  return Operand(OPERAND_MREG_MEMREF_OFFSET, MREG_RSP, _var_offset + 8 * slot + bias);
+}
+
 void InstructionVisitor::move_first(Instruction *ins, int operand_idx, struct Operand *reg_0, int *reg_0_constant){
   Instruction *move_first;
   if(ins->get_operand(operand_idx).has_base_reg()){
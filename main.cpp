@@ -14,6 +14,18 @@
 #include "x86_64.h"
 #include "cfg_transform.h"
 #include "live_vregs.h"
+#include "regalloc.h"
+#include "ssa.h"
+#include "constprop.h"
+#include "gvn.h"
+#include "copyprop.h"
+#include "licm.h"
+#include "strength_reduce.h"
+#include "dce.h"
+#include "peephole.h"
+#include "cfg_simplify.h"
+#include "loop_rotate.h"
+#include "loop_unroll.h"
 
 extern "C" {
 int yyparse(void);
@@ -27,6 +39,12 @@ void print_usage(void) {
     "   -p    print AST\n"
     "   -g    print AST as graph (DOT/graphviz)\n"
     "   -s    print symbol table information\n"
+    "   -h    print high-level code\n"
+    "   -o    optimize (linear-scan register allocation)\n"
+    "   -O<n> optimization level: -O1 is the same as -o,\n"
+    "         -O2 uses graph-coloring register allocation\n"
+    "   -u<n> unroll loops (at -O2) into at most n instructions\n"
+    "         (default 64, -u0 doesn't unroll)\n"
   );
 }
 
@@ -45,9 +63,10 @@ int main(int argc, char **argv) {
 
   int mode = COMPILE;
   int optim = 0;
+  int unroll_budget = 64;
   int opt;
 
-  while ((opt = getopt(argc, argv, "pgsho")) != -1) {
+  while ((opt = getopt(argc, argv, "pgshoO:u:")) != -1) {
     switch (opt) {
       case 'p':
         mode = PRINT_AST;
@@ -69,6 +88,14 @@ int main(int argc, char **argv) {
         optim = 1;
         break;
 
+      case 'O':
+        optim = atoi(optarg);
+        break;
+
+      case 'u':
+        unroll_budget = atoi(optarg);
+        break;
+
       case '?':
         print_usage();
     }
@@ -118,17 +145,93 @@ int main(int argc, char **argv) {
       // build cfg and analyze live vreg
       HighLevelControlFlowGraphBuilder cfg_builder(code);
       ControlFlowGraph *cfg = cfg_builder.build();
+
+      // enter WHILE loops through a copy of their test rather than a
+      // jump to it
+      LoopRotation rotate(cfg);
+      rotate.execute();
+
+      // remove the jumps to jumps and placeholder blocks left by the
+      // code generator before optimizing, and whatever the passes
+      // leave behind afterwards
+      HighLevelBranchRewriter branch_rewriter;
+      ControlFlowGraphSimplification simplify(cfg, &branch_rewriter);
+      simplify.execute();
+
+      if (optim >= 2 && unroll_budget > 0) {
+        // unrolled loops give the passes below more to work with
+        LoopUnrolling unroll(cfg, unsigned(unroll_budget));
+        unroll.execute();
+      }
+
+      if (optim >= 2) {
+        // the optimization passes work on the SSA form; the copies
+        // left by taking the CFG back out of SSA form are mostly
+        // removed by coalescing in the register allocator
+        SSABuilder ssa_builder(cfg);
+        ssa_builder.execute();
+
+        ConstantPropagation const_prop(cfg);
+        const_prop.execute();
+
+        GlobalValueNumbering gvn(cfg);
+        gvn.execute();
+
+        CopyPropagation copy_prop(cfg);
+        copy_prop.execute();
+
+        LoopInvariantCodeMotion licm(cfg);
+        licm.execute();
+
+        // hoisted instructions now dominate more of the loop, so
+        // look for redundancies again
+        GlobalValueNumbering gvn_after_licm(cfg);
+        gvn_after_licm.execute();
+
+        CopyPropagation copy_prop_after_licm(cfg);
+        copy_prop_after_licm.execute();
+
+        StrengthReduction strength_reduce(cfg);
+        strength_reduce.execute();
+
+        SSADestructor ssa_destructor(cfg);
+        ssa_destructor.execute();
+
+        ControlFlowGraphSimplification simplify_after_ssa(cfg, &branch_rewriter);
+        simplify_after_ssa.execute();
+      }
+
+      DeadCodeElimination dce(cfg);
+      dce.execute();
+
+      ControlFlowGraphSimplification simplify_after_dce(cfg, &branch_rewriter);
+      simplify_after_dce.execute();
+
       LiveVregs lvreg(cfg);
       lvreg.execute();
 
+      // allocate mregs over the whole function
+      RegisterAllocator *allocator;
+      if (optim >= 2) {
+        allocator = new GraphColoringRegisterAllocator(cfg, &lvreg);
+      } else {
+        allocator = new LinearScanRegisterAllocator(cfg, &lvreg);
+      }
+      allocator->allocate();
+
+      // share stack slots between vregs that are never live together
+      StackSlotAllocator slots(cfg, &lvreg, allocator);
+      slots.allocate();
+
       // perform optim
-      HighLevelControlFlowGraphTransform cfg_transform(cfg, &lvreg);
+      HighLevelControlFlowGraphTransform cfg_transform(cfg, allocator, &slots);
       ControlFlowGraph *new_cfg = cfg_transform.transform_cfg();
-      code = new_cfg->create_instruction_sequence();
+      code = new_cfg->create_instruction_sequence(&branch_rewriter);
 
       // get vreg mreg count
       vreg_count = cfg_transform.get_vreg_count();
       mreg_count = cfg_transform.get_max_mreg_use();
+      delete allocator;
 
       // Printer for debug use
 
@@ -155,6 +258,26 @@ int main(int argc, char **argv) {
       generator_generate_lowlevel(lowlevel_generator);
       struct InstructionSequence *lowlevel = generate_lowlevel(lowlevel_generator);
 
+      // clean up the generated code (at every optimization level)
+      X86_64ControlFlowGraphBuilder lowlevel_cfg_builder(lowlevel);
+      ControlFlowGraph *lowlevel_cfg = lowlevel_cfg_builder.build();
+      X86_64BranchRewriter branch_rewriter;
+      if (optim) {
+        ControlFlowGraphSimplification simplify(lowlevel_cfg, &branch_rewriter);
+        simplify.execute();
+      }
+      X86_64Peephole peephole(lowlevel_cfg);
+      peephole.execute();
+      if (optim) {
+        ControlFlowGraphSimplification simplify_after_peephole(lowlevel_cfg, &branch_rewriter);
+        simplify_after_peephole.execute();
+
+        // lay out the blocks so that loops and likely paths fall through
+        lowlevel = lowlevel_cfg->create_instruction_sequence(&branch_rewriter);
+      } else {
+        lowlevel = lowlevel_cfg->create_instruction_sequence();
+      }
+
       PrintX86_64InstructionSequence print_ins(lowlevel);
       print_ins.print();
     }
@@ -0,0 +1,414 @@
+#include <cassert>
+#include <climits>
+#include <iterator>
+#include "cfg.h"
+#include "x86_64.h"
+#include "peephole.h"
+
+namespace {
+  unsigned reg_bit(int reg) {
+    // %eax is the low half of %rax
+    return 1U << (reg == MREG_EAX ? MREG_RAX : reg);
+  }
+
+  // registers the lowering uses for values within a single high-level
+  // instruction
+  const unsigned SCRATCH_REGS = (1U << MREG_R10) | (1U << MREG_R11) | (1U << MREG_RAX) | (1U << MREG_RDX);
+
+  // registers that a call may change
+  const unsigned CALLER_SAVED_REGS = (1U << MREG_RAX) | (1U << MREG_RCX) | (1U << MREG_RDX) |
+                                     (1U << MREG_RSI) | (1U << MREG_RDI) | (1U << MREG_R8) |
+                                     (1U << MREG_R9) | (1U << MREG_R10) | (1U << MREG_R11);
+
+  bool is_reg(const Operand &operand) {
+    return operand.get_kind() == OPERAND_MREG;
+  }
+
+  bool is_mem(const Operand &operand) {
+    return operand.is_memref() || operand.get_kind() == OPERAND_LABEL;
+  }
+
+  bool is_literal(const Operand &operand, long value) {
+    return operand.get_kind() == OPERAND_INT_LITERAL && operand.get_int_value() == value;
+  }
+
+  // can the operand be used where an instruction takes a 32-bit immediate?
+  bool is_imm32(const Operand &operand) {
+    return operand.get_kind() != OPERAND_INT_LITERAL ||
+           (operand.get_int_value() >= INT_MIN && operand.get_int_value() <= INT_MAX);
+  }
+
+  bool is_scratch(const Operand &operand) {
+    return is_reg(operand) && (reg_bit(operand.get_base_reg()) & SCRATCH_REGS) != 0;
+  }
+
+  bool same_operand(const Operand &a, const Operand &b) {
+    if (a.get_kind() != b.get_kind()) {
+      return false;
+    }
+    if (a.has_base_reg() && reg_bit(a.get_base_reg()) != reg_bit(b.get_base_reg())) {
+      return false;
+    }
+    if (a.has_index_reg() && (a.get_index_reg() != b.get_index_reg() || a.get_scale() != b.get_scale())) {
+      return false;
+    }
+    if (a.get_kind() == OPERAND_INT_LITERAL) {
+      return a.get_int_value() == b.get_int_value();
+    }
+    if (a.get_kind() & OPROP_HAS_INTVAL) {
+      return a.get_offset() == b.get_offset();
+    }
+    if (a.get_kind() & OPROP_HAS_LABEL) {
+      return a.get_target_label() == b.get_target_label();
+    }
+    return true;
+  }
+
+  // registers read by an operand used as a source, or by the address
+  // of a memory reference
+  unsigned regs_in(const Operand &operand) {
+    unsigned regs = 0;
+    if (operand.has_base_reg()) {
+      regs |= reg_bit(operand.get_base_reg());
+    }
+    if (operand.has_index_reg()) {
+      regs |= reg_bit(operand.get_index_reg());
+    }
+    return regs;
+  }
+
+  unsigned address_regs(const Operand &operand) {
+    return operand.is_memref() ? regs_in(operand) : 0;
+  }
+
+  // get the registers an instruction reads and the ones it overwrites
+  // (an instruction not known here is assumed to read every register)
+  void get_reg_effects(Instruction *ins, unsigned &read, unsigned &written) {
+    unsigned num_operands = ins->get_num_operands();
+    read = 0;
+    written = 0;
+
+    switch (ins->get_opcode()) {
+    case MINS_MOVQ:
+    case MINS_MOVL:
+    case MINS_LEAQ:
+      {
+        Operand dest = ins->get_operand(1);
+        read = regs_in(ins->get_operand(0)) | address_regs(dest);
+        written = is_reg(dest) ? reg_bit(dest.get_base_reg()) : 0;
+      }
+      break;
+    case MINS_IMULQ:
+      if (num_operands == 1) {
+        read = regs_in(ins->get_operand(0)) | reg_bit(MREG_RAX);
+        written = reg_bit(MREG_RAX) | reg_bit(MREG_RDX);
+        break;
+      } else if (num_operands == 3) {
+        Operand dest = ins->get_operand(2);
+        read = regs_in(ins->get_operand(1));
+        written = reg_bit(dest.get_base_reg());
+        break;
+      }
+      // fall through: two-operand form
+    case MINS_ADDQ:
+    case MINS_SUBQ:
+    case MINS_ANDQ:
+    case MINS_SHLQ:
+    case MINS_SARQ:
+    case MINS_SHRQ:
+    case MINS_NEGQ:
+      {
+        Operand dest = ins->get_operand(num_operands - 1);
+        for (unsigned i = 0; i < num_operands; i++) {
+          read |= regs_in(ins->get_operand(i));
+        }
+        written = is_reg(dest) ? reg_bit(dest.get_base_reg()) : 0;
+      }
+      break;
+    case MINS_CMPQ:
+    case MINS_TESTQ:
+    case MINS_PUSHQ:
+      for (unsigned i = 0; i < num_operands; i++) {
+        read |= regs_in(ins->get_operand(i));
+      }
+      break;
+    case MINS_POPQ:
+      written = reg_bit(ins->get_operand(0).get_base_reg());
+      break;
+    case MINS_CQTO:
+      read = reg_bit(MREG_RAX);
+      written = reg_bit(MREG_RDX);
+      break;
+    case MINS_IDIVQ:
+      read = regs_in(ins->get_operand(0)) | reg_bit(MREG_RAX) | reg_bit(MREG_RDX);
+      written = reg_bit(MREG_RAX) | reg_bit(MREG_RDX);
+      break;
+    case MINS_CALL:
+      // the arguments, and %al for variadic functions
+      read = reg_bit(MREG_RDI) | reg_bit(MREG_RSI) | reg_bit(MREG_RAX);
+      written = CALLER_SAVED_REGS;
+      break;
+    case MINS_NOP:
+    case MINS_EPTY:
+    case MINS_JMP:
+    case MINS_JE:
+    case MINS_JNE:
+    case MINS_JL:
+    case MINS_JLE:
+    case MINS_JG:
+    case MINS_JGE:
+      break;
+    default:
+      read = ~0U;
+      break;
+    }
+  }
+
+  // is the scratch register's value unused from the instruction at
+  // index on?  (scratch registers are dead at the end of a block)
+  bool is_dead_from(BasicBlock *bb, unsigned index, const Operand &reg) {
+    assert(is_scratch(reg));
+    unsigned bit = reg_bit(reg.get_base_reg());
+    for (unsigned i = index; i < bb->get_length(); i++) {
+      unsigned read, written;
+      get_reg_effects(bb->get_instruction(i), read, written);
+      if (read & bit) {
+        return false;
+      }
+      if (written & bit) {
+        return true;
+      }
+    }
+    return true;
+  }
+
+  void remove_instruction(BasicBlock *bb, unsigned index) {
+    bb->remove_instruction(index);
+    if (bb->get_length() == 0) {
+      // keep a placeholder for the block's label
+      bb->add_instruction(new Instruction(MINS_EPTY));
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // default rules
+  //////////////////////////////////////////////////////////////////////
+
+  // addq $0, X / subq $0, X / shift by 0 / imulq $1, X  =>  (nothing)
+  // (the lowering never branches on the flags set by arithmetic)
+  bool remove_identity_arith(BasicBlock *bb, unsigned index) {
+    Instruction *ins = bb->get_instruction(index);
+    switch (ins->get_opcode()) {
+    case MINS_ADDQ:
+    case MINS_SUBQ:
+    case MINS_SHLQ:
+    case MINS_SARQ:
+    case MINS_SHRQ:
+      if (!is_literal(ins->get_operand(0), 0)) {
+        return false;
+      }
+      break;
+    case MINS_IMULQ:
+      if (ins->get_num_operands() != 2 || !is_literal(ins->get_operand(0), 1)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+    remove_instruction(bb, index);
+    return true;
+  }
+
+  // movq R, R  =>  (nothing)
+  bool remove_self_move(BasicBlock *bb, unsigned index) {
+    Instruction *ins = bb->get_instruction(index);
+    if (ins->get_opcode() != MINS_MOVQ || !is_reg(ins->get_operand(0)) ||
+        !same_operand(ins->get_operand(0), ins->get_operand(1))) {
+      return false;
+    }
+    remove_instruction(bb, index);
+    return true;
+  }
+
+  // movq/leaq X, S  =>  (nothing), if scratch register S is dead
+  bool remove_dead_scratch_write(BasicBlock *bb, unsigned index) {
+    Instruction *ins = bb->get_instruction(index);
+    if (ins->get_opcode() != MINS_MOVQ && ins->get_opcode() != MINS_LEAQ) {
+      return false;
+    }
+    Operand dest = ins->get_operand(1);
+    if (!is_scratch(dest) || !is_dead_from(bb, index + 1, dest)) {
+      return false;
+    }
+    remove_instruction(bb, index);
+    return true;
+  }
+
+  // movq A, B; movq B, A  =>  movq A, B
+  bool remove_move_back(BasicBlock *bb, unsigned index) {
+    Instruction *first = bb->get_instruction(index);
+    Instruction *second = bb->get_instruction(index + 1);
+    if (first->get_opcode() != MINS_MOVQ || second->get_opcode() != MINS_MOVQ) {
+      return false;
+    }
+    Operand a = first->get_operand(0), b = first->get_operand(1);
+    if (!same_operand(a, second->get_operand(1)) || !same_operand(b, second->get_operand(0))) {
+      return false;
+    }
+    // A's address mustn't have changed
+    if (is_reg(b) && (address_regs(a) & reg_bit(b.get_base_reg()))) {
+      return false;
+    }
+    remove_instruction(bb, index + 1);
+    return true;
+  }
+
+  // movq R, M; movq M, D  =>  movq R, M; movq R, D
+  bool forward_store_to_load(BasicBlock *bb, unsigned index) {
+    Instruction *store = bb->get_instruction(index);
+    Instruction *load = bb->get_instruction(index + 1);
+    if (store->get_opcode() != MINS_MOVQ || load->get_opcode() != MINS_MOVQ) {
+      return false;
+    }
+    Operand reg = store->get_operand(0), mem = store->get_operand(1);
+    Operand dest = load->get_operand(1);
+    if (!is_reg(reg) || !is_mem(mem) || !is_reg(dest) || !same_operand(mem, load->get_operand(0))) {
+      return false;
+    }
+    if (same_operand(reg, dest)) {
+      remove_instruction(bb, index + 1);
+    } else {
+      *load = Instruction(MINS_MOVQ, reg, dest);
+    }
+    return true;
+  }
+
+  // movq A, S; movq S, B  =>  movq A, B, if scratch register S is dead after
+  bool merge_scratch_copy(BasicBlock *bb, unsigned index) {
+    Instruction *first = bb->get_instruction(index);
+    Instruction *second = bb->get_instruction(index + 1);
+    if (first->get_opcode() != MINS_MOVQ || second->get_opcode() != MINS_MOVQ) {
+      return false;
+    }
+    Operand a = first->get_operand(0), s = first->get_operand(1), b = second->get_operand(1);
+    if (!is_scratch(s) || !same_operand(s, second->get_operand(0)) || same_operand(s, b)) {
+      return false;
+    }
+    // there is no memory-to-memory move, and only a register can take
+    // a 64-bit immediate
+    if (is_mem(a) && is_mem(b)) {
+      return false;
+    }
+    if (!is_reg(b) && !is_imm32(a)) {
+      return false;
+    }
+    if ((address_regs(b) & reg_bit(s.get_base_reg())) || !is_dead_from(bb, index + 2, s)) {
+      return false;
+    }
+    *first = Instruction(MINS_MOVQ, a, b);
+    remove_instruction(bb, index + 1);
+    return true;
+  }
+
+  // movq A, S; op S, B  =>  op A, B, if scratch register S is dead after
+  bool fold_scratch_operand(BasicBlock *bb, unsigned index) {
+    Instruction *move = bb->get_instruction(index);
+    Instruction *ins = bb->get_instruction(index + 1);
+    int opcode = ins->get_opcode();
+    if (move->get_opcode() != MINS_MOVQ || ins->get_num_operands() != 2) {
+      return false;
+    }
+    if (opcode != MINS_ADDQ && opcode != MINS_SUBQ && opcode != MINS_ANDQ &&
+        opcode != MINS_CMPQ && opcode != MINS_IMULQ) {
+      return false;
+    }
+    Operand a = move->get_operand(0), s = move->get_operand(1), b = ins->get_operand(1);
+    if (!is_scratch(s) || !same_operand(s, ins->get_operand(0)) || same_operand(s, b)) {
+      return false;
+    }
+    if ((is_mem(a) && is_mem(b)) || !is_imm32(a)) {
+      return false;
+    }
+    if (opcode == MINS_IMULQ && !is_reg(b)) {
+      return false;
+    }
+    if ((address_regs(b) & reg_bit(s.get_base_reg())) || !is_dead_from(bb, index + 2, s)) {
+      return false;
+    }
+    *ins = Instruction(opcode, a, b);
+    remove_instruction(bb, index);
+    return true;
+  }
+
+  const struct {
+    const char *name;
+    unsigned window;
+    PeepholeRuleFunc apply;
+  } default_rules[] = {
+    { "identity-arith",     1, remove_identity_arith },
+    { "self-move",          1, remove_self_move },
+    { "dead-scratch-write", 1, remove_dead_scratch_write },
+    { "move-back",          2, remove_move_back },
+    { "store-to-load",      2, forward_store_to_load },
+    { "scratch-copy",       2, merge_scratch_copy },
+    { "scratch-operand",    2, fold_scratch_operand },
+  };
+}
+
+X86_64Peephole::X86_64Peephole(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_max_window(1) {
+  for (auto i = std::begin(default_rules); i != std::end(default_rules); i++) {
+    add_rule(i->name, i->window, i->apply);
+  }
+}
+
+X86_64Peephole::~X86_64Peephole() {
+}
+
+void X86_64Peephole::add_rule(const std::string &name, unsigned window, PeepholeRuleFunc apply) {
+  assert(window > 0);
+  m_rules.push_back({ name, window, apply, 0 });
+  if (window > m_max_window) {
+    m_max_window = window;
+  }
+}
+
+void X86_64Peephole::execute() {
+  // a rewrite can make a scratch register dead anywhere earlier in
+  // its block, so keep going until nothing changes
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+      if (optimize_block(*i)) {
+        changed = true;
+      }
+    }
+  }
+}
+
+bool X86_64Peephole::optimize_block(BasicBlock *bb) {
+  bool changed = false;
+  unsigned index = 0;
+  while (index < bb->get_length()) {
+    bool hit = false;
+    for (auto i = m_rules.begin(); i != m_rules.end() && !hit; i++) {
+      if (index + i->window <= bb->get_length() && i->apply(bb, index)) {
+        i->num_hits++;
+        hit = true;
+      }
+    }
+
+    if (hit) {
+      // the rewritten instructions may now match a window starting
+      // before them
+      changed = true;
+      index = (index >= m_max_window - 1) ? index - (m_max_window - 1) : 0;
+    } else {
+      index++;
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,59 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <string>
+#include <vector>
+#include "cfg.h"
+
+// A peephole rule looks at the window of instructions starting at the
+// given index of a basic block; if they match, it rewrites them in
+// place and returns true.
+typedef bool (*PeepholeRuleFunc)(BasicBlock *bb, unsigned index);
+
+// Peephole optimization over an x86-64 ControlFlowGraph (see
+// X86_64ControlFlowGraphBuilder).  A window slides over each basic
+// block, and at each position the rules are tried in order; after a
+// rewrite the window backs up far enough for the rules to see the new
+// instructions together with the ones before them.  This repeats until
+// no rule matches anywhere.
+//
+// The default rules remove the redundancy left by the lowering, which
+// moves most values through the scratch registers (%r10, %r11, %rax,
+// %rdx) one high-level instruction at a time: a scratch register
+// never carries a value from one basic block to the next, so a rule
+// only has to look ahead to the end of the block to know that it's
+// dead.  More rules can be added with add_rule; each counts its hits.
+class X86_64Peephole {
+private:
+  struct Rule {
+    std::string name;
+    unsigned window;
+    PeepholeRuleFunc apply;
+    unsigned num_hits;
+  };
+
+  ControlFlowGraph *m_cfg;
+  std::vector<Rule> m_rules;
+  unsigned m_max_window;
+
+public:
+  // the default rules are added first
+  X86_64Peephole(ControlFlowGraph *cfg);
+  ~X86_64Peephole();
+
+  // add a rule matching a window of the given number of instructions
+  void add_rule(const std::string &name, unsigned window, PeepholeRuleFunc apply);
+
+  void execute();
+
+  unsigned get_num_rules() const { return unsigned(m_rules.size()); }
+  const std::string &get_rule_name(unsigned i) const { return m_rules[i].name; }
+
+  // get the number of times a rule has rewritten code
+  unsigned get_num_hits(unsigned i) const { return m_rules[i].num_hits; }
+
+private:
+  bool optimize_block(BasicBlock *bb);
+};
+
+#endif // PEEPHOLE_H
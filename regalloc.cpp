@@ -0,0 +1,839 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "live_intervals.h"
+#include "loops.h"
+#include "regalloc.h"
+
+namespace {
+  // Register preference orders.  Caller-saved registers are free to
+  // use (main doesn't have to save them), but they don't survive a call,
+  // so values live across a call are steered to callee-saved registers
+  // and only use a caller-saved one (saved and restored around each
+  // call) as a last resort.  Callee-saved registers are tried from r15
+  // down, since the prologue saves every register from r15 down to the
+  // lowest one used.
+  const std::vector<int> ANY_MREG_ORDER = { 0, 1, 2, 7, 6, 5, 4, 3 };
+  const std::vector<int> CALL_CROSSING_ORDER = { 7, 6, 5, 4, 3, 0, 1, 2 };
+  const std::vector<int> CALLEE_SAVED_ORDER = { 7, 6, 5, 4, 3 };
+}
+
+////////////////////////////////////////////////////////////////////////
+// RegisterAllocator implementation
+////////////////////////////////////////////////////////////////////////
+
+RegisterAllocator::RegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs)
+  : m_cfg(cfg)
+  , m_live_vregs(live_vregs)
+  , m_assignment(live_vregs->get_num_vregs(), -1)
+  , m_num_spilled(0) {
+}
+
+RegisterAllocator::~RegisterAllocator() {
+}
+
+int RegisterAllocator::get_mreg(int vreg) const {
+  if (vreg < 0 || unsigned(vreg) >= m_assignment.size()) {
+    return -1;
+  }
+  return m_assignment[vreg];
+}
+
+std::vector<int> RegisterAllocator::get_saved_across_call(BasicBlock *bb, unsigned index) const {
+  std::vector<int> result;
+  Instruction *ins = bb->get_instruction(index);
+  if (!is_call(ins)) {
+    return result;
+  }
+
+  // a vreg must survive the call if it is live both before and after it
+  int def = is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+  const LiveVregs::LiveSet &live_before = m_live_vregs->get_fact_before_instruction(bb, index);
+  const LiveVregs::LiveSet &live_after = m_live_vregs->get_fact_after_instruction(bb, index);
+  for (auto i = live_after.begin(); i != live_after.end(); ++i) {
+    int vreg = int(*i);
+    int mreg = get_mreg(vreg);
+    if (vreg != def && live_before.test(*i) && mreg >= 0 && !is_callee_saved(mreg)) {
+      result.push_back(vreg);
+    }
+  }
+  return result;
+}
+
+int RegisterAllocator::get_max_mreg_use() const {
+  int lowest = NUM_MREGS;
+  for (auto i = m_assignment.begin(); i != m_assignment.end(); i++) {
+    if (*i >= 0 && is_callee_saved(*i)) {
+      lowest = std::min(lowest, *i);
+    }
+  }
+  return NUM_MREGS - lowest;
+}
+
+////////////////////////////////////////////////////////////////////////
+// LinearScanRegisterAllocator implementation
+////////////////////////////////////////////////////////////////////////
+
+LinearScanRegisterAllocator::LinearScanRegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs)
+  : RegisterAllocator(cfg, live_vregs)
+  , m_intervals(cfg, live_vregs) {
+}
+
+LinearScanRegisterAllocator::~LinearScanRegisterAllocator() {
+}
+
+void LinearScanRegisterAllocator::allocate() {
+  m_intervals.build();
+
+  std::vector<LiveInterval *> unhandled = m_intervals.get_sorted_intervals();
+  for (auto i = unhandled.begin(); i != unhandled.end(); i++) {
+    LiveInterval *current = *i;
+    update_active_and_inactive(current->start());
+
+    // A caller-saved register costs a store and a load per call
+    // crossed, which is only worthwhile for a value used more often
+    // than that.
+    unsigned num_calls = m_intervals.get_num_calls_crossed(current);
+    const std::vector<int> *candidates = &ANY_MREG_ORDER;
+    if (num_calls > 0) {
+      candidates = (2 * num_calls < current->use_positions.size()) ? &CALL_CROSSING_ORDER : &CALLEE_SAVED_ORDER;
+    }
+
+    if (!try_allocate_free_reg(current, *candidates)) {
+      allocate_blocked_reg(current, *candidates);
+    }
+    if (m_assignment[current->vreg] >= 0) {
+      m_active.push_back(current);
+    }
+  }
+
+  m_active.clear();
+  m_inactive.clear();
+}
+
+void LinearScanRegisterAllocator::update_active_and_inactive(unsigned pos) {
+  std::vector<LiveInterval *> active, inactive;
+
+  // intervals that have ended are dropped; intervals in a lifetime
+  // hole at pos are inactive (their register can be used until they
+  // become live again)
+  for (auto i = m_active.begin(); i != m_active.end(); i++) {
+    LiveInterval *interval = *i;
+    if (interval->end() <= pos) {
+      continue;
+    }
+    if (interval->covers(pos)) {
+      active.push_back(interval);
+    } else {
+      inactive.push_back(interval);
+    }
+  }
+  for (auto i = m_inactive.begin(); i != m_inactive.end(); i++) {
+    LiveInterval *interval = *i;
+    if (interval->end() <= pos) {
+      continue;
+    }
+    if (interval->covers(pos)) {
+      active.push_back(interval);
+    } else {
+      inactive.push_back(interval);
+    }
+  }
+
+  m_active.swap(active);
+  m_inactive.swap(inactive);
+}
+
+bool LinearScanRegisterAllocator::try_allocate_free_reg(LiveInterval *current, const std::vector<int> &candidates) {
+  // find how long each register is free for
+  unsigned free_until[NUM_MREGS];
+  std::fill(free_until, free_until + NUM_MREGS, UINT_MAX);
+  for (auto i = m_active.begin(); i != m_active.end(); i++) {
+    free_until[m_assignment[(*i)->vreg]] = 0;
+  }
+  for (auto i = m_inactive.begin(); i != m_inactive.end(); i++) {
+    int mreg = m_assignment[(*i)->vreg];
+    free_until[mreg] = std::min(free_until[mreg], (*i)->next_intersection(current, 0));
+  }
+
+  // intervals aren't split, so the register must be free for
+  // the entire interval
+  for (auto i = candidates.begin(); i != candidates.end(); i++) {
+    if (free_until[*i] >= current->end()) {
+      m_assignment[current->vreg] = *i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LinearScanRegisterAllocator::allocate_blocked_reg(LiveInterval *current, const std::vector<int> &candidates) {
+  unsigned pos = current->start();
+
+  // find the next use of the value(s) occupying each register
+  unsigned next_use[NUM_MREGS];
+  std::fill(next_use, next_use + NUM_MREGS, UINT_MAX);
+  for (auto i = m_active.begin(); i != m_active.end(); i++) {
+    int mreg = m_assignment[(*i)->vreg];
+    next_use[mreg] = std::min(next_use[mreg], (*i)->next_use(pos));
+  }
+  for (auto i = m_inactive.begin(); i != m_inactive.end(); i++) {
+    if ((*i)->intersects(current)) {
+      int mreg = m_assignment[(*i)->vreg];
+      next_use[mreg] = std::min(next_use[mreg], (*i)->next_use(pos));
+    }
+  }
+
+  int best = -1;
+  for (auto i = candidates.begin(); i != candidates.end(); i++) {
+    if (best < 0 || next_use[*i] > next_use[best]) {
+      best = *i;
+    }
+  }
+  assert(best >= 0);
+
+  // The current interval usually starts with a def, which doesn't
+  // count: what matters is how soon the value is needed again.
+  if (current->next_use(pos + 1) >= next_use[best]) {
+    spill(current);
+    return;
+  }
+
+  // evict everything in the chosen register that overlaps the
+  // current interval
+  std::vector<LiveInterval *> active, inactive;
+  for (auto i = m_active.begin(); i != m_active.end(); i++) {
+    if (m_assignment[(*i)->vreg] == best) {
+      spill(*i);
+    } else {
+      active.push_back(*i);
+    }
+  }
+  for (auto i = m_inactive.begin(); i != m_inactive.end(); i++) {
+    if (m_assignment[(*i)->vreg] == best && (*i)->intersects(current)) {
+      spill(*i);
+    } else {
+      inactive.push_back(*i);
+    }
+  }
+  m_active.swap(active);
+  m_inactive.swap(inactive);
+
+  m_assignment[current->vreg] = best;
+}
+
+void LinearScanRegisterAllocator::spill(LiveInterval *interval) {
+  m_assignment[interval->vreg] = -1;
+  m_num_spilled++;
+}
+
+////////////////////////////////////////////////////////////////////////
+// GraphColoringRegisterAllocator implementation
+////////////////////////////////////////////////////////////////////////
+
+GraphColoringRegisterAllocator::GraphColoringRegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs)
+  : RegisterAllocator(cfg, live_vregs)
+  , m_num_nodes(NUM_MREGS + live_vregs->get_num_vregs())
+  , m_state(m_num_nodes, NODE_UNUSED)
+  , m_adj_list(m_num_nodes)
+  , m_degree(m_num_nodes, 0)
+  , m_move_list(m_num_nodes)
+  , m_alias(m_num_nodes)
+  , m_color(m_num_nodes, -1)
+  , m_spill_cost(m_num_nodes, 0.0)
+  , m_call_cost(m_num_nodes, 0.0)
+  , m_num_coalesced_moves(0) {
+  for (unsigned n = 0; n < m_num_nodes; n++) {
+    m_alias[n] = int(n);
+  }
+  for (int r = 0; r < NUM_MREGS; r++) {
+    m_state[r] = NODE_PRECOLORED;
+    m_color[r] = r;
+    // precolored nodes are never simplified or spilled
+    m_degree[r] = UINT_MAX / 2;
+  }
+}
+
+GraphColoringRegisterAllocator::~GraphColoringRegisterAllocator() {
+}
+
+void GraphColoringRegisterAllocator::allocate() {
+  build();
+  make_worklist();
+
+  while (!m_simplify_worklist.empty() || !m_worklist_moves.empty() ||
+         !m_freeze_worklist.empty() || !m_spill_worklist.empty()) {
+    if (!m_simplify_worklist.empty()) {
+      simplify();
+    } else if (!m_worklist_moves.empty()) {
+      coalesce();
+    } else if (!m_freeze_worklist.empty()) {
+      freeze();
+    } else {
+      select_spill();
+    }
+  }
+
+  assign_colors();
+
+  for (unsigned vreg = 0; vreg < m_assignment.size(); vreg++) {
+    int n = vreg_node(int(vreg));
+    if (m_state[n] == NODE_UNUSED) {
+      continue;
+    }
+    m_assignment[vreg] = m_color[n];
+    if (m_color[n] < 0) {
+      m_num_spilled++;
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::build() {
+  LoopForest *loops = m_cfg->get_loop_forest();
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    double weight = 1.0;
+    for (unsigned d = 0; d < loops->get_depth(bb) && d < 8; d++) {
+      weight *= 10.0;
+    }
+    build_block(bb, weight);
+  }
+}
+
+void GraphColoringRegisterAllocator::build_block(BasicBlock *bb, double weight) {
+  LiveVregs::LiveSet live = m_live_vregs->get_fact_at_end_of_block(bb);
+
+  for (unsigned j = bb->get_length(); j > 0; j--) {
+    Instruction *ins = bb->get_instruction(j - 1);
+    int def = is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+
+    if (ins->get_opcode() == HINS_MOV && def >= 0 &&
+        ins->get_operand(1).get_kind() == OPERAND_VREG) {
+      // a copy doesn't make its source and destination interfere,
+      // and is a candidate for coalescing
+      int src = ins->get_operand(1).get_base_reg();
+      live.reset(src);
+      if (src != def) {
+        Move move = { vreg_node(def), vreg_node(src), MOVE_WORKLIST };
+        int index = int(m_moves.size());
+        m_moves.push_back(move);
+        m_move_list[vreg_node(def)].push_back(index);
+        m_move_list[vreg_node(src)].push_back(index);
+        m_worklist_moves.insert(index);
+      }
+    }
+
+    if (is_call(ins)) {
+      // values live across the call would rather be in a
+      // callee-saved register
+      for (auto k = live.begin(); k != live.end(); ++k) {
+        if (int(*k) != def) {
+          m_call_cost[vreg_node(int(*k))] += weight;
+        }
+      }
+    }
+
+    if (def >= 0) {
+      int d = vreg_node(def);
+      if (m_state[d] == NODE_UNUSED) {
+        m_state[d] = NODE_INITIAL;
+      }
+      for (auto k = live.begin(); k != live.end(); ++k) {
+        if (int(*k) != def) {
+          add_edge(d, vreg_node(int(*k)));
+        }
+      }
+      m_spill_cost[d] += weight;
+      live.reset(def);
+    }
+
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (!is_use(ins, k)) {
+        continue;
+      }
+      Operand operand = ins->get_operand(k);
+      int regs[2] = { operand.get_base_reg(), operand.has_index_reg() ? operand.get_index_reg() : -1 };
+      for (int r = 0; r < 2; r++) {
+        if (regs[r] < 0) {
+          continue;
+        }
+        int u = vreg_node(regs[r]);
+        if (m_state[u] == NODE_UNUSED) {
+          m_state[u] = NODE_INITIAL;
+        }
+        m_spill_cost[u] += weight;
+        live.set(regs[r]);
+      }
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::add_edge(int u, int v) {
+  if (u == v || adjacent(u, v)) {
+    return;
+  }
+  m_adj_set.insert((unsigned long)u * m_num_nodes + v);
+  m_adj_set.insert((unsigned long)v * m_num_nodes + u);
+  if (!is_precolored(u)) {
+    m_adj_list[u].push_back(v);
+    m_degree[u]++;
+  }
+  if (!is_precolored(v)) {
+    m_adj_list[v].push_back(u);
+    m_degree[v]++;
+  }
+}
+
+bool GraphColoringRegisterAllocator::adjacent(int u, int v) const {
+  return m_adj_set.count((unsigned long)u * m_num_nodes + v) != 0;
+}
+
+void GraphColoringRegisterAllocator::make_worklist() {
+  for (unsigned n = NUM_MREGS; n < m_num_nodes; n++) {
+    if (m_state[n] != NODE_INITIAL) {
+      continue;
+    }
+    if (m_degree[n] >= unsigned(NUM_MREGS)) {
+      set_state(int(n), NODE_SPILL);
+    } else if (is_move_related(int(n))) {
+      set_state(int(n), NODE_FREEZE);
+    } else {
+      set_state(int(n), NODE_SIMPLIFY);
+    }
+  }
+}
+
+template<typename Fn>
+void GraphColoringRegisterAllocator::for_each_adjacent(int n, Fn fn) {
+  // neighbors that have been removed from the graph don't count
+  std::vector<int> &adj = m_adj_list[n];
+  for (unsigned i = 0; i < adj.size(); i++) {
+    int m = adj[i];
+    if (m_state[m] != NODE_ON_STACK && m_state[m] != NODE_COALESCED) {
+      fn(m);
+    }
+  }
+}
+
+bool GraphColoringRegisterAllocator::is_move_related(int n) const {
+  const std::vector<int> &moves = m_move_list[n];
+  for (auto i = moves.begin(); i != moves.end(); i++) {
+    MoveState state = m_moves[*i].state;
+    if (state == MOVE_WORKLIST || state == MOVE_ACTIVE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template<typename Fn>
+void GraphColoringRegisterAllocator::for_each_node_move(int n, Fn fn) {
+  std::vector<int> &moves = m_move_list[n];
+  for (unsigned i = 0; i < moves.size(); i++) {
+    MoveState state = m_moves[moves[i]].state;
+    if (state == MOVE_WORKLIST || state == MOVE_ACTIVE) {
+      fn(moves[i]);
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::simplify() {
+  int n = *m_simplify_worklist.begin();
+  set_state(n, NODE_ON_STACK);
+  m_select_stack.push_back(n);
+  for_each_adjacent(n, [this](int m) { decrement_degree(m); });
+}
+
+void GraphColoringRegisterAllocator::decrement_degree(int m) {
+  if (is_precolored(m)) {
+    return;
+  }
+  unsigned d = m_degree[m]--;
+  if (d == unsigned(NUM_MREGS)) {
+    // m just became low-degree: moves involving it or its neighbors
+    // may now be coalescable
+    enable_moves(m);
+    for_each_adjacent(m, [this](int t) { enable_moves(t); });
+    if (m_state[m] == NODE_SPILL) {
+      set_state(m, is_move_related(m) ? NODE_FREEZE : NODE_SIMPLIFY);
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::enable_moves(int n) {
+  for_each_node_move(n, [this](int index) {
+    if (m_moves[index].state == MOVE_ACTIVE) {
+      m_moves[index].state = MOVE_WORKLIST;
+      m_worklist_moves.insert(index);
+    }
+  });
+}
+
+void GraphColoringRegisterAllocator::coalesce() {
+  int index = *m_worklist_moves.begin();
+  m_worklist_moves.erase(m_worklist_moves.begin());
+  Move &move = m_moves[index];
+
+  int x = get_alias(move.dst), y = get_alias(move.src);
+  int u = x, v = y;
+  if (is_precolored(y)) {
+    u = y;
+    v = x;
+  }
+
+  if (u == v) {
+    move.state = MOVE_COALESCED;
+    m_num_coalesced_moves++;
+    add_worklist(u);
+  } else if (is_precolored(v) || adjacent(u, v)) {
+    move.state = MOVE_CONSTRAINED;
+    add_worklist(u);
+    add_worklist(v);
+  } else {
+    bool can_combine;
+    if (is_precolored(u)) {
+      // George: every neighbor of v is fine with u
+      can_combine = true;
+      for_each_adjacent(v, [this, u, &can_combine](int t) {
+        if (!ok(t, u)) { can_combine = false; }
+      });
+    } else {
+      // Briggs: the combined node has fewer than K high-degree neighbors
+      can_combine = conservative(u, v);
+    }
+
+    if (can_combine) {
+      move.state = MOVE_COALESCED;
+      m_num_coalesced_moves++;
+      combine(u, v);
+      add_worklist(u);
+    } else {
+      move.state = MOVE_ACTIVE;
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::add_worklist(int u) {
+  if (!is_precolored(u) && !is_move_related(u) && m_degree[u] < unsigned(NUM_MREGS) &&
+      m_state[u] == NODE_FREEZE) {
+    set_state(u, NODE_SIMPLIFY);
+  }
+}
+
+bool GraphColoringRegisterAllocator::ok(int t, int r) const {
+  return m_degree[t] < unsigned(NUM_MREGS) || is_precolored(t) || adjacent(t, r);
+}
+
+bool GraphColoringRegisterAllocator::conservative(int u, int v) {
+  std::unordered_set<int> seen;
+  unsigned k = 0;
+  auto count = [this, &seen, &k](int n) {
+    if (seen.insert(n).second && m_degree[n] >= unsigned(NUM_MREGS)) {
+      k++;
+    }
+  };
+  for_each_adjacent(u, count);
+  for_each_adjacent(v, count);
+  return k < unsigned(NUM_MREGS);
+}
+
+int GraphColoringRegisterAllocator::get_alias(int n) const {
+  while (m_state[n] == NODE_COALESCED) {
+    n = m_alias[n];
+  }
+  return n;
+}
+
+void GraphColoringRegisterAllocator::combine(int u, int v) {
+  set_state(v, NODE_COALESCED);
+  m_alias[v] = u;
+  m_move_list[u].insert(m_move_list[u].end(), m_move_list[v].begin(), m_move_list[v].end());
+  m_spill_cost[u] += m_spill_cost[v];
+  m_call_cost[u] += m_call_cost[v];
+  enable_moves(v);
+
+  std::vector<int> neighbors;
+  for_each_adjacent(v, [&neighbors](int t) { neighbors.push_back(t); });
+  for (auto i = neighbors.begin(); i != neighbors.end(); i++) {
+    add_edge(*i, u);
+    decrement_degree(*i);
+  }
+
+  if (m_degree[u] >= unsigned(NUM_MREGS) && m_state[u] == NODE_FREEZE) {
+    set_state(u, NODE_SPILL);
+  }
+}
+
+void GraphColoringRegisterAllocator::freeze() {
+  int u = *m_freeze_worklist.begin();
+  set_state(u, NODE_SIMPLIFY);
+  freeze_moves(u);
+}
+
+void GraphColoringRegisterAllocator::freeze_moves(int u) {
+  std::vector<int> moves;
+  for_each_node_move(u, [&moves](int index) { moves.push_back(index); });
+
+  for (auto i = moves.begin(); i != moves.end(); i++) {
+    Move &move = m_moves[*i];
+    int x = get_alias(move.dst), y = get_alias(move.src);
+    int v = (y == get_alias(u)) ? x : y;
+
+    if (move.state == MOVE_WORKLIST) {
+      m_worklist_moves.erase(*i);
+    }
+    move.state = MOVE_FROZEN;
+
+    if (m_state[v] == NODE_FREEZE && !is_move_related(v) && m_degree[v] < unsigned(NUM_MREGS)) {
+      set_state(v, NODE_SIMPLIFY);
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::select_spill() {
+  // prefer spilling cheap nodes that interfere with many others
+  int best = -1;
+  double best_metric = 0.0;
+  for (auto i = m_spill_worklist.begin(); i != m_spill_worklist.end(); i++) {
+    double metric = m_spill_cost[*i] / m_degree[*i];
+    if (best < 0 || metric < best_metric) {
+      best = *i;
+      best_metric = metric;
+    }
+  }
+  set_state(best, NODE_SIMPLIFY);
+  freeze_moves(best);
+}
+
+void GraphColoringRegisterAllocator::assign_colors() {
+  while (!m_select_stack.empty()) {
+    int n = m_select_stack.back();
+    m_select_stack.pop_back();
+
+    bool used[NUM_MREGS] = { false };
+    std::vector<int> &adj = m_adj_list[n];
+    for (auto i = adj.begin(); i != adj.end(); i++) {
+      int w = get_alias(*i);
+      if (m_state[w] == NODE_COLORED || m_state[w] == NODE_PRECOLORED) {
+        used[m_color[w]] = true;
+      }
+    }
+
+    // optimistic: a node pushed as a potential spill may still find
+    // a color
+    m_state[n] = NODE_SPILLED;
+    const std::vector<int> &order = m_call_cost[n] > 0.0 ? CALL_CROSSING_ORDER : ANY_MREG_ORDER;
+    for (auto i = order.begin(); i != order.end(); i++) {
+      if (used[*i]) {
+        continue;
+      }
+      // a caller-saved register costs a store and a load per call
+      // crossed; if that's worse than spilling, spill
+      if (!is_callee_saved(*i) && 2.0 * m_call_cost[n] >= m_spill_cost[n]) {
+        break;
+      }
+      m_state[n] = NODE_COLORED;
+      m_color[n] = *i;
+      break;
+    }
+  }
+
+  for (unsigned n = NUM_MREGS; n < m_num_nodes; n++) {
+    if (m_state[n] == NODE_COALESCED) {
+      m_color[n] = m_color[get_alias(int(n))];
+    }
+  }
+}
+
+void GraphColoringRegisterAllocator::set_state(int n, NodeState state) {
+  // keep the worklists in sync with node states
+  switch (m_state[n]) {
+  case NODE_SIMPLIFY: m_simplify_worklist.erase(n); break;
+  case NODE_FREEZE:   m_freeze_worklist.erase(n); break;
+  case NODE_SPILL:    m_spill_worklist.erase(n); break;
+  default: break;
+  }
+  m_state[n] = state;
+  switch (state) {
+  case NODE_SIMPLIFY: m_simplify_worklist.insert(n); break;
+  case NODE_FREEZE:   m_freeze_worklist.insert(n); break;
+  case NODE_SPILL:    m_spill_worklist.insert(n); break;
+  default: break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// StackSlotAllocator implementation
+////////////////////////////////////////////////////////////////////////
+
+StackSlotAllocator::StackSlotAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs, RegisterAllocator *allocator)
+  : m_cfg(cfg)
+  , m_live_vregs(live_vregs)
+  , m_allocator(allocator)
+  , m_spilled(live_vregs->get_num_vregs(), false)
+  , m_saved(live_vregs->get_num_vregs(), false)
+  , m_adj_list(live_vregs->get_num_vregs())
+  , m_weight(live_vregs->get_num_vregs(), 0.0)
+  , m_slot(live_vregs->get_num_vregs(), -1)
+  , m_num_slots(0) {
+}
+
+StackSlotAllocator::~StackSlotAllocator() {
+}
+
+void StackSlotAllocator::allocate() {
+  unsigned num_vregs = m_live_vregs->get_num_vregs();
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    m_spilled[vreg] = (m_allocator->get_mreg(int(vreg)) < 0);
+  }
+
+  LoopForest *loops = m_cfg->get_loop_forest();
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    BasicBlock *bb = *i;
+    double weight = 1.0;
+    for (unsigned d = 0; d < loops->get_depth(bb) && d < 8; d++) {
+      weight *= 10.0;
+    }
+    build_block(bb, weight);
+  }
+
+  // values live on entry were never written, but keep them apart anyway
+  BasicBlock *entry = m_cfg->get_entry_block();
+  const LiveVregs::LiveSet &live_in = m_live_vregs->get_fact_at_end_of_block(entry);
+  for (auto i = live_in.begin(); i != live_in.end(); ++i) {
+    for (auto j = i; j != live_in.end(); ++j) {
+      if (m_spilled[*i] && m_spilled[*j]) {
+        add_edge(int(*i), int(*j));
+      }
+    }
+  }
+
+  // only vregs that actually appear in the code get a slot
+  std::vector<int> order;
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    if (needs_slot(int(vreg)) && m_weight[vreg] > 0.0) {
+      order.push_back(int(vreg));
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [this](int a, int b) { return m_weight[a] > m_weight[b]; });
+
+  std::vector<unsigned> used_by; // slot -> last vreg (+1) that found it taken
+  for (auto i = order.begin(); i != order.end(); i++) {
+    int vreg = *i;
+    for (auto j = m_adj_list[vreg].begin(); j != m_adj_list[vreg].end(); j++) {
+      int slot = m_slot[*j];
+      if (slot >= 0) {
+        used_by[slot] = unsigned(vreg) + 1;
+      }
+    }
+    unsigned slot = 0;
+    while (slot < m_num_slots && used_by[slot] == unsigned(vreg) + 1) {
+      slot++;
+    }
+    if (slot == m_num_slots) {
+      m_num_slots++;
+      used_by.push_back(0);
+    }
+    m_slot[vreg] = int(slot);
+  }
+}
+
+int StackSlotAllocator::get_slot(int vreg) const {
+  if (vreg < 0 || unsigned(vreg) >= m_slot.size()) {
+    return -1;
+  }
+  return m_slot[vreg];
+}
+
+void StackSlotAllocator::build_block(BasicBlock *bb, double weight) {
+  LiveVregs::LiveSet live = m_live_vregs->get_fact_at_end_of_block(bb);
+
+  for (unsigned j = bb->get_length(); j > 0; j--) {
+    Instruction *ins = bb->get_instruction(j - 1);
+    int def = is_def(ins) ? ins->get_operand(0).get_base_reg() : -1;
+
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      Operand operand = ins->get_operand(k);
+      OperandKind kind = operand.get_kind();
+      if (kind != OPERAND_VREG && kind != OPERAND_VREG_MEMREF &&
+          kind != OPERAND_VREG_MEMREF_OFFSET && kind != OPERAND_VREG_MEMREF_INDEX) {
+        continue;
+      }
+      m_weight[operand.get_base_reg()] += m_spilled[operand.get_base_reg()] ? weight : 0.0;
+      if (operand.has_index_reg()) {
+        m_weight[operand.get_index_reg()] += m_spilled[operand.get_index_reg()] ? weight : 0.0;
+      }
+    }
+
+    // Around a call, the slots of the saved vregs hold their values:
+    // they are written before the call and read after it, so they
+    // overlap each other and every spilled value the call reads or
+    // writes or that is live after it.
+    std::vector<int> saved = m_allocator->get_saved_across_call(bb, j - 1);
+    if (!saved.empty()) {
+      LiveVregs::LiveSet overlapping = live;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        Operand operand = ins->get_operand(k);
+        if ((k == 0 && def >= 0) || is_use(ins, k)) {
+          overlapping.set(operand.get_base_reg());
+        }
+      }
+      for (auto i = saved.begin(); i != saved.end(); i++) {
+        m_saved[*i] = true;
+        m_weight[*i] += 2.0 * weight;
+        for (auto k = overlapping.begin(); k != overlapping.end(); ++k) {
+          if (m_spilled[*k]) {
+            add_edge(*i, int(*k));
+          }
+        }
+        for (auto k = saved.begin(); k != saved.end(); k++) {
+          add_edge(*i, *k);
+        }
+      }
+    }
+
+    int copy_src = -1;
+    if (ins->get_opcode() == HINS_MOV && ins->get_operand(1).get_kind() == OPERAND_VREG) {
+      // the source and destination of a copy hold the same value
+      copy_src = ins->get_operand(1).get_base_reg();
+    }
+
+    if (def >= 0) {
+      if (m_spilled[def]) {
+        for (auto k = live.begin(); k != live.end(); ++k) {
+          if (m_spilled[*k] && int(*k) != copy_src) {
+            add_edge(def, int(*k));
+          }
+        }
+      }
+      live.reset(def);
+    }
+
+    for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+      if (!is_use(ins, k)) {
+        continue;
+      }
+      Operand operand = ins->get_operand(k);
+      live.set(operand.get_base_reg());
+      if (operand.has_index_reg()) {
+        live.set(operand.get_index_reg());
+      }
+    }
+  }
+}
+
+void StackSlotAllocator::add_edge(int u, int v) {
+  if (u == v) {
+    return;
+  }
+  unsigned long key = (unsigned long)std::min(u, v) * m_slot.size() + std::max(u, v);
+  if (m_adj_set.insert(key).second) {
+    m_adj_list[u].push_back(v);
+    m_adj_list[v].push_back(u);
+  }
+}
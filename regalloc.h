@@ -0,0 +1,224 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <vector>
+#include <set>
+#include <unordered_set>
+#include "cfg.h"
+#include "live_vregs.h"
+#include "live_intervals.h"
+
+// Base class for register allocators.  An allocator assigns each vreg
+// either a machine register index (0..NUM_MREGS-1, see idx_to_register
+// in lowlevelgen.cpp) or -1, meaning that the vreg lives in its stack slot.
+//
+// Indices 0..2 (rcx, r8, r9) are caller-saved, so they don't need to
+// be saved by main, but are clobbered by calls (see is_call()); a vreg
+// assigned one of them that is live across a call is saved to its stack
+// slot before the call and restored after it.  Indices 3..7 (rbx,
+// r12..r15) are callee-saved.
+class RegisterAllocator {
+public:
+  static const int NUM_MREGS = 8;
+  static const int FIRST_CALLEE_SAVED = 3;
+
+protected:
+  ControlFlowGraph *m_cfg;
+  LiveVregs *m_live_vregs;
+  // assigned mreg index of each vreg (-1 if spilled or unused)
+  std::vector<int> m_assignment;
+  unsigned m_num_spilled;
+
+public:
+  RegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs);
+  virtual ~RegisterAllocator();
+
+  // assign mregs to vregs
+  virtual void allocate() = 0;
+
+  unsigned get_num_vregs() const { return unsigned(m_assignment.size()); }
+
+  // get the mreg index assigned to specified vreg (-1 if none)
+  int get_mreg(int vreg) const;
+
+  // get the vregs in caller-saved mregs that must be saved and restored
+  // around the instruction at specified index of a block (empty if the
+  // instruction isn't a call)
+  std::vector<int> get_saved_across_call(BasicBlock *bb, unsigned index) const;
+
+  // get the number of vregs that did not get a register
+  unsigned get_num_spilled() const { return m_num_spilled; }
+
+  // get the number of callee-saved registers the prologue must save:
+  // the prologue saves indices 7 down to (8 - result), so this covers
+  // the lowest-numbered callee-saved register in use
+  int get_max_mreg_use() const;
+
+  static bool is_callee_saved(int mreg) { return mreg >= FIRST_CALLEE_SAVED; }
+};
+
+// Linear-scan allocation over whole-function live intervals,
+// following Poletto & Sarkar, with the lifetime-hole handling of
+// Wimmer & Mossenboeck (a register is shared by intervals whose ranges
+// interleave).  Intervals are not split: when no register is free for
+// the whole of an interval, the interval (either the current one or the
+// ones occupying a register) whose next use is furthest away is spilled.
+class LinearScanRegisterAllocator : public RegisterAllocator {
+private:
+  LiveIntervals m_intervals;
+  std::vector<LiveInterval *> m_active, m_inactive;
+
+public:
+  LinearScanRegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs);
+  virtual ~LinearScanRegisterAllocator();
+
+  virtual void allocate();
+
+private:
+  void update_active_and_inactive(unsigned pos);
+  bool try_allocate_free_reg(LiveInterval *current, const std::vector<int> &candidates);
+  void allocate_blocked_reg(LiveInterval *current, const std::vector<int> &candidates);
+  void spill(LiveInterval *interval);
+};
+
+// Graph-coloring allocation by iterated register coalescing
+// (George & Appel): simplify, coalesce copies conservatively (Briggs's
+// test for two vregs, George's test against a machine register),
+// freeze, and pick potential spills by cost / degree, then assign colors
+// optimistically.  Nodes that can't be colored are spilled to their
+// stack slots; since the lowering reaches spilled vregs through scratch
+// registers, no rewrite-and-repeat step is needed.
+//
+// Nodes 0..NUM_MREGS-1 are precolored nodes standing for the machine
+// registers; node NUM_MREGS + n is vreg n.  Vregs live across a call
+// prefer callee-saved colors.
+class GraphColoringRegisterAllocator : public RegisterAllocator {
+private:
+  enum NodeState {
+    NODE_UNUSED,
+    NODE_PRECOLORED,
+    NODE_INITIAL,
+    NODE_SIMPLIFY,
+    NODE_FREEZE,
+    NODE_SPILL,
+    NODE_SPILLED,
+    NODE_COALESCED,
+    NODE_COLORED,
+    NODE_ON_STACK,
+  };
+
+  enum MoveState {
+    MOVE_WORKLIST,
+    MOVE_ACTIVE,
+    MOVE_COALESCED,
+    MOVE_CONSTRAINED,
+    MOVE_FROZEN,
+  };
+
+  struct Move {
+    int dst, src;
+    MoveState state;
+  };
+
+  unsigned m_num_nodes;
+  std::vector<NodeState> m_state;
+  std::vector<std::vector<int> > m_adj_list;
+  std::unordered_set<unsigned long> m_adj_set;
+  std::vector<unsigned> m_degree;
+  std::vector<std::vector<int> > m_move_list;
+  std::vector<int> m_alias;
+  std::vector<int> m_color;
+  // estimated cost of spilling each node (uses and defs weighted by
+  // loop depth)
+  std::vector<double> m_spill_cost;
+  // estimated cost of saving and restoring the node around the calls
+  // it is live across (zero if it doesn't cross a call)
+  std::vector<double> m_call_cost;
+
+  std::vector<Move> m_moves;
+  std::set<int> m_worklist_moves;
+  std::set<int> m_simplify_worklist, m_freeze_worklist, m_spill_worklist;
+  std::vector<int> m_select_stack;
+  unsigned m_num_coalesced_moves;
+
+public:
+  GraphColoringRegisterAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs);
+  virtual ~GraphColoringRegisterAllocator();
+
+  virtual void allocate();
+
+  // get the number of copies removed by coalescing
+  unsigned get_num_coalesced_moves() const { return m_num_coalesced_moves; }
+
+private:
+  static int vreg_node(int vreg) { return NUM_MREGS + vreg; }
+  bool is_precolored(int n) const { return m_state[n] == NODE_PRECOLORED; }
+
+  void build();
+  void build_block(BasicBlock *bb, double weight);
+  void add_edge(int u, int v);
+  bool adjacent(int u, int v) const;
+  void make_worklist();
+
+  template<typename Fn>
+  void for_each_adjacent(int n, Fn fn);
+  bool is_move_related(int n) const;
+  template<typename Fn>
+  void for_each_node_move(int n, Fn fn);
+
+  void simplify();
+  void decrement_degree(int m);
+  void enable_moves(int n);
+  void coalesce();
+  void add_worklist(int u);
+  bool ok(int t, int r) const;
+  bool conservative(int u, int v);
+  int get_alias(int n) const;
+  void combine(int u, int v);
+  void freeze();
+  void freeze_moves(int u);
+  void select_spill();
+  void assign_colors();
+
+  void set_state(int n, NodeState state);
+};
+
+// Assigns stack slots to the vregs that need one after register
+// allocation: vregs without an mreg, and vregs in caller-saved mregs
+// that are saved around calls.  Vregs whose slots are never live at the
+// same time share a slot, so the frame is sized by the number of
+// simultaneously-live spilled values rather than the number of vregs.
+// Slots are handed out greedily, most frequently accessed vregs
+// first, so the hottest slots are packed together at the bottom of
+// the frame.
+class StackSlotAllocator {
+private:
+  ControlFlowGraph *m_cfg;
+  LiveVregs *m_live_vregs;
+  RegisterAllocator *m_allocator;
+  // does the vreg live in memory, or is it saved around some call?
+  std::vector<bool> m_spilled, m_saved;
+  std::vector<std::vector<int> > m_adj_list;
+  std::unordered_set<unsigned long> m_adj_set;
+  std::vector<double> m_weight;
+  std::vector<int> m_slot;
+  unsigned m_num_slots;
+
+public:
+  StackSlotAllocator(ControlFlowGraph *cfg, LiveVregs *live_vregs, RegisterAllocator *allocator);
+  ~StackSlotAllocator();
+
+  void allocate();
+
+  // get the slot assigned to specified vreg (-1 if it doesn't need one)
+  int get_slot(int vreg) const;
+
+  unsigned get_num_slots() const { return m_num_slots; }
+
+private:
+  void build_block(BasicBlock *bb, double weight);
+  void add_edge(int u, int v);
+  bool needs_slot(int vreg) const { return m_spilled[vreg] || m_saved[vreg]; }
+};
+
+#endif // REGALLOC_H
@@ -0,0 +1,457 @@
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "dominators.h"
+#include "ssa.h"
+
+////////////////////////////////////////////////////////////////////////
+// SSABuilder implementation
+////////////////////////////////////////////////////////////////////////
+
+SSABuilder::SSABuilder(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_num_phis(0) {
+}
+
+SSABuilder::~SSABuilder() {
+}
+
+void SSABuilder::execute() {
+  // liveness of the original vregs, for pruning
+  LiveVregs live_vregs(m_cfg);
+  live_vregs.execute();
+
+  unsigned num_vregs = live_vregs.get_num_vregs();
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    m_orig_vreg.push_back(int(vreg));
+  }
+  m_names.resize(num_vregs);
+
+  place_phis(&live_vregs);
+  rename();
+}
+
+void SSABuilder::place_phis(LiveVregs *live_vregs) {
+  DominatorTree *dom = m_cfg->get_dominator_tree();
+  const std::vector<BasicBlock *> &rpo = dom->get_rpo();
+  unsigned num_vregs = unsigned(m_names.size());
+  unsigned num_blocks = m_cfg->get_num_blocks();
+
+  // blocks defining each vreg
+  std::vector<std::vector<BasicBlock *> > def_blocks(num_vregs);
+  for (auto i = rpo.begin(); i != rpo.end(); i++) {
+    BasicBlock *bb = *i;
+    for (auto j = bb->cbegin(); j != bb->cend(); j++) {
+      if (is_def(*j)) {
+        std::vector<BasicBlock *> &blocks = def_blocks[(*j)->get_operand(0).get_base_reg()];
+        if (blocks.empty() || blocks.back() != bb) {
+          blocks.push_back(bb);
+        }
+      }
+    }
+  }
+
+  // for each vreg, find the iterated dominance frontier of its defs
+  // (a phi is a def too); has_phi and queued hold the last vreg for
+  // which a block got a phi or was put on the work list, so they
+  // needn't be cleared between vregs
+  std::vector<std::vector<int> > phi_vregs(num_blocks);
+  std::vector<int> has_phi(num_blocks, -1), queued(num_blocks, -1);
+  for (unsigned vreg = 0; vreg < num_vregs; vreg++) {
+    std::vector<BasicBlock *> work(def_blocks[vreg]);
+    for (auto i = work.begin(); i != work.end(); i++) {
+      queued[(*i)->get_id()] = int(vreg);
+    }
+    while (!work.empty()) {
+      BasicBlock *bb = work.back();
+      work.pop_back();
+      const std::vector<BasicBlock *> &frontier = dom->get_frontier(bb);
+      for (auto i = frontier.begin(); i != frontier.end(); i++) {
+        BasicBlock *join = *i;
+        unsigned id = join->get_id();
+        if (has_phi[id] == int(vreg) ||
+            !live_vregs->get_fact_at_beginning_of_block(join).test(vreg)) {
+          continue;
+        }
+        has_phi[id] = int(vreg);
+        phi_vregs[id].push_back(int(vreg));
+        if (queued[id] != int(vreg)) {
+          queued[id] = int(vreg);
+          work.push_back(join);
+        }
+      }
+    }
+  }
+
+  // every operand of a new phi names the original vreg until the
+  // renaming fills in the value on the corresponding edge
+  for (unsigned id = 0; id < num_blocks; id++) {
+    BasicBlock *bb = m_cfg->get_block(id);
+    unsigned num_preds = unsigned(m_cfg->get_incoming_edges(bb).size());
+    for (unsigned i = 0; i < phi_vregs[id].size(); i++) {
+      Operand vreg(OPERAND_VREG, phi_vregs[id][i]);
+      Instruction *phi = new Instruction(HINS_PHI, vreg);
+      for (unsigned j = 0; j < num_preds; j++) {
+        phi->add_operand(vreg);
+      }
+      bb->insert_instruction(i, phi);
+      m_num_phis++;
+    }
+  }
+}
+
+void SSABuilder::rename() {
+  // preorder walk over the dominator tree (iteratively, since the tree
+  // can be very deep); the names pushed by a block are popped once
+  // all of the blocks it dominates have been renamed
+  DominatorTree *dom = m_cfg->get_dominator_tree();
+  std::vector<std::pair<BasicBlock *, unsigned> > stack;
+  std::vector<std::vector<int> > pushed;
+
+  BasicBlock *entry = m_cfg->get_entry_block();
+  stack.push_back(std::make_pair(entry, 0U));
+  pushed.push_back(std::vector<int>());
+  rename_block(entry, pushed.back());
+
+  while (!stack.empty()) {
+    BasicBlock *bb = stack.back().first;
+    unsigned next_child = stack.back().second;
+    const std::vector<BasicBlock *> &children = dom->get_children(bb);
+
+    if (next_child < children.size()) {
+      stack.back().second++;
+      BasicBlock *child = children[next_child];
+      stack.push_back(std::make_pair(child, 0U));
+      pushed.push_back(std::vector<int>());
+      rename_block(child, pushed.back());
+    } else {
+      const std::vector<int> &vregs = pushed.back();
+      for (auto i = vregs.begin(); i != vregs.end(); i++) {
+        m_names[*i].pop_back();
+      }
+      pushed.pop_back();
+      stack.pop_back();
+    }
+  }
+}
+
+void SSABuilder::rename_block(BasicBlock *bb, std::vector<int> &pushed) {
+  for (auto i = bb->cbegin(); i != bb->cend(); i++) {
+    Instruction *ins = *i;
+
+    // phi operands are renamed from the predecessors
+    if (!is_phi(ins)) {
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (!is_use(ins, k)) {
+          continue;
+        }
+        Operand &operand = (*ins)[k];
+        operand.set_base_reg(current_name(operand.get_base_reg()));
+        if (operand.has_index_reg()) {
+          operand.set_index_reg(current_name(operand.get_index_reg()));
+        }
+      }
+    }
+
+    if (is_def(ins)) {
+      Operand &dest = (*ins)[0];
+      int vreg = dest.get_base_reg();
+      dest.set_base_reg(new_name(vreg));
+      pushed.push_back(vreg);
+    }
+  }
+
+  // fill in this block's operand of the successors' phis
+  const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+  for (auto i = outgoing_edges.cbegin(); i != outgoing_edges.cend(); i++) {
+    BasicBlock *succ = (*i)->get_target();
+    unsigned index = m_cfg->get_incoming_index(*i);
+    for (unsigned j = 0; j < succ->get_length() && is_phi(succ->get_instruction(j)); j++) {
+      Instruction *phi = succ->get_instruction(j);
+      int vreg = m_orig_vreg[phi->get_operand(0).get_base_reg()];
+      (*phi)[index + 1].set_base_reg(current_name(vreg));
+    }
+  }
+}
+
+int SSABuilder::current_name(int vreg) const {
+  const std::vector<int> &names = m_names[vreg];
+  return names.empty() ? vreg : names.back();
+}
+
+int SSABuilder::new_name(int vreg) {
+  int name = int(m_orig_vreg.size());
+  m_orig_vreg.push_back(vreg);
+  m_names[vreg].push_back(name);
+  return name;
+}
+
+////////////////////////////////////////////////////////////////////////
+// SSADestructor implementation
+////////////////////////////////////////////////////////////////////////
+
+SSADestructor::SSADestructor(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_next_vreg(0)
+  , m_num_split_edges(0) {
+}
+
+SSADestructor::~SSADestructor() {
+}
+
+void SSADestructor::execute() {
+  // temporaries for breaking copy cycles are numbered after the
+  // vregs already in use
+  m_next_vreg = int(count_vregs(m_cfg));
+
+  // (splitting edges adds blocks, which have no phis)
+  unsigned num_blocks = m_cfg->get_num_blocks();
+  for (unsigned id = 0; id < num_blocks; id++) {
+    destruct_block(m_cfg->get_block(id));
+  }
+}
+
+void SSADestructor::destruct_block(BasicBlock *bb) {
+  unsigned num_phis = 0;
+  while (num_phis < bb->get_length() && is_phi(bb->get_instruction(num_phis))) {
+    num_phis++;
+  }
+  if (num_phis == 0) {
+    return;
+  }
+
+  // (copy the edge list, since splitting edges changes it)
+  ControlFlowGraph::EdgeList incoming_edges = m_cfg->get_incoming_edges(bb);
+  for (unsigned j = 0; j < incoming_edges.size(); j++) {
+    Edge *e = incoming_edges[j];
+    BasicBlock *pred = e->get_source();
+
+    // nothing has a value yet on the edge from the entry block
+    if (pred->get_kind() == BASICBLOCK_ENTRY) {
+      continue;
+    }
+
+    std::vector<Copy> copies;
+    for (unsigned i = 0; i < num_phis; i++) {
+      Instruction *phi = bb->get_instruction(i);
+      int dest = phi->get_operand(0).get_base_reg();
+      Operand src = phi->get_operand(j + 1);
+      if (src.get_kind() == OPERAND_VREG && src.get_base_reg() == dest) {
+        continue;
+      }
+      copies.push_back(Copy(dest, src));
+    }
+    if (copies.empty()) {
+      continue;
+    }
+
+    if (m_cfg->get_outgoing_edges(pred).size() > 1) {
+      pred = split_edge(e);
+    }
+
+    // the copies go before the branch at the end of the predecessor
+    unsigned index = pred->get_length();
+    if (index > 0 && is_branch(pred->get_last())) {
+      index--;
+    }
+    std::vector<Instruction *> seq = sequentialize(copies);
+    for (auto i = seq.begin(); i != seq.end(); i++) {
+      pred->insert_instruction(index++, *i);
+    }
+  }
+
+  for (unsigned i = 0; i < num_phis; i++) {
+    bb->remove_instruction(0);
+  }
+}
+
+BasicBlock *SSADestructor::split_edge(Edge *e) {
+  BasicBlock *source = e->get_source(), *target = e->get_target();
+  EdgeKind kind = e->get_kind();
+  m_cfg->remove_edge(e);
+  m_num_split_edges++;
+
+  BasicBlock *middle = m_cfg->create_basic_block(BASICBLOCK_INTERIOR);
+  if (kind == EDGE_FALLTHROUGH) {
+    // the new block goes between the source and target
+    m_cfg->create_edge(source, middle, EDGE_FALLTHROUGH);
+    m_cfg->create_edge(middle, target, EDGE_FALLTHROUGH);
+  } else {
+    // the source branches to the new block, which jumps to the target
+    assert(target->has_label());
+    middle->set_label(target->get_label() + "_" + std::to_string(middle->get_id()));
+    middle->add_instruction(new Instruction(HINS_JUMP, Operand(target->get_label())));
+
+    Instruction *branch = source->get_last();
+    assert(is_branch(branch) && (*branch)[0].get_target_label() == target->get_label());
+    (*branch)[0] = Operand(middle->get_label());
+
+    m_cfg->create_edge(source, middle, EDGE_BRANCH);
+    m_cfg->create_edge(middle, target, EDGE_BRANCH);
+  }
+  return middle;
+}
+
+std::vector<Instruction *> SSADestructor::sequentialize(const std::vector<Copy> &copies) {
+  std::vector<Instruction *> result;
+
+  // register-to-register copies (by destination), and the number of
+  // pending copies reading each vreg
+  std::map<int, int> pending;
+  std::map<int, unsigned> readers;
+  std::vector<Copy> literal_copies;
+  for (auto i = copies.begin(); i != copies.end(); i++) {
+    if (i->second.get_kind() == OPERAND_VREG) {
+      pending[i->first] = i->second.get_base_reg();
+      readers[i->second.get_base_reg()]++;
+    } else {
+      literal_copies.push_back(*i);
+    }
+  }
+
+  // a copy can be done once no pending copy reads its destination
+  std::vector<int> ready;
+  for (auto i = pending.begin(); i != pending.end(); i++) {
+    if (readers[i->first] == 0) {
+      ready.push_back(i->first);
+    }
+  }
+
+  while (!pending.empty()) {
+    while (!ready.empty()) {
+      int dest = ready.back();
+      ready.pop_back();
+      int src = pending[dest];
+      result.push_back(new Instruction(HINS_MOV, Operand(OPERAND_VREG, dest), Operand(OPERAND_VREG, src)));
+      pending.erase(dest);
+      if (--readers[src] == 0 && pending.count(src) > 0) {
+        ready.push_back(src);
+      }
+    }
+    if (pending.empty()) {
+      break;
+    }
+
+    // the remaining copies form cycles: save one destination in a
+    // temporary, and have its readers read the temporary instead
+    int dest = pending.begin()->first;
+    int temp = m_next_vreg++;
+    result.push_back(new Instruction(HINS_MOV, Operand(OPERAND_VREG, temp), Operand(OPERAND_VREG, dest)));
+    for (auto i = pending.begin(); i != pending.end(); i++) {
+      if (i->second == dest) {
+        i->second = temp;
+        readers[temp]++;
+      }
+    }
+    readers[dest] = 0;
+    ready.push_back(dest);
+  }
+
+  // copies of literals go last, after every copy that reads their
+  // destinations
+  for (auto i = literal_copies.begin(); i != literal_copies.end(); i++) {
+    result.push_back(new Instruction(HINS_MOV, Operand(OPERAND_VREG, i->first), i->second));
+  }
+  return result;
+}
+
+void ssa_remove_edge(ControlFlowGraph *cfg, Edge *e) {
+  BasicBlock *target = e->get_target();
+  unsigned index = cfg->get_incoming_index(e);
+  for (unsigned i = 0; i < target->get_length() && is_phi(target->get_instruction(i)); i++) {
+    target->get_instruction(i)->remove_operand(index + 1);
+  }
+  cfg->remove_edge(e);
+}
+
+BasicBlock *ssa_create_preheader(ControlFlowGraph *cfg, BasicBlock *header) {
+  // the edges entering the loop are the ones from blocks the header
+  // doesn't dominate (the others are back edges)
+  DominatorTree *dom = cfg->get_dominator_tree();
+  std::vector<Edge *> entering;
+  const ControlFlowGraph::EdgeList &incoming_edges = cfg->get_incoming_edges(header);
+  for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+    if (!dom->dominates(header, (*i)->get_source())) {
+      entering.push_back(*i);
+    }
+  }
+  assert(!entering.empty());
+
+  for (auto i = entering.begin(); i != entering.end(); i++) {
+    if ((*i)->get_source()->get_kind() == BASICBLOCK_ENTRY) {
+      return nullptr;
+    }
+  }
+  BasicBlock *pred = entering.front()->get_source();
+  if (entering.size() == 1 && cfg->get_outgoing_edges(pred).size() == 1 &&
+      (pred->get_length() == 0 || !is_conditional_branch(pred->get_last()))) {
+    return pred;
+  }
+
+  BasicBlock *preheader = cfg->create_basic_block(BASICBLOCK_INTERIOR);
+  bool falls_through = false;
+  for (auto i = entering.begin(); i != entering.end(); i++) {
+    falls_through = falls_through || (*i)->get_kind() == EDGE_FALLTHROUGH;
+  }
+  if (header->has_label()) {
+    preheader->set_label(header->get_label() + "_" + std::to_string(preheader->get_id()));
+  }
+
+  // the value of each of the header's phis coming from the preheader:
+  // either the value they all have on the entering edges, or a phi
+  // merging them in the preheader
+  unsigned next_vreg = count_vregs(cfg);
+  std::vector<Operand> values;
+  for (unsigned i = 0; i < header->get_length() && is_phi(header->get_instruction(i)); i++) {
+    Instruction *phi = header->get_instruction(i);
+    Instruction *merge = new Instruction(HINS_PHI, Operand(OPERAND_VREG, int(next_vreg)));
+    bool same = true;
+    for (auto j = entering.begin(); j != entering.end(); j++) {
+      Operand operand = phi->get_operand(cfg->get_incoming_index(*j) + 1);
+      merge->add_operand(operand);
+      same = same && operand.get_kind() == merge->get_operand(1).get_kind() &&
+        (operand.get_kind() == OPERAND_VREG ? operand.get_base_reg() == merge->get_operand(1).get_base_reg()
+                                            : operand.get_int_value() == merge->get_operand(1).get_int_value());
+    }
+    if (same) {
+      values.push_back(merge->get_operand(1));
+      delete merge;
+    } else {
+      values.push_back(merge->get_operand(0));
+      preheader->add_instruction(merge);
+      next_vreg++;
+    }
+  }
+  if (preheader->get_length() == 0) {
+    // keep a placeholder for the block's label
+    preheader->add_instruction(new Instruction(HINS_EMPTY));
+  }
+
+  // redirect the entering edges (in order, to match the new phis'
+  // operands) to the preheader
+  for (auto i = entering.begin(); i != entering.end(); i++) {
+    BasicBlock *source = (*i)->get_source();
+    EdgeKind kind = (*i)->get_kind();
+    ssa_remove_edge(cfg, *i);
+    if (kind == EDGE_BRANCH) {
+      Instruction *branch = source->get_last();
+      assert(is_branch(branch) && (*branch)[0].get_target_label() == header->get_label());
+      (*branch)[0] = Operand(preheader->get_label());
+    }
+    cfg->create_edge(source, preheader, kind);
+  }
+
+  if (falls_through) {
+    cfg->create_edge(preheader, header, EDGE_FALLTHROUGH);
+  } else {
+    preheader->add_instruction(new Instruction(HINS_JUMP, Operand(header->get_label())));
+    cfg->create_edge(preheader, header, EDGE_BRANCH);
+  }
+  for (unsigned i = 0; i < values.size(); i++) {
+    header->get_instruction(i)->add_operand(values[i]);
+  }
+  return preheader;
+}
@@ -0,0 +1,95 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <vector>
+#include "cfg.h"
+#include "live_vregs.h"
+
+// Puts a high-level ControlFlowGraph into (pruned) SSA form, in place,
+// following Cytron et al.: a phi for a vreg is placed in the iterated
+// dominance frontier of the blocks defining it, but only where the
+// vreg is live on entry, and then every def gets a fresh vreg number
+// in a walk over the dominator tree.  Uses with no reaching def (e.g.,
+// of an uninitialized variable) keep the original vreg number.
+//
+// Phis (HINS_PHI) are placed at the beginning of their block; operand
+// k+1 of a phi is the value coming in on the block's k'th incoming edge,
+// so the CFG's edges must not be changed while it is in SSA form
+// (unless the phis are updated to match).  Blocks not reachable from
+// the entry block are left alone.
+class SSABuilder {
+private:
+  ControlFlowGraph *m_cfg;
+  // original vreg of each (new) vreg number
+  std::vector<int> m_orig_vreg;
+  // stack of current names of each original vreg during renaming
+  std::vector<std::vector<int> > m_names;
+  unsigned m_num_phis;
+
+public:
+  SSABuilder(ControlFlowGraph *cfg);
+  ~SSABuilder();
+
+  void execute();
+
+  // get the number of vregs used by the SSA form (one more than the
+  // highest vreg number)
+  unsigned get_num_vregs() const { return unsigned(m_orig_vreg.size()); }
+
+  // get the number of phis placed
+  unsigned get_num_phis() const { return m_num_phis; }
+
+private:
+  void place_phis(LiveVregs *live_vregs);
+  void rename();
+  void rename_block(BasicBlock *bb, std::vector<int> &pushed);
+  int current_name(int vreg) const;
+  int new_name(int vreg);
+};
+
+// Takes a ControlFlowGraph out of SSA form, in place: each phi
+// becomes a copy on each of its block's incoming edges.  The copies on
+// an edge happen in parallel (a phi may read the value another phi on
+// the same edge overwrites), so they are put into an order in which no
+// vreg is overwritten before it's read, with a temporary vreg to break
+// cycles.  Edges from a block with several successors (critical
+// edges) are split, so that copies only happen on the edge they
+// belong to.
+class SSADestructor {
+private:
+  // a copy dst <- src, where src is a vreg or an integer literal
+  typedef std::pair<int, Operand> Copy;
+
+  ControlFlowGraph *m_cfg;
+  int m_next_vreg;
+  unsigned m_num_split_edges;
+
+public:
+  SSADestructor(ControlFlowGraph *cfg);
+  ~SSADestructor();
+
+  void execute();
+
+  // get the number of critical edges that were split
+  unsigned get_num_split_edges() const { return m_num_split_edges; }
+
+private:
+  void destruct_block(BasicBlock *bb);
+  BasicBlock *split_edge(Edge *e);
+  std::vector<Instruction *> sequentialize(const std::vector<Copy> &copies);
+};
+
+// Remove an edge from a ControlFlowGraph in SSA form, along with the
+// operands of the target block's phis for that edge
+void ssa_remove_edge(ControlFlowGraph *cfg, Edge *e);
+
+// Get a preheader for a loop header in a ControlFlowGraph in SSA form:
+// a block whose only successor is the header, through which every edge
+// entering the loop from outside passes.  An existing block is used if
+// it qualifies; otherwise a new block is created and the entering edges
+// are redirected to it, with new phis for the values that differ
+// between them.  Returns null if the loop is entered from the entry
+// block (which can't hold instructions).
+BasicBlock *ssa_create_preheader(ControlFlowGraph *cfg, BasicBlock *header);
+
+#endif // SSA_H
@@ -0,0 +1,600 @@
+#include <cassert>
+#include <climits>
+#include <algorithm>
+#include "cfg.h"
+#include "highlevel.h"
+#include "live_vregs.h"
+#include "loops.h"
+#include "ssa.h"
+#include "dce.h"
+#include "strength_reduce.h"
+
+namespace {
+  bool fits_in_imm32(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+  }
+
+  bool is_literal(const Operand &operand) {
+    return operand.get_kind() == OPERAND_INT_LITERAL;
+  }
+
+  bool is_vreg(const Operand &operand) {
+    return operand.get_kind() == OPERAND_VREG;
+  }
+
+  // find the index of the instruction defining a vreg in a block
+  // (-1 if there is none)
+  int find_def(BasicBlock *bb, int vreg) {
+    for (unsigned i = 0; i < bb->get_length(); i++) {
+      Instruction *ins = bb->get_instruction(i);
+      if (is_def(ins) && ins->get_operand(0).get_base_reg() == vreg) {
+        return int(i);
+      }
+    }
+    return -1;
+  }
+
+  void remove_def(BasicBlock *bb, int vreg) {
+    assert(find_def(bb, vreg) >= 0);
+    bb->remove_instruction(unsigned(find_def(bb, vreg)));
+    if (bb->get_length() == 0) {
+      // keep a placeholder for the block's label
+      bb->add_instruction(new Instruction(HINS_EMPTY));
+    }
+  }
+}
+
+StrengthReduction::StrengthReduction(ControlFlowGraph *cfg)
+  : m_cfg(cfg)
+  , m_next_vreg(0)
+  , m_num_reduced(0)
+  , m_num_tests_replaced(0) {
+}
+
+StrengthReduction::~StrengthReduction() {
+}
+
+void StrengthReduction::execute() {
+  m_next_vreg = int(count_vregs(m_cfg));
+  find_defs();
+
+  // copy the loops, since creating preheaders discards the loop forest
+  const std::vector<Loop *> &loops = m_cfg->get_loop_forest()->get_loops();
+  std::vector<LoopBlocks> copies(loops.size());
+  for (unsigned i = 0; i < loops.size(); i++) {
+    copies[i].header = loops[i]->header;
+    copies[i].blocks.insert(loops[i]->blocks.begin(), loops[i]->blocks.end());
+    copies[i].parent = -1;
+    for (unsigned j = 0; j < i; j++) {
+      if (loops[j] == loops[i]->parent) {
+        copies[i].parent = int(j);
+      }
+    }
+  }
+
+  // inner loops first; an outer loop's derived induction variables
+  // include the bases of its inner loops' ones
+  std::vector<TestReplacement> replacements;
+  for (unsigned i = unsigned(copies.size()); i > 0; i--) {
+    LoopBlocks &loop = copies[i - 1];
+    unsigned num_blocks = m_cfg->get_num_blocks();
+    BasicBlock *preheader = ssa_create_preheader(m_cfg, loop.header);
+    if (preheader == nullptr) {
+      continue;
+    }
+    if (m_cfg->get_num_blocks() != num_blocks) {
+      m_def_block.resize(m_next_vreg, nullptr);
+      for (unsigned j = 0; j < preheader->get_length() && is_phi(preheader->get_instruction(j)); j++) {
+        int vreg = preheader->get_instruction(j)->get_operand(0).get_base_reg();
+        m_next_vreg = std::max(m_next_vreg, vreg + 1);
+        m_def_block.resize(m_next_vreg, nullptr);
+        m_def_block[vreg] = preheader;
+      }
+      for (int j = loop.parent; j >= 0; j = copies[j].parent) {
+        copies[j].blocks.insert(preheader);
+      }
+    }
+    reduce_loop(loop, preheader);
+
+    // remember an increasing derived induction variable of each
+    // counter, for replacing the exit test
+    for (auto j = m_reduced.begin(); j != m_reduced.end(); j++) {
+      int biv = std::get<0>(j->first);
+      long scale = std::get<2>(j->first);
+      if (scale > 0 && (replacements.empty() || replacements.back().loop != &loop ||
+                        replacements.back().biv.phi != biv)) {
+        TestReplacement r = { &loop, preheader, m_bivs[biv], scale, j->second };
+        replacements.push_back(r);
+      }
+    }
+  }
+
+  // the instructions computing the derived induction variables the
+  // old way are dead now; once they're gone, the counters that are
+  // only used by exit tests can be replaced
+  DeadCodeElimination dce(m_cfg);
+  dce.execute();
+
+  for (auto i = replacements.begin(); i != replacements.end(); i++) {
+    replace_test(*i);
+  }
+}
+
+void StrengthReduction::find_defs() {
+  m_def_block.assign(m_next_vreg, nullptr);
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      if (is_def(*j)) {
+        m_def_block[(*j)->get_operand(0).get_base_reg()] = *i;
+      }
+    }
+  }
+}
+
+void StrengthReduction::reduce_loop(const LoopBlocks &loop, BasicBlock *preheader) {
+  find_basic_ivs(loop);
+  if (m_bivs.empty()) {
+    return;
+  }
+  find_derived_ivs(loop);
+
+  // the values worth reducing: addresses (an invariant base plus a
+  // multiple of the counter), and multiples of the counter used for
+  // anything other than such an address
+  std::vector<BasicBlock *> blocks;
+  const std::vector<BasicBlock *> &rpo = m_cfg->get_dominator_tree()->get_rpo();
+  for (auto i = rpo.begin(); i != rpo.end(); i++) {
+    if (loop.blocks.count(*i) > 0) {
+      blocks.push_back(*i);
+    }
+  }
+
+  std::vector<std::pair<BasicBlock *, Instruction *> > candidates;
+  std::set<Instruction *> address_candidates;
+  for (auto i = blocks.begin(); i != blocks.end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      if (!is_def(ins) || is_phi(ins) || ins->get_opcode() == HINS_MOV) {
+        continue;
+      }
+      auto iv = m_ivs.find(ins->get_operand(0).get_base_reg());
+      if (iv != m_ivs.end() && iv->second.base >= 0 && iv->second.scale != 1 && iv->second.scale != 0) {
+        candidates.push_back(std::make_pair(*i, ins));
+        address_candidates.insert(ins);
+      }
+    }
+  }
+  for (auto i = blocks.begin(); i != blocks.end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      if (ins->get_opcode() != HINS_INT_MUL) {
+        continue;
+      }
+      int dest = ins->get_operand(0).get_base_reg();
+      auto iv = m_ivs.find(dest);
+      if (iv != m_ivs.end() && iv->second.base < 0 && iv->second.scale != 1 && iv->second.scale != 0 &&
+          has_other_uses(loop, dest, address_candidates)) {
+        candidates.push_back(std::make_pair(*i, ins));
+      }
+    }
+  }
+
+  for (auto i = candidates.begin(); i != candidates.end(); i++) {
+    Instruction *ins = i->second;
+    Operand dest = ins->get_operand(0);
+    DerivedIV iv = m_ivs[dest.get_base_reg()];
+    ReducedIV reduced = get_reduced_iv(loop, preheader, iv);
+    if (reduced.first < 0) {
+      continue;
+    }
+    if (iv.offset == 0) {
+      *ins = Instruction(HINS_MOV, dest, Operand(OPERAND_VREG, reduced.first));
+    } else {
+      *ins = Instruction(HINS_INT_ADD, dest, Operand(OPERAND_VREG, reduced.first), Operand(OPERAND_INT_LITERAL, iv.offset));
+    }
+    m_num_reduced++;
+  }
+}
+
+void StrengthReduction::find_basic_ivs(const LoopBlocks &loop) {
+  m_bivs.clear();
+  m_reduced.clear();
+
+  BasicBlock *header = loop.header;
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(header);
+  for (unsigned i = 0; i < header->get_length() && is_phi(header->get_instruction(i)); i++) {
+    Instruction *phi = header->get_instruction(i);
+    BasicIV biv;
+    biv.phi = phi->get_operand(0).get_base_reg();
+    biv.next = -1;
+
+    // one value coming into the loop, and the same vreg coming around
+    // every back edge
+    unsigned num_entering = 0;
+    bool ok = true;
+    for (unsigned k = 0; k < incoming_edges.size() && ok; k++) {
+      Operand operand = phi->get_operand(k + 1);
+      if (loop.blocks.count(incoming_edges[k]->get_source()) == 0) {
+        biv.init = operand;
+        num_entering++;
+      } else if (!is_vreg(operand) || (biv.next >= 0 && operand.get_base_reg() != biv.next)) {
+        ok = false;
+      } else {
+        biv.next = operand.get_base_reg();
+      }
+    }
+    if (!ok || num_entering != 1 || biv.next < 0 || unsigned(biv.next) >= m_def_block.size()) {
+      continue;
+    }
+    if (!is_literal(biv.init) && !is_vreg(biv.init)) {
+      continue;
+    }
+
+    // next = phi + step (or phi - step)
+    BasicBlock *bb = m_def_block[biv.next];
+    if (bb == nullptr || loop.blocks.count(bb) == 0 || !reassociate_increments(loop, biv.phi, biv.next)) {
+      continue;
+    }
+    Instruction *increment = bb->get_instruction(unsigned(find_def(bb, biv.next)));
+    if (increment->get_opcode() != HINS_INT_ADD && increment->get_opcode() != HINS_INT_SUB) {
+      continue;
+    }
+    Operand a = increment->get_operand(1), b = increment->get_operand(2);
+    if (increment->get_opcode() == HINS_INT_ADD && is_vreg(a) && a.get_base_reg() == biv.phi && is_literal(b)) {
+      biv.step = b.get_int_value();
+    } else if (increment->get_opcode() == HINS_INT_ADD && is_vreg(b) && b.get_base_reg() == biv.phi && is_literal(a)) {
+      biv.step = a.get_int_value();
+    } else if (increment->get_opcode() == HINS_INT_SUB && is_vreg(a) && a.get_base_reg() == biv.phi && is_literal(b)) {
+      biv.step = -b.get_int_value();
+    } else {
+      continue;
+    }
+    if (biv.step == 0 || !fits_in_imm32(biv.step)) {
+      continue;
+    }
+    biv.increment_block = bb;
+    m_bivs[biv.phi] = biv;
+  }
+}
+
+// a counter bumped more than once per iteration (e.g., in an unrolled
+// loop) is a chain of increments, next = ((phi + a) + b) + ...: make
+// each of them add to the phi instead, so next = phi + step, and the
+// values in between are derived induction variables (false if next
+// isn't computed that way)
+bool StrengthReduction::reassociate_increments(const LoopBlocks &loop, int phi, int next) {
+  std::vector<Instruction *> chain;
+  std::vector<long> steps;
+  for (int vreg = next; vreg != phi; ) {
+    if (unsigned(vreg) >= m_def_block.size() || m_def_block[vreg] == nullptr ||
+        loop.blocks.count(m_def_block[vreg]) == 0) {
+      return false;
+    }
+    BasicBlock *bb = m_def_block[vreg];
+    Instruction *increment = bb->get_instruction(unsigned(find_def(bb, vreg)));
+    Operand a = increment->get_operand(1);
+    Operand b = (increment->get_num_operands() > 2) ? increment->get_operand(2) : Operand();
+    if (increment->get_opcode() == HINS_INT_ADD && is_literal(a)) {
+      std::swap(a, b);
+    }
+    if ((increment->get_opcode() != HINS_INT_ADD && increment->get_opcode() != HINS_INT_SUB) ||
+        !is_vreg(a) || !is_literal(b)) {
+      return false;
+    }
+    chain.push_back(increment);
+    steps.push_back(increment->get_opcode() == HINS_INT_ADD ? b.get_int_value() : -b.get_int_value());
+    vreg = a.get_base_reg();
+  }
+  if (chain.size() < 2) {
+    return true;
+  }
+
+  long offset = 0;
+  for (auto i = steps.begin(); i != steps.end(); i++) {
+    offset += *i;
+    if (!fits_in_imm32(offset)) {
+      return false;
+    }
+  }
+  // (the chain runs from next back to the phi)
+  offset = 0;
+  for (unsigned i = unsigned(chain.size()); i > 0; i--) {
+    offset += steps[i - 1];
+    Operand dest = chain[i - 1]->get_operand(0);
+    *chain[i - 1] = Instruction(HINS_INT_ADD, dest, Operand(OPERAND_VREG, phi), Operand(OPERAND_INT_LITERAL, offset));
+  }
+  return true;
+}
+
+void StrengthReduction::find_derived_ivs(const LoopBlocks &loop) {
+  m_ivs.clear();
+  for (auto i = m_bivs.begin(); i != m_bivs.end(); i++) {
+    DerivedIV iv = { i->first, -1, 1, 0 };
+    m_ivs[i->first] = iv;
+    iv.offset = i->second.step;
+    m_ivs[i->second.next] = iv;
+  }
+
+  // (in dominator tree order, so operands are seen before their uses)
+  const std::vector<BasicBlock *> &rpo = m_cfg->get_dominator_tree()->get_rpo();
+  for (auto i = rpo.begin(); i != rpo.end(); i++) {
+    if (loop.blocks.count(*i) == 0) {
+      continue;
+    }
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      if (!is_def(ins) || is_phi(ins) || m_ivs.count(ins->get_operand(0).get_base_reg()) > 0) {
+        continue;
+      }
+      int opcode = ins->get_opcode();
+      if (opcode != HINS_MOV && opcode != HINS_INT_ADD && opcode != HINS_INT_SUB && opcode != HINS_INT_MUL) {
+        continue;
+      }
+
+      // which operand is an induction variable?
+      Operand a = ins->get_operand(1);
+      Operand b = opcode == HINS_MOV ? Operand() : ins->get_operand(2);
+      if (!(is_vreg(a) && m_ivs.count(a.get_base_reg()) > 0) && opcode != HINS_INT_SUB) {
+        std::swap(a, b);
+      }
+      if (!is_vreg(a) || m_ivs.count(a.get_base_reg()) == 0) {
+        continue;
+      }
+      DerivedIV iv = m_ivs[a.get_base_reg()];
+
+      if (opcode == HINS_MOV) {
+        // (same value)
+      } else if (opcode == HINS_INT_MUL && is_literal(b) && iv.base < 0) {
+        iv.scale *= b.get_int_value();
+        iv.offset *= b.get_int_value();
+      } else if (opcode == HINS_INT_ADD && is_literal(b)) {
+        iv.offset += b.get_int_value();
+      } else if (opcode == HINS_INT_SUB && is_literal(b)) {
+        iv.offset -= b.get_int_value();
+      } else if (opcode == HINS_INT_ADD && iv.base < 0 && is_vreg(b) && is_invariant(loop, b)) {
+        iv.base = b.get_base_reg();
+      } else {
+        continue;
+      }
+      if (fits_in_imm32(iv.scale) && fits_in_imm32(iv.offset)) {
+        m_ivs[ins->get_operand(0).get_base_reg()] = iv;
+      }
+    }
+  }
+}
+
+bool StrengthReduction::is_invariant(const LoopBlocks &loop, const Operand &operand) const {
+  if (is_literal(operand)) {
+    return true;
+  }
+  if (!is_vreg(operand)) {
+    return false;
+  }
+  unsigned vreg = unsigned(operand.get_base_reg());
+  return vreg < m_def_block.size() && (m_def_block[vreg] == nullptr || loop.blocks.count(m_def_block[vreg]) == 0);
+}
+
+bool StrengthReduction::has_other_uses(const LoopBlocks &loop, int vreg, const std::set<Instruction *> &candidates) const {
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      if (candidates.count(ins) > 0) {
+        continue;
+      }
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (!is_use(ins, int(k))) {
+          continue;
+        }
+        Operand operand = ins->get_operand(k);
+        if (operand.get_base_reg() == vreg || (operand.has_index_reg() && operand.get_index_reg() == vreg)) {
+          // (the counter's own derived values don't count)
+          if (is_def(ins) && m_ivs.count(ins->get_operand(0).get_base_reg()) > 0 &&
+              loop.blocks.count(*i) > 0 && !is_phi(ins)) {
+            continue;
+          }
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+StrengthReduction::ReducedIV StrengthReduction::get_reduced_iv(const LoopBlocks &loop, BasicBlock *preheader, const DerivedIV &iv) {
+  ReducedKey key(iv.biv, iv.base, iv.scale);
+  auto found = m_reduced.find(key);
+  if (found != m_reduced.end()) {
+    return found->second;
+  }
+
+  const BasicIV &biv = m_bivs[iv.biv];
+  long increment = iv.scale * biv.step;
+  if (!fits_in_imm32(increment) || (is_literal(biv.init) && !fits_in_imm32(iv.scale * biv.init.get_int_value()))) {
+    return ReducedIV(-1, -1);
+  }
+
+  // the initial value, base + scale*init, computed in the preheader
+  Operand init;
+  if (is_literal(biv.init)) {
+    init = Operand(OPERAND_INT_LITERAL, iv.scale * biv.init.get_int_value());
+  } else {
+    init = Operand(OPERAND_VREG, m_next_vreg++);
+    insert_in_preheader(preheader, new Instruction(HINS_INT_MUL, init, biv.init, Operand(OPERAND_INT_LITERAL, iv.scale)));
+  }
+  if (iv.base >= 0 && is_literal(init) && init.get_int_value() == 0) {
+    init = Operand(OPERAND_VREG, iv.base);
+  } else if (iv.base >= 0) {
+    Operand sum(OPERAND_VREG, m_next_vreg++);
+    insert_in_preheader(preheader, new Instruction(HINS_INT_ADD, sum, Operand(OPERAND_VREG, iv.base), init));
+    init = sum;
+  }
+
+  // the phi, and the increment next to the counter's
+  ReducedIV reduced(m_next_vreg, m_next_vreg + 1);
+  m_next_vreg += 2;
+  Instruction *phi = new Instruction(HINS_PHI, Operand(OPERAND_VREG, reduced.first));
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(loop.header);
+  for (auto i = incoming_edges.cbegin(); i != incoming_edges.cend(); i++) {
+    if (loop.blocks.count((*i)->get_source()) == 0) {
+      phi->add_operand(init);
+    } else {
+      phi->add_operand(Operand(OPERAND_VREG, reduced.second));
+    }
+  }
+  loop.header->insert_instruction(0, phi);
+
+  BasicBlock *bb = biv.increment_block;
+  bb->insert_instruction(unsigned(find_def(bb, biv.next)) + 1,
+                         new Instruction(HINS_INT_ADD, Operand(OPERAND_VREG, reduced.second),
+                                         Operand(OPERAND_VREG, reduced.first), Operand(OPERAND_INT_LITERAL, increment)));
+
+  m_def_block.resize(m_next_vreg, nullptr);
+  m_def_block[reduced.first] = loop.header;
+  m_def_block[reduced.second] = bb;
+  m_reduced[key] = reduced;
+  return reduced;
+}
+
+void StrengthReduction::replace_test(const TestReplacement &r) {
+  const LoopBlocks &loop = *r.loop;
+  const BasicIV &biv = r.biv;
+  BasicBlock *header = loop.header;
+  int phi_index = find_def(header, biv.phi);
+  int increment_index = find_def(biv.increment_block, biv.next);
+  if (phi_index < 0 || increment_index < 0) {
+    return;
+  }
+
+  // the loop's exit tests comparing the counter with an invariant
+  std::vector<std::pair<Instruction *, unsigned> > tests;
+  for (auto i = loop.blocks.begin(); i != loop.blocks.end(); i++) {
+    BasicBlock *bb = *i;
+    unsigned len = bb->get_length();
+    if (len < 2 || !is_conditional_branch(bb->get_last()) ||
+        bb->get_instruction(len - 2)->get_opcode() != HINS_INT_COMPARE) {
+      continue;
+    }
+    bool exits = false;
+    const ControlFlowGraph::EdgeList &outgoing_edges = m_cfg->get_outgoing_edges(bb);
+    for (auto j = outgoing_edges.cbegin(); j != outgoing_edges.cend(); j++) {
+      exits = exits || loop.blocks.count((*j)->get_target()) == 0;
+    }
+    Instruction *cmp = bb->get_instruction(len - 2);
+    for (unsigned k = 0; k < 2 && exits; k++) {
+      Operand operand = cmp->get_operand(k);
+      if (is_vreg(operand) && (operand.get_base_reg() == biv.phi || operand.get_base_reg() == biv.next) &&
+          is_invariant(loop, cmp->get_operand(1 - k))) {
+        tests.push_back(std::make_pair(cmp, k));
+        break;
+      }
+    }
+  }
+  if (tests.empty()) {
+    return;
+  }
+
+  // the counter must have no uses besides its own increment, its phi
+  // and the tests
+  std::vector<unsigned> num_uses(m_next_vreg, 0);
+  count_uses(num_uses);
+  unsigned num_phi_uses = 1, num_next_uses = 0;
+  Instruction *phi = header->get_instruction(unsigned(phi_index));
+  for (unsigned k = 1; k < phi->get_num_operands(); k++) {
+    if (is_vreg(phi->get_operand(k)) && phi->get_operand(k).get_base_reg() == biv.next) {
+      num_next_uses++;
+    }
+  }
+  for (auto i = tests.begin(); i != tests.end(); i++) {
+    if (i->first->get_operand(i->second).get_base_reg() == biv.phi) {
+      num_phi_uses++;
+    } else {
+      num_next_uses++;
+    }
+  }
+  if (num_uses[biv.phi] != num_phi_uses || num_uses[biv.next] != num_next_uses) {
+    return;
+  }
+
+  // the initial values of the counter and the derived induction
+  // variable, coming in from the preheader
+  const ControlFlowGraph::EdgeList &incoming_edges = m_cfg->get_incoming_edges(header);
+  int reduced_index = find_def(header, r.reduced.first);
+  unsigned entering = 0;
+  while (entering < incoming_edges.size() && incoming_edges[entering]->get_source() != r.preheader) {
+    entering++;
+  }
+  if (reduced_index < 0 || entering == incoming_edges.size()) {
+    return;
+  }
+  Operand init = phi->get_operand(entering + 1);
+  Operand reduced_init = header->get_instruction(unsigned(reduced_index))->get_operand(entering + 1);
+
+  // i <op> n is the same as p <op> p0 + scale*(n - i0), where p is
+  // base + scale*i, and p0 and i0 are the initial values of p and i
+  std::vector<Operand> limits;
+  for (auto i = tests.begin(); i != tests.end(); i++) {
+    Operand bound = i->first->get_operand(1 - i->second);
+    Operand diff = emit_in_preheader(r.preheader, HINS_INT_SUB, bound, init);
+    Operand scaled = emit_in_preheader(r.preheader, HINS_INT_MUL, diff, Operand(OPERAND_INT_LITERAL, r.scale));
+    Operand limit = emit_in_preheader(r.preheader, HINS_INT_ADD, reduced_init, scaled);
+    if (limit.get_kind() == OPERAND_NONE) {
+      // (the instructions already added are dead)
+      return;
+    }
+    limits.push_back(limit);
+  }
+
+  for (unsigned i = 0; i < tests.size(); i++) {
+    Instruction *cmp = tests[i].first;
+    unsigned k = tests[i].second;
+    bool is_next = cmp->get_operand(k).get_base_reg() == biv.next;
+    (*cmp)[k] = Operand(OPERAND_VREG, is_next ? r.reduced.second : r.reduced.first);
+    (*cmp)[1 - k] = limits[i];
+  }
+
+  remove_def(biv.increment_block, biv.next);
+  remove_def(header, biv.phi);
+  m_num_tests_replaced++;
+}
+
+void StrengthReduction::count_uses(std::vector<unsigned> &num_uses) const {
+  for (auto i = m_cfg->bb_begin(); i != m_cfg->bb_end(); i++) {
+    for (auto j = (*i)->cbegin(); j != (*i)->cend(); j++) {
+      Instruction *ins = *j;
+      for (unsigned k = 0; k < ins->get_num_operands(); k++) {
+        if (!is_use(ins, int(k))) {
+          continue;
+        }
+        Operand operand = ins->get_operand(k);
+        num_uses[operand.get_base_reg()]++;
+        if (operand.has_index_reg()) {
+          num_uses[operand.get_index_reg()]++;
+        }
+      }
+    }
+  }
+}
+
+Operand StrengthReduction::emit_in_preheader(BasicBlock *preheader, int opcode, Operand a, Operand b) {
+  if (a.get_kind() == OPERAND_NONE || b.get_kind() == OPERAND_NONE) {
+    return Operand();
+  }
+  if (is_literal(a) && is_literal(b)) {
+    // (the operands fit in 32 bits, so these can't overflow)
+    long result = opcode == HINS_INT_ADD ? a.get_int_value() + b.get_int_value()
+                : opcode == HINS_INT_SUB ? a.get_int_value() - b.get_int_value()
+                : a.get_int_value() * b.get_int_value();
+    return fits_in_imm32(result) ? Operand(OPERAND_INT_LITERAL, result) : Operand();
+  }
+  Operand dest(OPERAND_VREG, m_next_vreg++);
+  insert_in_preheader(preheader, new Instruction(opcode, dest, a, b));
+  return dest;
+}
+
+void StrengthReduction::insert_in_preheader(BasicBlock *preheader, Instruction *ins) {
+  unsigned index = preheader->get_length();
+  if (index > 0 && is_branch(preheader->get_last())) {
+    index--;
+  }
+  preheader->insert_instruction(index, ins);
+}
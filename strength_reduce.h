@@ -0,0 +1,108 @@
+#ifndef STRENGTH_REDUCE_H
+#define STRENGTH_REDUCE_H
+
+#include <vector>
+#include <set>
+#include <map>
+#include <tuple>
+#include "cfg.h"
+
+// Induction variable strength reduction over a high-level
+// ControlFlowGraph in SSA form (see SSABuilder).
+//
+// A basic induction variable is a phi in a loop header that is
+// incremented by a literal on each iteration ("i := i + 1", or several
+// of them in an unrolled loop).  Values computed in the loop as
+// base + scale*i + offset (with a loop invariant base, e.g. the
+// address of an array element a[i]) are derived induction variables:
+// instead of computing them with a multiply on every iteration, each
+// gets a phi of its own, initialized in the preheader and bumped by
+// scale*step next to the increment of i.  The multiplies and adds are
+// left for dead code elimination.
+//
+// If the only remaining use of a basic induction variable is then the
+// loop's exit test, the test is rewritten in terms of a derived
+// induction variable (linear function test replacement) and the
+// original counter is removed.
+class StrengthReduction {
+private:
+  // the parts of a Loop needed here (see LoopInvariantCodeMotion)
+  struct LoopBlocks {
+    BasicBlock *header;
+    std::set<BasicBlock *> blocks;
+    int parent;
+  };
+
+  // a basic induction variable: phi = phi(init, next), next = phi + step
+  struct BasicIV {
+    int phi;
+    int next;
+    long step;
+    Operand init;
+    BasicBlock *increment_block;
+  };
+
+  // an induction variable: base + scale*biv + offset (base is -1 if
+  // there is no base vreg)
+  struct DerivedIV {
+    int biv;
+    int base;
+    long scale;
+    long offset;
+  };
+
+  // a new induction variable for base + scale*biv: its phi, and its
+  // value on the next iteration
+  typedef std::tuple<int, int, long> ReducedKey;
+  typedef std::pair<int, int> ReducedIV;
+
+  // a loop whose exit test could be rewritten in terms of a derived
+  // induction variable (base + scale*biv, with scale > 0)
+  struct TestReplacement {
+    const LoopBlocks *loop;
+    BasicBlock *preheader;
+    BasicIV biv;
+    long scale;
+    ReducedIV reduced;
+  };
+
+  ControlFlowGraph *m_cfg;
+  int m_next_vreg;
+  // block containing the def of each vreg
+  std::vector<BasicBlock *> m_def_block;
+  // the current loop's basic and derived induction variables
+  std::map<int, BasicIV> m_bivs;
+  std::map<int, DerivedIV> m_ivs;
+  std::map<ReducedKey, ReducedIV> m_reduced;
+
+  unsigned m_num_reduced;
+  unsigned m_num_tests_replaced;
+
+public:
+  StrengthReduction(ControlFlowGraph *cfg);
+  ~StrengthReduction();
+
+  void execute();
+
+  // get the number of instructions replaced by new induction variables
+  unsigned get_num_reduced() const { return m_num_reduced; }
+
+  // get the number of loop exit tests rewritten (and counters removed)
+  unsigned get_num_tests_replaced() const { return m_num_tests_replaced; }
+
+private:
+  void find_defs();
+  void reduce_loop(const LoopBlocks &loop, BasicBlock *preheader);
+  void find_basic_ivs(const LoopBlocks &loop);
+  bool reassociate_increments(const LoopBlocks &loop, int phi, int next);
+  void find_derived_ivs(const LoopBlocks &loop);
+  bool is_invariant(const LoopBlocks &loop, const Operand &operand) const;
+  bool has_other_uses(const LoopBlocks &loop, int vreg, const std::set<Instruction *> &candidates) const;
+  ReducedIV get_reduced_iv(const LoopBlocks &loop, BasicBlock *preheader, const DerivedIV &iv);
+  void replace_test(const TestReplacement &r);
+  Operand emit_in_preheader(BasicBlock *preheader, int opcode, Operand a, Operand b);
+  void insert_in_preheader(BasicBlock *preheader, Instruction *ins);
+  void count_uses(std::vector<unsigned> &num_uses) const;
+};
+
+#endif // STRENGTH_REDUCE_H
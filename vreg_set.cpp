@@ -0,0 +1,313 @@
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include "vreg_set.h"
+
+////////////////////////////////////////////////////////////////////////
+// VregSet::const_iterator implementation
+////////////////////////////////////////////////////////////////////////
+
+VregSet::const_iterator::const_iterator(const VregSet *set, unsigned pos)
+  : m_set(set)
+  , m_pos(pos) {
+  skip_to_member();
+}
+
+unsigned VregSet::const_iterator::operator*() const {
+  return m_set->m_dense ? m_pos : m_set->m_elems[m_pos];
+}
+
+VregSet::const_iterator &VregSet::const_iterator::operator++() {
+  m_pos++;
+  skip_to_member();
+  return *this;
+}
+
+void VregSet::const_iterator::skip_to_member() {
+  if (!m_set->m_dense) {
+    // every position in the sparse representation is a member
+    return;
+  }
+
+  // find the next set bit at or after m_pos, a word at a time
+  unsigned end = m_set->num_words() * 64;
+  while (m_pos < end) {
+    uint64_t word = m_set->m_words[m_pos / 64] >> (m_pos % 64);
+    if (word != 0) {
+      m_pos += unsigned(__builtin_ctzll(word));
+      return;
+    }
+    m_pos = (m_pos / 64 + 1) * 64;
+  }
+  m_pos = end;
+}
+
+////////////////////////////////////////////////////////////////////////
+// VregSet implementation
+////////////////////////////////////////////////////////////////////////
+
+VregSet::VregSet(unsigned universe)
+  : m_universe(universe)
+  , m_dense(false) {
+}
+
+bool VregSet::test(unsigned vreg) const {
+  if (vreg >= m_universe) {
+    return false;
+  }
+  if (m_dense) {
+    return (m_words[vreg / 64] >> (vreg % 64)) & 1;
+  }
+  return std::binary_search(m_elems.begin(), m_elems.end(), vreg);
+}
+
+void VregSet::set(unsigned vreg) {
+  if (vreg >= m_universe) {
+    grow(vreg + 1);
+  }
+  if (m_dense) {
+    m_words[vreg / 64] |= uint64_t(1) << (vreg % 64);
+    return;
+  }
+  auto i = std::lower_bound(m_elems.begin(), m_elems.end(), vreg);
+  if (i == m_elems.end() || *i != vreg) {
+    m_elems.insert(i, vreg);
+    adjust_representation();
+  }
+}
+
+void VregSet::reset(unsigned vreg) {
+  if (vreg >= m_universe) {
+    return;
+  }
+  if (m_dense) {
+    m_words[vreg / 64] &= ~(uint64_t(1) << (vreg % 64));
+    return;
+  }
+  auto i = std::lower_bound(m_elems.begin(), m_elems.end(), vreg);
+  if (i != m_elems.end() && *i == vreg) {
+    m_elems.erase(i);
+  }
+}
+
+void VregSet::clear() {
+  m_dense = false;
+  m_elems.clear();
+  m_words.clear();
+}
+
+unsigned VregSet::count() const {
+  if (!m_dense) {
+    return unsigned(m_elems.size());
+  }
+  unsigned n = 0;
+  for (unsigned i = 0; i < m_words.size(); i++) {
+    n += unsigned(__builtin_popcountll(m_words[i]));
+  }
+  return n;
+}
+
+bool VregSet::any() const {
+  if (!m_dense) {
+    return !m_elems.empty();
+  }
+  uint64_t acc = 0;
+  for (unsigned i = 0; i < m_words.size(); i++) {
+    acc |= m_words[i];
+  }
+  return acc != 0;
+}
+
+VregSet &VregSet::operator|=(const VregSet &other) {
+  if (other.m_universe > m_universe) {
+    grow(other.m_universe);
+  }
+
+  if (!other.m_dense) {
+    if (other.m_elems.empty()) {
+      return *this;
+    }
+    if (m_dense) {
+      for (auto i = other.m_elems.begin(); i != other.m_elems.end(); i++) {
+        m_words[*i / 64] |= uint64_t(1) << (*i % 64);
+      }
+    } else {
+      std::vector<unsigned> merged;
+      merged.reserve(m_elems.size() + other.m_elems.size());
+      std::set_union(m_elems.begin(), m_elems.end(),
+                     other.m_elems.begin(), other.m_elems.end(),
+                     std::back_inserter(merged));
+      m_elems.swap(merged);
+      adjust_representation();
+    }
+    return *this;
+  }
+
+  // other is dense, so the union will be too
+  if (!m_dense) {
+    to_dense();
+  }
+  uint64_t *dst = m_words.data();
+  const uint64_t *src = other.m_words.data();
+  unsigned n = unsigned(other.m_words.size());
+  for (unsigned i = 0; i < n; i++) {
+    dst[i] |= src[i];
+  }
+  return *this;
+}
+
+VregSet &VregSet::operator&=(const VregSet &other) {
+  if (!m_dense) {
+    std::vector<unsigned> kept;
+    kept.reserve(m_elems.size());
+    for (auto i = m_elems.begin(); i != m_elems.end(); i++) {
+      if (other.test(*i)) {
+        kept.push_back(*i);
+      }
+    }
+    m_elems.swap(kept);
+    return *this;
+  }
+
+  if (other.m_dense) {
+    uint64_t *dst = m_words.data();
+    const uint64_t *src = other.m_words.data();
+    unsigned n = unsigned(std::min(m_words.size(), other.m_words.size()));
+    for (unsigned i = 0; i < n; i++) {
+      dst[i] &= src[i];
+    }
+    for (unsigned i = n; i < m_words.size(); i++) {
+      dst[i] = 0;
+    }
+  } else {
+    // the intersection is no larger than the sparse operand
+    VregSet result(m_universe);
+    for (auto i = other.m_elems.begin(); i != other.m_elems.end(); i++) {
+      if (test(*i)) {
+        result.m_elems.push_back(*i);
+      }
+    }
+    *this = result;
+  }
+  adjust_representation();
+  return *this;
+}
+
+VregSet &VregSet::subtract(const VregSet &other) {
+  if (!m_dense) {
+    std::vector<unsigned> kept;
+    kept.reserve(m_elems.size());
+    for (auto i = m_elems.begin(); i != m_elems.end(); i++) {
+      if (!other.test(*i)) {
+        kept.push_back(*i);
+      }
+    }
+    m_elems.swap(kept);
+    return *this;
+  }
+
+  if (other.m_dense) {
+    uint64_t *dst = m_words.data();
+    const uint64_t *src = other.m_words.data();
+    unsigned n = unsigned(std::min(m_words.size(), other.m_words.size()));
+    for (unsigned i = 0; i < n; i++) {
+      dst[i] &= ~src[i];
+    }
+  } else {
+    for (auto i = other.m_elems.begin(); i != other.m_elems.end(); i++) {
+      if (*i < m_universe) {
+        m_words[*i / 64] &= ~(uint64_t(1) << (*i % 64));
+      }
+    }
+  }
+  adjust_representation();
+  return *this;
+}
+
+bool VregSet::operator==(const VregSet &other) const {
+  if (m_dense && other.m_dense) {
+    // compare the common words, then make sure the longer
+    // set has no members beyond them
+    const std::vector<uint64_t> &shorter = m_words.size() < other.m_words.size() ? m_words : other.m_words;
+    const std::vector<uint64_t> &longer = m_words.size() < other.m_words.size() ? other.m_words : m_words;
+    uint64_t diff = 0;
+    for (unsigned i = 0; i < shorter.size(); i++) {
+      diff |= shorter[i] ^ longer[i];
+    }
+    for (unsigned i = unsigned(shorter.size()); i < longer.size(); i++) {
+      diff |= longer[i];
+    }
+    return diff == 0;
+  }
+
+  if (!m_dense && !other.m_dense) {
+    return m_elems == other.m_elems;
+  }
+
+  // mixed representations: the sets are equal if they have the same
+  // number of members and every member of the sparse one is in the dense one
+  const VregSet &sparse = m_dense ? other : *this;
+  const VregSet &dense = m_dense ? *this : other;
+  if (sparse.m_elems.size() != dense.count()) {
+    return false;
+  }
+  for (auto i = sparse.m_elems.begin(); i != sparse.m_elems.end(); i++) {
+    if (!dense.test(*i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+VregSet::const_iterator VregSet::begin() const {
+  return const_iterator(this, 0);
+}
+
+VregSet::const_iterator VregSet::end() const {
+  return const_iterator(this, m_dense ? num_words() * 64 : unsigned(m_elems.size()));
+}
+
+void VregSet::grow(unsigned universe) {
+  assert(universe >= m_universe);
+  m_universe = universe;
+  if (m_dense) {
+    m_words.resize(num_words(), 0);
+  }
+}
+
+void VregSet::to_dense() {
+  assert(!m_dense);
+  m_words.assign(num_words(), 0);
+  for (auto i = m_elems.begin(); i != m_elems.end(); i++) {
+    m_words[*i / 64] |= uint64_t(1) << (*i % 64);
+  }
+  m_elems.clear();
+  m_dense = true;
+}
+
+void VregSet::to_sparse() {
+  assert(m_dense);
+  std::vector<unsigned> elems;
+  for (auto i = begin(); i != end(); ++i) {
+    elems.push_back(*i);
+  }
+  m_words.clear();
+  m_dense = false;
+  m_elems.swap(elems);
+}
+
+void VregSet::adjust_representation() {
+  // A sorted vector costs 32 bits per member, a bit vector one bit per
+  // vreg in the universe.  Switch to whichever is smaller, with a factor
+  // of two of hysteresis so sets near the threshold don't flip back
+  // and forth.
+  if (!m_dense) {
+    if (uint64_t(m_elems.size()) * 32 >= m_universe && !m_elems.empty()) {
+      to_dense();
+    }
+  } else {
+    if (uint64_t(count()) * 64 < m_universe) {
+      to_sparse();
+    }
+  }
+}
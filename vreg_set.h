@@ -0,0 +1,83 @@
+#ifndef VREG_SET_H
+#define VREG_SET_H
+
+#include <cstdint>
+#include <vector>
+
+// A set of vreg numbers, sized at runtime.
+//
+// Small sets are represented sparsely, as a sorted vector of
+// vreg numbers.  Once a set becomes dense enough that a bit vector
+// would be smaller, it switches to a vector of 64-bit words (and
+// back again if it becomes sparse).  Dense unions and comparisons
+// are simple loops over contiguous words, which the compiler can
+// vectorize.
+//
+// The interface mirrors the subset of std::bitset used by the
+// dataflow analyses (test/set/reset, |=, ==), so code written against
+// a fixed-size bitset can use it without changes.
+class VregSet {
+public:
+  class const_iterator {
+  private:
+    const VregSet *m_set;
+    unsigned m_pos; // index into m_elems (sparse) or bit position (dense)
+
+  public:
+    const_iterator(const VregSet *set, unsigned pos);
+
+    unsigned operator*() const;
+    const_iterator &operator++();
+    bool operator==(const const_iterator &other) const { return m_pos == other.m_pos; }
+    bool operator!=(const const_iterator &other) const { return m_pos != other.m_pos; }
+
+  private:
+    void skip_to_member();
+  };
+
+private:
+  // number of vregs the set can hold without growing
+  unsigned m_universe;
+  bool m_dense;
+  // sorted member list (sparse representation)
+  std::vector<unsigned> m_elems;
+  // bit vector (dense representation)
+  std::vector<uint64_t> m_words;
+
+public:
+  VregSet(unsigned universe = 0);
+
+  unsigned get_universe() const { return m_universe; }
+  bool is_dense() const { return m_dense; }
+
+  bool test(unsigned vreg) const;
+  void set(unsigned vreg);
+  void reset(unsigned vreg);
+  void clear();
+
+  unsigned count() const;
+  bool any() const;
+  bool none() const { return !any(); }
+
+  VregSet &operator|=(const VregSet &other);
+  VregSet &operator&=(const VregSet &other);
+
+  // remove every member of other from this set
+  VregSet &subtract(const VregSet &other);
+
+  bool operator==(const VregSet &other) const;
+  bool operator!=(const VregSet &other) const { return !(*this == other); }
+
+  // iterate over the members in increasing order
+  const_iterator begin() const;
+  const_iterator end() const;
+
+private:
+  void grow(unsigned universe);
+  void to_dense();
+  void to_sparse();
+  void adjust_representation();
+  unsigned num_words() const { return (m_universe + 63) / 64; }
+};
+
+#endif // VREG_SET_H
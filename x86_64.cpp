@@ -30,6 +30,12 @@ std::string PrintX86_64InstructionSequence::get_opcode_name(int opcode) {
   case MINS_RET: return "ret";
   case MINS_PUSHQ: return "pushq";
   case MINS_POPQ: return "popq";
+  case MINS_SHLQ: return "shlq";
+  case MINS_SARQ: return "sarq";
+  case MINS_SHRQ: return "shrq";
+  case MINS_ANDQ: return "andq";
+  case MINS_NEGQ: return "negq";
+  case MINS_TESTQ: return "testq";
   
   default:
     assert(false);
@@ -89,6 +95,28 @@ bool X86_64ControlFlowGraphBuilder::falls_through(Instruction *ins) {
   return ins->get_opcode() != MINS_JMP;
 }
 
+X86_64BranchRewriter::X86_64BranchRewriter() {
+}
+
+X86_64BranchRewriter::~X86_64BranchRewriter() {
+}
+
+bool X86_64BranchRewriter::is_nop(Instruction *ins) {
+  return ins->get_opcode() == MINS_NOP || ins->get_opcode() == MINS_EPTY;
+}
+
+bool X86_64BranchRewriter::is_compare(Instruction *ins) {
+  return ins->get_opcode() == MINS_CMPQ || ins->get_opcode() == MINS_TESTQ;
+}
+
+Instruction *X86_64BranchRewriter::create_jump(const std::string &label) {
+  return new Instruction(MINS_JMP, Operand(label));
+}
+
+Instruction *X86_64BranchRewriter::create_inverted_branch(Instruction *branch, const std::string &label) {
+  return new Instruction(x86_64_invert_condition(branch->get_opcode()), Operand(label));
+}
+
 X86_64ControlFlowGraphPrinter::X86_64ControlFlowGraphPrinter(ControlFlowGraph *cfg)
   : ControlFlowGraphPrinter(cfg) {
 }
@@ -100,3 +128,17 @@ void X86_64ControlFlowGraphPrinter::print_basic_block(BasicBlock *bb) {
   PrintX86_64InstructionSequence print_iseq(bb);
   print_iseq.print();
 }
+
+int x86_64_invert_condition(int opcode) {
+  switch (opcode) {
+  case MINS_JE:  return MINS_JNE;
+  case MINS_JNE: return MINS_JE;
+  case MINS_JL:  return MINS_JGE;
+  case MINS_JLE: return MINS_JG;
+  case MINS_JG:  return MINS_JLE;
+  case MINS_JGE: return MINS_JL;
+  default:
+    assert(false);
+    return opcode;
+  }
+}
@@ -45,7 +45,13 @@ enum X86_64Instruction {
   MINS_RET,
   MINS_MOVL,
   MINS_PUSHQ,
-  MINS_POPQ
+  MINS_POPQ,
+  MINS_SHLQ,
+  MINS_SARQ,
+  MINS_SHRQ,
+  MINS_ANDQ,
+  MINS_NEGQ,
+  MINS_TESTQ
 };
 
 class PrintX86_64InstructionSequence : public PrintInstructionSequence {
@@ -65,6 +71,18 @@ public:
   virtual bool falls_through(Instruction *ins);
 };
 
+class X86_64BranchRewriter : public BranchRewriter {
+public:
+  X86_64BranchRewriter();
+  virtual ~X86_64BranchRewriter();
+
+  virtual bool is_nop(Instruction *ins);
+  virtual bool is_compare(Instruction *ins);
+
+  virtual Instruction *create_jump(const std::string &label);
+  virtual Instruction *create_inverted_branch(Instruction *branch, const std::string &label);
+};
+
 class X86_64ControlFlowGraphPrinter : public ControlFlowGraphPrinter {
 public:
   X86_64ControlFlowGraphPrinter(ControlFlowGraph *cfg);
@@ -73,4 +91,7 @@ public:
   virtual void print_basic_block(BasicBlock *bb);
 };
 
+// get the conditional jump taken exactly when the given one isn't
+int x86_64_invert_condition(int opcode);
+
 #endif // X86_64_H